@@ -0,0 +1,633 @@
+/*
+ * benchmark stage2 running as an ordinary process
+ *
+ * for every count, s2bench creates that many service directories (a
+ * share of them with a log/ subdirectory) and runs stage2 on them
+ * with a stub supervisor: s2bench itself, which stage2 spawns as
+ * SUPERVISE_PROG (see the stage2-bench target). a stub reports its
+ * start over a datagram socket and waits to be killed. the phases:
+ *
+ *   startup   until every stub has reported: the first scan, the
+ *             spawn rate
+ *   storm     every service stub killed at once, until all are back:
+ *             the reap latency, from the kill to the new stub's start
+ *             (the restart delay of stage2 included)
+ *   rescan    1% of the directories replaced by new ones and 'a' on
+ *             the control fifo, until the new stubs are up
+ *   shutdown  't' on the control fifo, until stage2 exits
+ *
+ * with the cpu time and the resident set size of stage2 after each.
+ * scan times are those stage2 exports in its metrics.
+ */
+
+#include "feat.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <skalibs/allreadwrite.h>
+#include <skalibs/sgetopt.h>
+#include <skalibs/types.h>
+#include <skalibs/strerr2.h>
+#include <s6/config.h>
+#include "s2ctl.h"
+
+#define USAGE			"s2bench [ -s stage2 ] [ -d dir ] [ -l logpercent ] [ -w timeout ] [ count ... ]"
+#define dieusage()		strerr_dieusage( 100, USAGE )
+
+/* set in the environment of stage2, and so of the stubs */
+#define SOCKET_VAR		"S2BENCH_SOCKET"
+#define STUB_NAME		"s2bench-supervise"
+#define CONTROL_FIFO		S6_SVSCAN_CTLDIR "/control"
+#define CONTROL_SOCKET		S6_SVSCAN_CTLDIR "/" S2CTL_SOCKET
+
+/* what a stub sends when it starts */
+struct report_s {
+  uint32_t idx ;
+  uint32_t islog ;
+  int32_t pid ;
+  uint64_t ns ;
+} ;
+
+struct svc_s {
+  pid_t pid [ 2 ] ;
+  /* last start reported, and when the storm killed it */
+  uint64_t up [ 2 ] ;
+  uint64_t killed ;
+} ;
+
+/* stage2 as seen from /proc */
+struct usage_s {
+  double cpu ;
+  unsigned long rss ;
+  unsigned long hwm ;
+} ;
+
+static char const * stage2 = "./stage2-bench" ;
+static char const * topdir = NULL ;
+static unsigned int logpct = 10 ;
+static unsigned int phasemax = 120 ;
+static struct svc_s * svcs ;
+static unsigned int nsvcs = 0 ;
+static int repfd = -1 ;
+
+static uint64_t now ( void )
+{
+  struct timespec ts ;
+
+  (void) clock_gettime ( CLOCK_MONOTONIC, & ts ) ;
+
+  return (uint64_t) ts . tv_sec * 1000000000 + ts . tv_nsec ;
+}
+
+static int haslog ( const unsigned int idx )
+{
+  return idx % 100 < logpct ;
+}
+
+/* The stub supervisor. stage2 runs it as s6-supervise with the
+   service directory (b<idx> or b<idx>/log) as argument. */
+
+static int stub ( int argc, char const * const * argv, char const * path )
+{
+  struct sockaddr_un sa ;
+  struct report_s m ;
+  unsigned int idx ;
+  size_t k ;
+  int fd ;
+
+  if ( 2 > argc || 'b' != argv [ 1 ] [ 0 ] ) { return 100 ; }
+
+  k = uint_scan ( argv [ 1 ] + 1, & idx ) ;
+  if ( ! k ) { return 100 ; }
+
+  m . idx = idx ;
+  m . islog = ! strcmp ( argv [ 1 ] + 1 + k, "/log" ) ;
+  m . pid = getpid () ;
+  m . ns = now () ;
+
+  memset ( & sa, 0, sizeof ( sa ) ) ;
+  sa . sun_family = AF_UNIX ;
+  if ( strlen ( path ) >= sizeof ( sa . sun_path ) ) { return 100 ; }
+  memcpy ( sa . sun_path, path, strlen ( path ) ) ;
+
+  fd = socket ( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) { return 111 ; }
+
+  /* blocks while the harness is behind, it catches up */
+  while ( sendto ( fd, & m, sizeof ( m ), 0, (struct sockaddr *) & sa, sizeof ( sa ) ) < 0 )
+    if ( EINTR != errno ) { return 111 ; }
+
+  (void) close ( fd ) ;
+
+  /* like s6-supervise, which keeps the directory busy */
+  if ( chdir ( argv [ 1 ] ) < 0 ) { return 111 ; }
+
+  /* killed by the storm or by stage2 at shutdown */
+  while ( 1 ) { (void) pause () ; }
+}
+
+/* The harness. */
+
+static void spawnwait ( char const * const * argv )
+{
+  pid_t pid = fork () ;
+  int wstat ;
+
+  if ( 0 > pid ) { strerr_diefu1sys ( 111, "fork" ) ; }
+
+  if ( ! pid ) {
+    (void) execvp ( argv [ 0 ], (char * const *) argv ) ;
+    _exit ( 127 ) ;
+  }
+
+  (void) waitpid ( pid, & wstat, 0 ) ;
+}
+
+static void mkservice ( char const * scan, const unsigned int idx )
+{
+  char fn [ strlen ( scan ) + UINT_FMT + 8 ] ;
+  size_t m = strlen ( scan ) ;
+
+  memcpy ( fn, scan, m ) ;
+  memcpy ( fn + m, "/b", 2 ) ; m += 2 ;
+  m += uint_fmt ( fn + m, idx ) ;
+  fn [ m ] = 0 ;
+
+  if ( mkdir ( fn, 0755 ) < 0 ) { strerr_diefu2sys ( 111, "mkdir ", fn ) ; }
+
+  if ( haslog ( idx ) ) {
+    memcpy ( fn + m, "/log", 5 ) ;
+    if ( mkdir ( fn, 0755 ) < 0 ) { strerr_diefu2sys ( 111, "mkdir ", fn ) ; }
+  }
+}
+
+static void rmservice ( char const * scan, const unsigned int idx )
+{
+  char fn [ strlen ( scan ) + UINT_FMT + 8 ] ;
+  size_t m = strlen ( scan ) ;
+
+  memcpy ( fn, scan, m ) ;
+  memcpy ( fn + m, "/b", 2 ) ; m += 2 ;
+  m += uint_fmt ( fn + m, idx ) ;
+  fn [ m ] = 0 ;
+
+  if ( haslog ( idx ) ) {
+    memcpy ( fn + m, "/log", 5 ) ;
+    if ( rmdir ( fn ) < 0 ) { strerr_warnwu2sys ( "rmdir ", fn ) ; }
+    fn [ m ] = 0 ;
+  }
+
+  if ( rmdir ( fn ) < 0 ) { strerr_warnwu2sys ( "rmdir ", fn ) ; }
+}
+
+/* the reports that came in until want did since the phase began, or
+ * until the phase timed out. returns how many came in.
+ */
+static unsigned int collect ( const unsigned int want, uint64_t * last )
+{
+  const uint64_t deadline = now () + (uint64_t) phasemax * 1000000000 ;
+  unsigned int got = 0 ;
+
+  while ( got < want ) {
+    struct pollfd p = { .fd = repfd, .events = POLLIN } ;
+    const uint64_t t = now () ;
+    struct report_s m ;
+
+    if ( t >= deadline ) { break ; }
+
+    if ( poll ( & p, 1, (int) ( ( deadline - t ) / 1000000 ) + 1 ) < 0 && EINTR != errno ) {
+      strerr_diefu1sys ( 111, "poll" ) ;
+    }
+
+    while ( got < want && recv ( repfd, & m, sizeof ( m ), 0 ) == sizeof ( m ) ) {
+      if ( m . idx >= nsvcs || 1 < m . islog ) { continue ; }
+
+      svcs [ m . idx ] . pid [ m . islog ] = m . pid ;
+      svcs [ m . idx ] . up [ m . islog ] = m . ns ;
+      if ( m . ns > * last ) { * last = m . ns ; }
+      ++ got ;
+    }
+  }
+
+  if ( got < want ) {
+    char fmt [ UINT_FMT ] ;
+
+    fmt [ uint_fmt ( fmt, want - got ) ] = 0 ;
+    strerr_warnw3x ( "phase timed out, stubs missing: ", fmt, " (see stage2.log)" ) ;
+  }
+
+  return got ;
+}
+
+/* cpu time, resident and peak resident set of a process, from /proc.
+ * a zombie has no memory left: the peak seen before is kept.
+ */
+static void usage ( const pid_t pid, struct usage_s * u )
+{
+  const unsigned long hwm = u -> hwm ;
+  char fn [ 32 ] ;
+  char buf [ 4096 ] ;
+  ssize_t r ;
+  int fd ;
+
+  memset ( u, 0, sizeof ( * u ) ) ;
+  u -> hwm = hwm ;
+
+  (void) snprintf ( fn, sizeof ( fn ), "/proc/%ld/stat", (long) pid ) ;
+  fd = open ( fn, O_RDONLY | O_CLOEXEC ) ;
+
+  if ( 0 <= fd ) {
+    r = read ( fd, buf, sizeof ( buf ) - 1 ) ;
+    (void) close ( fd ) ;
+
+    if ( 0 < r ) {
+      char const * p ;
+      unsigned long ut, st ;
+
+      buf [ r ] = 0 ;
+      /* utime and stime are the 12th and 13th fields after the name */
+      p = strrchr ( buf, ')' ) ;
+      if ( p && 2 == sscanf ( p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", & ut, & st ) ) {
+        u -> cpu = (double) ( ut + st ) / sysconf ( _SC_CLK_TCK ) ;
+      }
+    }
+  }
+
+  (void) snprintf ( fn, sizeof ( fn ), "/proc/%ld/status", (long) pid ) ;
+  fd = open ( fn, O_RDONLY | O_CLOEXEC ) ;
+
+  if ( 0 <= fd ) {
+    r = read ( fd, buf, sizeof ( buf ) - 1 ) ;
+    (void) close ( fd ) ;
+
+    if ( 0 < r ) {
+      char const * p ;
+
+      buf [ r ] = 0 ;
+      if ( ( p = strstr ( buf, "VmRSS:" ) ) ) { u -> rss = strtoul ( p + 6, NULL, 10 ) ; }
+      if ( ( p = strstr ( buf, "VmHWM:" ) ) && strtoul ( p + 6, NULL, 10 ) > u -> hwm ) { u -> hwm = strtoul ( p + 6, NULL, 10 ) ; }
+    }
+  }
+}
+
+/* the value of a metric stage2 exports, -1 if it cannot be had */
+static double metric ( char const * scan, char const * name )
+{
+  struct sockaddr_un sa ;
+  struct s2ctl_hdr_s h = { 0, S2CTL_METRICS, 0, 0 } ;
+  const size_t len = strlen ( scan ) ;
+  const size_t nlen = strlen ( name ) ;
+  double v = -1 ;
+  char * body ;
+  int fd ;
+
+  memset ( & sa, 0, sizeof ( sa ) ) ;
+  sa . sun_family = AF_UNIX ;
+  if ( len + sizeof ( "/" CONTROL_SOCKET ) > sizeof ( sa . sun_path ) ) { return -1 ; }
+  memcpy ( sa . sun_path, scan, len ) ;
+  memcpy ( sa . sun_path + len, "/" CONTROL_SOCKET, sizeof ( "/" CONTROL_SOCKET ) ) ;
+
+  fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  if ( connect ( fd, (struct sockaddr *) & sa, sizeof ( sa ) ) < 0
+    || allwrite ( fd, (char const *) & h, sizeof ( h ) ) < sizeof ( h )
+    || allread ( fd, (char *) & h, sizeof ( h ) ) < sizeof ( h ) || S2CTL_OK != h . arg ) {
+    (void) close ( fd ) ;
+    return -1 ;
+  }
+
+  body = malloc ( h . len + 1 ) ;
+
+  if ( body && allread ( fd, body, h . len ) == h . len ) {
+    char const * p = body ;
+
+    body [ h . len ] = 0 ;
+
+    for ( ; p ; p = strchr ( p, '\n' ) ? strchr ( p, '\n' ) + 1 : NULL ) {
+      if ( ! strncmp ( p, name, nlen ) && ' ' == p [ nlen ] ) {
+        v = strtod ( p + nlen + 1, NULL ) ;
+        break ;
+      }
+    }
+  }
+
+  free ( body ) ;
+  (void) close ( fd ) ;
+
+  return v ;
+}
+
+static void control ( char const * scan, char const * cmd )
+{
+  char fn [ strlen ( scan ) + sizeof ( "/" CONTROL_FIFO ) ] ;
+  int fd ;
+
+  memcpy ( fn, scan, strlen ( scan ) ) ;
+  memcpy ( fn + strlen ( scan ), "/" CONTROL_FIFO, sizeof ( "/" CONTROL_FIFO ) ) ;
+
+  fd = open ( fn, O_WRONLY | O_NONBLOCK | O_CLOEXEC ) ;
+  if ( 0 > fd ) { strerr_diefu2sys ( 111, "open ", fn ) ; }
+  if ( write ( fd, cmd, strlen ( cmd ) ) < (ssize_t) strlen ( cmd ) ) { strerr_diefu2sys ( 111, "write to ", fn ) ; }
+  (void) close ( fd ) ;
+}
+
+static int cmp64 ( void const * a, void const * b )
+{
+  const uint64_t x = * (uint64_t const *) a, y = * (uint64_t const *) b ;
+
+  return ( x > y ) - ( x < y ) ;
+}
+
+static void show_usage ( struct usage_s const * u )
+{
+  (void) printf ( "  cpu %.2f s  rss %lu kB (peak %lu kB)\n", u -> cpu, u -> rss, u -> hwm ) ;
+}
+
+/* one run of stage2 on count services */
+static void bench ( const unsigned int count )
+{
+  const unsigned int nchange = count / 100 ? count / 100 : 1 ;
+  const size_t tlen = strlen ( topdir ) ;
+  char base [ tlen + UINT_FMT + 2 ] ;
+  char scan [ tlen + UINT_FMT + 8 ] ;
+  char sock [ tlen + UINT_FMT + 16 ] ;
+  char bin [ tlen + 8 ] ;
+  struct sockaddr_un sa ;
+  struct usage_s u = { 0 } ;
+  uint64_t t0, last = 0 ;
+  unsigned int k, nlog = 0, nnewlog = 0 ;
+  pid_t pid ;
+  int wstat ;
+
+  (void) snprintf ( base, sizeof ( base ), "%s/%u", topdir, count ) ;
+  (void) snprintf ( scan, sizeof ( scan ), "%s/scan", base ) ;
+  (void) snprintf ( sock, sizeof ( sock ), "%s/report", base ) ;
+  (void) snprintf ( bin, sizeof ( bin ), "%s/bin", topdir ) ;
+
+  nsvcs = count + nchange ;
+  svcs = calloc ( nsvcs, sizeof ( struct svc_s ) ) ;
+  if ( ! svcs ) { strerr_diefu1sys ( 111, "allocate memory" ) ; }
+
+  if ( mkdir ( base, 0755 ) < 0 || mkdir ( scan, 0755 ) < 0 ) { strerr_diefu2sys ( 111, "mkdir ", base ) ; }
+
+  {
+    char fn [ sizeof ( scan ) + 32 ] ;
+    int fd ;
+
+    (void) snprintf ( fn, sizeof ( fn ), "%s/" S6_SVSCAN_CTLDIR, scan ) ;
+    if ( mkdir ( fn, 0755 ) < 0 ) { strerr_diefu2sys ( 111, "mkdir ", fn ) ; }
+
+    /* what stage2 execs once it is done */
+    (void) snprintf ( fn, sizeof ( fn ), "%s/" S6_SVSCAN_CTLDIR "/finish", scan ) ;
+    fd = open ( fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755 ) ;
+    if ( 0 > fd || write ( fd, "#!/bin/sh\nexit 0\n", 17 ) < 17 ) { strerr_diefu2sys ( 111, "create ", fn ) ; }
+    (void) close ( fd ) ;
+  }
+
+  for ( k = 0 ; k < count ; ++ k ) {
+    mkservice ( scan, k ) ;
+    nlog += haslog ( k ) ;
+  }
+
+  for ( k = count ; k < nsvcs ; ++ k ) { nnewlog += haslog ( k ) ; }
+
+  memset ( & sa, 0, sizeof ( sa ) ) ;
+  sa . sun_family = AF_UNIX ;
+  if ( strlen ( sock ) >= sizeof ( sa . sun_path ) ) { strerr_dief2x ( 100, "directory name too long: ", topdir ) ; }
+  memcpy ( sa . sun_path, sock, strlen ( sock ) ) ;
+
+  repfd = socket ( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > repfd || bind ( repfd, (struct sockaddr *) & sa, sizeof ( sa ) ) < 0 ) { strerr_diefu2sys ( 111, "bind ", sock ) ; }
+
+  {
+    int sz = 4 << 20 ;
+
+    (void) setsockopt ( repfd, SOL_SOCKET, SO_RCVBUF, & sz, sizeof ( sz ) ) ;
+  }
+
+  (void) printf ( "%u services, %u with log/\n", count, nlog ) ;
+  (void) fflush ( stdout ) ;
+
+  /* startup */
+  t0 = now () ;
+  pid = fork () ;
+  if ( 0 > pid ) { strerr_diefu1sys ( 111, "fork" ) ; }
+
+  if ( ! pid ) {
+    char cap [ UINT_FMT ] ;
+    char logfn [ sizeof ( base ) + 16 ] ;
+    char const * argv [ 7 ] = { stage2, "-t", "0", "-c", cap, ".", 0 } ;
+    char const * path = getenv ( "PATH" ) ;
+    char * env ;
+    int fd ;
+
+    cap [ uint_fmt ( cap, nsvcs + 1 ) ] = 0 ;
+
+    /* stage2 spawns STUB_NAME by its name */
+    env = malloc ( strlen ( bin ) + ( path ? strlen ( path ) : 0 ) + 2 ) ;
+    if ( ! env ) { _exit ( 111 ) ; }
+    (void) sprintf ( env, "%s%s%s", bin, path ? ":" : "", path ? path : "" ) ;
+    if ( setenv ( "PATH", env, 1 ) < 0 || setenv ( SOCKET_VAR, sock, 1 ) < 0 ) { _exit ( 111 ) ; }
+
+    (void) snprintf ( logfn, sizeof ( logfn ), "%s/stage2.log", base ) ;
+    fd = open ( logfn, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ;
+    if ( 0 <= fd ) {
+      (void) dup2 ( fd, 1 ) ;
+      (void) dup2 ( fd, 2 ) ;
+      (void) close ( fd ) ;
+    }
+
+    if ( chdir ( scan ) < 0 ) { _exit ( 111 ) ; }
+    (void) execv ( stage2, (char * const *) argv ) ;
+    _exit ( 127 ) ;
+  }
+
+  k = collect ( count + nlog, & last ) ;
+  usage ( pid, & u ) ;
+  (void) printf ( "  startup   %8.3f s  %.0f spawns/s  first scan %.3f s\n",
+    ( last - t0 ) / 1e9, k / ( ( last > t0 ? last - t0 : 1 ) / 1e9 ), metric ( scan, "stage2_scan_seconds_last" ) ) ;
+  show_usage ( & u ) ;
+
+  /* the storm: every service killed at once */
+  {
+    uint64_t * lat = calloc ( count ? count : 1, sizeof ( uint64_t ) ) ;
+    unsigned int nlat = 0, nkilled = 0 ;
+
+    if ( ! lat ) { strerr_diefu1sys ( 111, "allocate memory" ) ; }
+
+    t0 = now () ;
+    last = t0 ;
+
+    for ( k = 0 ; k < count ; ++ k ) {
+      if ( ! svcs [ k ] . pid [ 0 ] ) { continue ; }
+      svcs [ k ] . killed = now () ;
+      (void) kill ( svcs [ k ] . pid [ 0 ], SIGTERM ) ;
+      ++ nkilled ;
+    }
+
+    (void) collect ( nkilled, & last ) ;
+    usage ( pid, & u ) ;
+
+    for ( k = 0 ; k < count ; ++ k ) {
+      if ( svcs [ k ] . killed && svcs [ k ] . up [ 0 ] > svcs [ k ] . killed ) {
+        lat [ nlat ++ ] = svcs [ k ] . up [ 0 ] - svcs [ k ] . killed ;
+      }
+    }
+
+    qsort ( lat, nlat, sizeof ( uint64_t ), cmp64 ) ;
+
+    (void) printf ( "  storm     %8.3f s  %u restarted  reap latency p50 %.1f ms p99 %.1f ms max %.1f ms\n",
+      ( last - t0 ) / 1e9, nlat,
+      nlat ? lat [ nlat / 2 ] / 1e6 : 0, nlat ? lat [ nlat * 99 / 100 ] / 1e6 : 0, nlat ? lat [ nlat - 1 ] / 1e6 : 0 ) ;
+    show_usage ( & u ) ;
+    free ( lat ) ;
+  }
+
+  /* rescan: 1% of the directories replaced */
+  for ( k = 0 ; k < nchange && k < count ; ++ k ) { rmservice ( scan, k ) ; }
+  for ( k = count ; k < nsvcs ; ++ k ) { mkservice ( scan, k ) ; }
+
+  t0 = now () ;
+  last = t0 ;
+  control ( scan, "a" ) ;
+  (void) collect ( nchange + nnewlog, & last ) ;
+  usage ( pid, & u ) ;
+  (void) printf ( "  rescan    %8.3f s  %u replaced  scan %.3f s\n",
+    ( last - t0 ) / 1e9, nchange, metric ( scan, "stage2_scan_seconds_last" ) ) ;
+  show_usage ( & u ) ;
+
+  /* shutdown: the usage of stage2 is read before it is reaped */
+  t0 = now () ;
+  control ( scan, "t" ) ;
+
+  {
+    siginfo_t si ;
+
+    while ( waitid ( P_PID, pid, & si, WEXITED | WNOWAIT ) < 0 )
+      if ( EINTR != errno ) { strerr_diefu1sys ( 111, "wait for stage2" ) ; }
+  }
+
+  last = now () ;
+  usage ( pid, & u ) ;
+  (void) waitpid ( pid, & wstat, 0 ) ;
+  (void) printf ( "  shutdown  %8.3f s\n  total cpu %.2f s  peak rss %lu kB\n", ( last - t0 ) / 1e9, u . cpu, u . hwm ) ;
+  (void) fflush ( stdout ) ;
+
+  (void) close ( repfd ) ;
+  repfd = -1 ;
+  free ( svcs ) ;
+  svcs = NULL ;
+
+  /* the stubs went down with stage2 */
+  {
+    char const * argv [ 4 ] = { "rm", "-rf", base, 0 } ;
+
+    spawnwait ( argv ) ;
+  }
+}
+
+int main ( int argc, char const * const * argv )
+{
+  static char const * const defaults [] = { "100", "1000", "10000", "50000", 0 } ;
+  char const * const path = getenv ( SOCKET_VAR ) ;
+  char tmpl [] = "/tmp/s2bench.XXXXXX" ;
+  char * self ;
+  int ours = 0 ;
+
+  /* run by stage2 */
+  if ( path ) { return stub ( argc, argv, path ) ; }
+
+  PROG = "s2bench" ;
+
+  self = realpath ( argv [ 0 ], NULL ) ;
+  if ( ! self ) { strerr_diefu2sys ( 111, "find ", argv [ 0 ] ) ; }
+
+  {
+    subgetopt_t l = SUBGETOPT_ZERO ;
+
+    while ( 1 ) {
+      const int opt = subgetopt_r ( argc, argv, "s:d:l:w:", & l ) ;
+
+      if ( 1 > opt ) { break ; }
+
+      switch ( opt ) {
+        case 's' : stage2 = l . arg ; break ;
+        case 'd' : topdir = l . arg ; break ;
+        case 'l' : if ( ! uint0_scan ( l . arg, & logpct ) || 100 < logpct ) dieusage () ; break ;
+        case 'w' : if ( ! uint0_scan ( l . arg, & phasemax ) || ! phasemax ) dieusage () ; break ;
+        default : dieusage () ;
+      }
+    }
+
+    argc -= l . ind ;
+    argv += l . ind ;
+  }
+
+  if ( ! argc ) { argv = defaults ; }
+  if ( access ( stage2, X_OK ) < 0 ) { strerr_diefu2sys ( 111, "run ", stage2 ) ; }
+
+  if ( ! topdir ) {
+    if ( ! mkdtemp ( tmpl ) ) { strerr_diefu2sys ( 111, "create ", tmpl ) ; }
+    topdir = tmpl ;
+    ours = 1 ;
+  }
+
+  /* the stub, by the name stage2 spawns it by */
+  {
+    char bin [ strlen ( topdir ) + sizeof ( "/bin/" STUB_NAME ) ] ;
+
+    memcpy ( bin, topdir, strlen ( topdir ) ) ;
+    memcpy ( bin + strlen ( topdir ), "/bin", 5 ) ;
+    if ( mkdir ( bin, 0755 ) < 0 ) { strerr_diefu2sys ( 111, "mkdir ", bin ) ; }
+    memcpy ( bin + strlen ( topdir ), "/bin/" STUB_NAME, sizeof ( "/bin/" STUB_NAME ) ) ;
+    if ( symlink ( self, bin ) < 0 ) { strerr_diefu2sys ( 111, "symlink ", bin ) ; }
+  }
+
+  /* a pipe for every logged service */
+  {
+    struct rlimit rl ;
+
+    if ( getrlimit ( RLIMIT_NOFILE, & rl ) == 0 && rl . rlim_cur < rl . rlim_max ) {
+      rl . rlim_cur = rl . rlim_max ;
+      (void) setrlimit ( RLIMIT_NOFILE, & rl ) ;
+    }
+  }
+
+  for ( ; * argv ; ++ argv ) {
+    unsigned int count ;
+
+    if ( ! uint0_scan ( * argv, & count ) || ! count ) { strerr_dief2x ( 100, "invalid count: ", * argv ) ; }
+    bench ( count ) ;
+  }
+
+  {
+    char const * rmargv [ 4 ] = { "rm", "-rf", topdir, 0 } ;
+    char bin [ strlen ( topdir ) + sizeof ( "/bin/" STUB_NAME ) ] ;
+
+    if ( ours ) { spawnwait ( rmargv ) ; }
+    else {
+      memcpy ( bin, topdir, strlen ( topdir ) ) ;
+      memcpy ( bin + strlen ( topdir ), "/bin/" STUB_NAME, sizeof ( "/bin/" STUB_NAME ) ) ;
+      (void) unlink ( bin ) ;
+      bin [ strlen ( topdir ) + 4 ] = 0 ;
+      (void) rmdir ( bin ) ;
+    }
+  }
+
+  free ( self ) ;
+
+  return 0 ;
+}
@@ -0,0 +1,270 @@
+/*
+ * talk to stage2 over its control socket
+ */
+
+#include "feat.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <skalibs/allreadwrite.h>
+#include <skalibs/sgetopt.h>
+#include <skalibs/types.h>
+#include <skalibs/strerr2.h>
+#include <skalibs/sig.h>
+#include <s6/config.h>
+#include "s2ctl.h"
+
+#define USAGE			"s2ctl [ -d scandir ] start|stop|restart|rescan|query|metrics|logtail|reexec|events|signal sig [ service ... ]"
+#define dieusage()		strerr_dieusage( 100, USAGE )
+
+static char const * const results [] = {
+  "ok",
+  "no such service",
+  "invalid request",
+  "supervisor unreachable",
+  "protocol error",
+} ;
+
+static int ctlconnect ( char const * dir )
+{
+  const size_t dirlen = strlen ( dir ) ;
+  const size_t len = dirlen + sizeof ( "/" S6_SVSCAN_CTLDIR "/" S2CTL_SOCKET ) ;
+  struct sockaddr_un sa ;
+  int fd ;
+
+  memset ( & sa, 0, sizeof ( sa ) ) ;
+  sa . sun_family = AF_UNIX ;
+
+  if ( len > sizeof ( sa . sun_path ) ) strerr_dief2x ( 100, "scan directory name too long: ", dir ) ;
+
+  memcpy ( sa . sun_path, dir, dirlen ) ;
+  memcpy ( sa . sun_path + dirlen, "/" S6_SVSCAN_CTLDIR "/" S2CTL_SOCKET, len - dirlen ) ;
+
+  fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) strerr_diefu1sys ( 111, "create socket" ) ;
+
+  if ( connect ( fd, (struct sockaddr *) & sa, sizeof ( sa ) ) < 0 )
+    strerr_diefu2sys ( 111, "connect to ", sa . sun_path ) ;
+
+  return fd ;
+}
+
+static void * xmalloc ( const size_t len )
+{
+  void * const p = malloc ( len ? len : 1 ) ;
+
+  if ( ! p ) strerr_diefu1sys ( 111, "allocate memory" ) ;
+
+  return p ;
+}
+
+/* print a reply. returns the number of failed names. */
+static unsigned int show ( struct s2ctl_hdr_s const * h, char const * p, char const * const * names )
+{
+  unsigned int k, bad = 0 ;
+  size_t pos = 0 ;
+
+  if ( S2CTL_METRICS == h -> op || S2CTL_LOGTAIL == h -> op ) {
+    (void) allwrite ( 1, p, h -> len ) ;
+    return 0 ;
+  }
+
+  if ( S2CTL_QUERY != h -> op ) {
+    for ( k = 0 ; k < h -> count && k < h -> len ; ++ k ) {
+      const unsigned char res = p [ k ] ;
+
+      if ( S2CTL_OK == res ) { continue ; }
+
+      ++ bad ;
+      strerr_warnw3x ( names [ k ], ": ", ( res <= S2CTL_EPROTO ) ? results [ res ] : "unknown error" ) ;
+    }
+
+    return bad ;
+  }
+
+  for ( k = 0 ; k < h -> count ; ++ k ) {
+    struct s2ctl_state_s st ;
+    char const * name ;
+    char buf [ 4 * UINT_FMT + 16 ] ;
+    size_t m = 0 ;
+
+    if ( pos + sizeof ( st ) >= h -> len ) { break ; }
+
+    memcpy ( & st, p + pos, sizeof ( st ) ) ;
+    name = p + pos + sizeof ( st ) ;
+    pos += sizeof ( st ) + strnlen ( name, h -> len - pos - sizeof ( st ) ) + 1 ;
+
+    if ( ! st . flags ) {
+      ++ bad ;
+      strerr_warnw3x ( name, ": ", results [ S2CTL_ENOENT ] ) ;
+      continue ;
+    }
+
+    (void) fd_write ( 1, name, strlen ( name ) ) ;
+
+    if ( st . pid ) {
+      memcpy ( buf + m, " up pid ", 8 ) ; m += 8 ;
+      m += uint_fmt ( buf + m, st . pid ) ;
+      memcpy ( buf + m, " ", 1 ) ; m += 1 ;
+      m += uint_fmt ( buf + m, st . uptime ) ;
+      memcpy ( buf + m, "s", 1 ) ; m += 1 ;
+    } else {
+      memcpy ( buf + m, " down", 5 ) ; m += 5 ;
+    }
+
+    if ( st . logpid ) {
+      memcpy ( buf + m, " log ", 5 ) ; m += 5 ;
+      m += uint_fmt ( buf + m, st . logpid ) ;
+    }
+
+    if ( st . fails ) {
+      memcpy ( buf + m, " fails ", 7 ) ; m += 7 ;
+      m += uint_fmt ( buf + m, st . fails ) ;
+    }
+
+    (void) fd_write ( 1, buf, m ) ;
+
+    if ( ! ( st . flags & S2CTL_ACTIVE ) ) (void) fd_write ( 1, " removed", 8 ) ;
+    if ( st . flags & S2CTL_QUARANTINE ) (void) fd_write ( 1, " quarantined", 12 ) ;
+    if ( st . flags & S2CTL_QUEUED ) (void) fd_write ( 1, " queued", 7 ) ;
+    if ( st . flags & S2CTL_STARTING ) (void) fd_write ( 1, " starting", 9 ) ;
+    if ( st . flags & S2CTL_READY ) (void) fd_write ( 1, " ready", 6 ) ;
+    if ( st . flags & S2CTL_WAITING ) (void) fd_write ( 1, " waiting", 8 ) ;
+    if ( st . flags & S2CTL_CRITICAL ) (void) fd_write ( 1, " critical", 9 ) ;
+    if ( st . flags & S2CTL_DOWN ) (void) fd_write ( 1, " wantdown", 9 ) ;
+    if ( st . flags & S2CTL_TEMPLATE ) (void) fd_write ( 1, " template", 9 ) ;
+    if ( st . flags & S2CTL_PAUSED ) (void) fd_write ( 1, " paused", 7 ) ;
+    if ( st . flags & S2CTL_HELD ) (void) fd_write ( 1, " held", 5 ) ;
+    (void) fd_write ( 1, "\n", 1 ) ;
+  }
+
+  return bad ;
+}
+
+/* send one request for names [ 0 .. count ) and print the reply */
+static unsigned int request ( const int fd, const unsigned int op, const unsigned int arg,
+  char const * const * names, const unsigned int count, const size_t len )
+{
+  struct s2ctl_hdr_s h ;
+  char * const buf = xmalloc ( sizeof ( h ) + len ) ;
+  char * p ;
+  size_t pos = sizeof ( h ) ;
+  unsigned int k, bad ;
+
+  h . len = len ;
+  h . op = op ;
+  h . arg = arg ;
+  h . count = count ;
+  memcpy ( buf, & h, sizeof ( h ) ) ;
+
+  for ( k = 0 ; k < count ; ++ k ) {
+    const size_t l = strlen ( names [ k ] ) + 1 ;
+
+    memcpy ( buf + pos, names [ k ], l ) ;
+    pos += l ;
+  }
+
+  if ( allwrite ( fd, buf, pos ) < pos ) strerr_diefu1sys ( 111, "send request" ) ;
+
+  free ( buf ) ;
+
+  if ( allread ( fd, (char *) & h, sizeof ( h ) ) < sizeof ( h ) ) strerr_diefu1sys ( 111, "read reply" ) ;
+
+  if ( S2CTL_OK != h . arg )
+    strerr_dief2x ( 111, "request refused: ", ( h . arg <= S2CTL_EPROTO ) ? results [ h . arg ] : "unknown error" ) ;
+
+  p = xmalloc ( h . len ) ;
+
+  if ( allread ( fd, p, h . len ) < h . len ) strerr_diefu1sys ( 111, "read reply" ) ;
+
+  bad = show ( & h, p, names ) ;
+  free ( p ) ;
+
+  return bad ;
+}
+
+int main ( int argc, char const * const * argv )
+{
+  char const * dir = "." ;
+  unsigned int op = 0, arg = 0, bad = 0 ;
+  int fd ;
+
+  PROG = "s2ctl" ;
+
+  {
+    subgetopt_t l = SUBGETOPT_ZERO ;
+
+    while ( 1 ) {
+      const int opt = subgetopt_r ( argc, argv, "d:", & l ) ;
+
+      if ( 1 > opt ) { break ; }
+
+      switch ( opt ) {
+        case 'd' : dir = l . arg ; break ;
+        default : dieusage () ;
+      }
+    }
+
+    argc -= l . ind ;
+    argv += l . ind ;
+  }
+
+  if ( 1 > argc ) dieusage () ;
+
+  if ( ! strcmp ( argv [ 0 ], "start" ) ) op = S2CTL_START ;
+  else if ( ! strcmp ( argv [ 0 ], "stop" ) ) op = S2CTL_STOP ;
+  else if ( ! strcmp ( argv [ 0 ], "restart" ) ) op = S2CTL_RESTART ;
+  else if ( ! strcmp ( argv [ 0 ], "rescan" ) ) op = S2CTL_RESCAN ;
+  else if ( ! strcmp ( argv [ 0 ], "query" ) ) op = S2CTL_QUERY ;
+  else if ( ! strcmp ( argv [ 0 ], "metrics" ) ) op = S2CTL_METRICS ;
+  else if ( ! strcmp ( argv [ 0 ], "logtail" ) ) op = S2CTL_LOGTAIL ;
+  else if ( ! strcmp ( argv [ 0 ], "reexec" ) ) op = S2CTL_REEXEC ;
+  else if ( ! strcmp ( argv [ 0 ], "events" ) ) op = S2CTL_EVENTS ;
+  else if ( ! strcmp ( argv [ 0 ], "signal" ) ) {
+    op = S2CTL_SIGNAL ;
+    if ( 2 > argc ) dieusage () ;
+    if ( ! uint0_scan ( argv [ 1 ], & arg ) ) {
+      arg = sig_number ( argv [ 1 ] + ( strncmp ( argv [ 1 ], "SIG", 3 ) ? 0 : 3 ) ) ;
+      if ( ! arg ) strerr_dief2x ( 100, "unknown signal: ", argv [ 1 ] ) ;
+    }
+    -- argc ; ++ argv ;
+  }
+  else dieusage () ;
+
+  -- argc ; ++ argv ;
+
+  if ( ! argc && S2CTL_QUERY != op && S2CTL_RESCAN != op && S2CTL_METRICS != op && S2CTL_REEXEC != op && S2CTL_EVENTS != op ) dieusage () ;
+  if ( argc && ( S2CTL_METRICS == op || S2CTL_REEXEC == op || S2CTL_EVENTS == op ) ) dieusage () ;
+  if ( 1 != argc && S2CTL_LOGTAIL == op ) dieusage () ;
+
+  fd = ctlconnect ( dir ) ;
+
+  if ( ! argc ) { bad = request ( fd, op, arg, argv, 0, 0 ) ; }
+
+  /* as many names per request as fit */
+  while ( argc ) {
+    unsigned int count = 0 ;
+    size_t len = 0 ;
+
+    while ( count < (unsigned int) argc && count < 0xffff ) {
+      const size_t l = strlen ( argv [ count ] ) + 1 ;
+
+      if ( len + l > S2CTL_MAXREQ ) { break ; }
+      len += l ;
+      ++ count ;
+    }
+
+    if ( ! count ) strerr_dief2x ( 100, "service name too long: ", argv [ 0 ] ) ;
+
+    bad += request ( fd, op, arg, argv, count, len ) ;
+    argc -= count ;
+    argv += count ;
+  }
+
+  return bad ? 1 : 0 ;
+}
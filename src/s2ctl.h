@@ -0,0 +1,111 @@
+/*
+ * the stage2 control socket protocol
+ *
+ * a client sends requests over the Unix stream socket named
+ * S2CTL_SOCKET in the s6-svscan control directory and gets exactly
+ * one reply per request, in order. requests may be pipelined.
+ * all integers are in host byte order, the socket is local only.
+ *
+ * a request is a header followed by len bytes of payload:
+ * count NUL terminated service names (a name "svc/log" addresses
+ * the logger of svc).
+ *
+ * a reply is a header with the same op, the status in arg and the
+ * number of records or results in count, followed by:
+ * - for S2CTL_QUERY: count records, each a struct s2ctl_state_s
+ *   directly followed by the NUL terminated name (count = 0 in the
+ *   request queries all services)
+ * - for S2CTL_METRICS and S2CTL_LOGTAIL: text
+ * - for all other ops: count result bytes, one per name (S2CTL_OK ...)
+ *
+ * S2CTL_START on name@inst, where name@ is a template, creates that
+ * instance first (in-process mode only). S2CTL_STOP on such an
+ * instance drops it at the next scan.
+ */
+
+#ifndef S2CTL_H
+#define S2CTL_H
+
+#include <stdint.h>
+
+#define S2CTL_SOCKET		"socket"
+#define S2CTL_MAXREQ		65536
+
+/* request ops */
+enum {
+  S2CTL_START			= 1,
+  S2CTL_STOP			= 2,
+  S2CTL_RESTART			= 3,
+  /* arg holds the signal number */
+  S2CTL_SIGNAL			= 4,
+  /* count = 0: full scan, else rescan the named directories */
+  S2CTL_RESCAN			= 5,
+  S2CTL_QUERY			= 6,
+  /* count = 0, the reply holds the Prometheus text format metrics */
+  S2CTL_METRICS			= 7,
+  /* count = 1, the reply holds the latest output of the service
+   * (log multiplexer only) */
+  S2CTL_LOGTAIL			= 8,
+  /* count = 0, stage2 re-executes itself after the reply, keeping
+   * its services running (an upgrade) */
+  S2CTL_REEXEC			= 9,
+  /* count = 0, stage2 writes its flight recorder to the file events
+   * in its control directory (see s2events.h) */
+  S2CTL_EVENTS			= 10,
+} ;
+
+/* reply status and per name results */
+enum {
+  S2CTL_OK			= 0,
+  /* no such service */
+  S2CTL_ENOENT			= 1,
+  /* bad name, op or signal */
+  S2CTL_EINVAL			= 2,
+  /* the supervisor could not be told */
+  S2CTL_EIO			= 3,
+  /* malformed request, the connection is closed after the reply */
+  S2CTL_EPROTO			= 4,
+} ;
+
+/* service state flags, 0 for an unknown name */
+enum {
+  S2CTL_KNOWN			= 0x0100,
+  S2CTL_ACTIVE			= 0x0001,
+  S2CTL_LOG			= 0x0002,
+  S2CTL_QUARANTINE		= 0x0004,
+  S2CTL_QUEUED			= 0x0008,
+  S2CTL_STARTING		= 0x0010,
+  S2CTL_CRITICAL		= 0x0020,
+  S2CTL_DOWN			= 0x0040,
+  S2CTL_LOGDOWN			= 0x0080,
+  /* the service signalled readiness (or does not notify) */
+  S2CTL_READY			= 0x0200,
+  /* the service waits for its dependencies */
+  S2CTL_WAITING			= 0x0400,
+  /* a template (name@), never started itself */
+  S2CTL_TEMPLATE		= 0x0800,
+  /* stopped until memory and cpu pressure is gone */
+  S2CTL_PAUSED			= 0x1000,
+  /* idle class, waiting for the system to settle after boot */
+  S2CTL_HELD			= 0x2000,
+} ;
+
+struct s2ctl_hdr_s {
+  uint32_t len ;
+  uint8_t op ;
+  uint8_t arg ;
+  uint16_t count ;
+} ;
+
+struct s2ctl_state_s {
+  int32_t pid ;
+  int32_t logpid ;
+  uint32_t flags ;
+  /* deaths in a row (see the restart backoff) */
+  uint32_t fails ;
+  uint32_t logfails ;
+  /* seconds since the service (supervisor) was started, 0 if down */
+  uint32_t uptime ;
+} ;
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * compile a stage2 scan directory into a service database
+ */
+
+#include "feat.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <skalibs/sgetopt.h>
+#include <skalibs/types.h>
+#include <skalibs/strerr2.h>
+#include <skalibs/djbunix.h>
+#include <skalibs/direntry.h>
+#include <s6/config.h>
+#include "s2db.h"
+
+#define USAGE			"s2db [ -o dbfile ] scandir"
+#define dieusage()		strerr_dieusage( 100, USAGE )
+
+/* the files that make stage2 tune a service, see tune_load () there */
+static char const * const tunefiles [] = { "cpuset", "numa", "sched", "nice", "ioclass", "heavy", 0 } ;
+
+/* a service found, before its strings go to the string table */
+struct svc_s {
+  struct s2db_ent_s e ;
+  char * name ;
+  char * deps ;
+  size_t depslen ;
+} ;
+
+static char const * scanroot ;
+
+static void * xrealloc ( void * p, const size_t len )
+{
+  p = realloc ( p, len ? len : 1 ) ;
+  if ( ! p ) strerr_diefu1sys ( 111, "allocate memory" ) ;
+
+  return p ;
+}
+
+/* scandir/name/file, into a buffer of the caller */
+static char const * path ( char * fn, char const * name, char const * file )
+{
+  const size_t dirlen = strlen ( scanroot ), namelen = strlen ( name ) ;
+
+  memcpy ( fn, scanroot, dirlen ) ;
+  fn [ dirlen ] = '/' ;
+  memcpy ( fn + dirlen + 1, name, namelen ) ;
+  fn [ dirlen + 1 + namelen ] = '/' ;
+  memcpy ( fn + dirlen + namelen + 2, file, strlen ( file ) + 1 ) ;
+
+  return fn ;
+}
+
+#define PATHLEN(name, file)	( strlen ( scanroot ) + strlen ( name ) + strlen ( file ) + 3 )
+
+/* read a setting, 0 if the file is missing */
+static ssize_t readsetting ( char const * name, char const * file, char * buf, const size_t len )
+{
+  char fn [ PATHLEN( name, file ) ] ;
+  ssize_t r = openreadnclose ( path ( fn, name, file ), buf, len - 1 ) ;
+
+  if ( 0 > r ) {
+    if ( ENOENT != errno ) strerr_diefu2sys ( 111, "read ", fn ) ;
+    r = 0 ;
+  }
+
+  buf [ r ] = 0 ;
+
+  return r ;
+}
+
+static int exists ( char const * name, char const * file )
+{
+  char fn [ PATHLEN( name, file ) ] ;
+
+  return 0 == access ( path ( fn, name, file ), F_OK ) ;
+}
+
+static uint32_t readuint ( char const * name, char const * file )
+{
+  char buf [ UINT_FMT + 2 ] ;
+  unsigned int u ;
+
+  if ( ! readsetting ( name, file, buf, sizeof ( buf ) ) ) { return S2DB_UNSET ; }
+
+  if ( ! uint_scan ( buf, & u ) ) {
+    strerr_warnw4x ( "invalid ", file, " setting for ", name ) ;
+    return S2DB_UNSET ;
+  }
+
+  return u ;
+}
+
+/* the same rules as stage2 applies to a dependencies file */
+static void readdeps ( struct svc_s * s )
+{
+  char deps [ 4096 ] ;
+  size_t k = 0, len = 0 ;
+
+  if ( ! readsetting ( s -> name, "dependencies", deps, sizeof ( deps ) ) ) { return ; }
+
+  while ( deps [ k ] ) {
+    size_t l, next ;
+
+    while ( deps [ k ] == ' ' || deps [ k ] == '\t' || deps [ k ] == '\n' ) { ++ k ; }
+    for ( l = k ; deps [ l ] && deps [ l ] != ' ' && deps [ l ] != '\t' && deps [ l ] != '\n' ; ++ l ) ;
+    if ( l == k ) { break ; }
+    next = deps [ l ] ? l + 1 : l ;
+
+    if ( deps [ k ] == '.' || memchr ( deps + k, '/', l - k ) || ( l - k == strlen ( s -> name ) && ! memcmp ( deps + k, s -> name, l - k ) ) ) {
+      strerr_warnw2x ( "invalid dependencies setting for ", s -> name ) ;
+    } else {
+      memmove ( deps + len, deps + k, l - k ) ;
+      len += l - k ;
+      deps [ len ++ ] = 0 ;
+      ++ s -> e . ndeps ;
+    }
+
+    k = next ;
+  }
+
+  s -> deps = xrealloc ( NULL, len ) ;
+  memcpy ( s -> deps, deps, len ) ;
+  s -> depslen = len ;
+}
+
+static void readsvc ( struct svc_s * s )
+{
+  struct stat st ;
+  char buf [ 64 ] ;
+  char fn [ PATHLEN( s -> name, "log" ) ] ;
+  unsigned int k ;
+
+  s -> e . delaymax = readuint ( s -> name, "restart-delay-max" ) ;
+  s -> e . resetafter = readuint ( s -> name, "restart-reset" ) ;
+  s -> e . notifyfd = readuint ( s -> name, "notification-fd" ) ;
+  s -> e . limit = s -> e . window = S2DB_UNSET ;
+
+  /* "N SECS" */
+  if ( readsetting ( s -> name, "restart-limit", buf, sizeof ( buf ) ) ) {
+    unsigned int limit, window ;
+    size_t m = uint_scan ( buf, & limit ) ;
+
+    while ( m && ( ' ' == buf [ m ] || '\t' == buf [ m ] ) ) { ++ m ; }
+
+    if ( ! m || ! uint_scan ( buf + m, & window ) ) {
+      strerr_warnw2x ( "invalid restart-limit setting for ", s -> name ) ;
+    } else {
+      s -> e . limit = limit ;
+      s -> e . window = window ;
+    }
+  }
+
+  if ( exists ( s -> name, "critical" ) ) { s -> e . flags |= S2DB_CRITICAL ; }
+  if ( exists ( s -> name, "down" ) ) { s -> e . flags |= S2DB_DOWN ; }
+  if ( exists ( s -> name, "listen" ) ) { s -> e . flags |= S2DB_LISTEN ; }
+  if ( exists ( s -> name, "probe" ) ) { s -> e . flags |= S2DB_PROBE ; }
+  if ( exists ( s -> name, "low-priority" ) ) { s -> e . flags |= S2DB_LOWPRIO ; }
+  if ( exists ( s -> name, "sheddable" ) ) { s -> e . flags |= S2DB_SHED ; }
+
+  if ( readsetting ( s -> name, "start-class", buf, sizeof ( buf ) ) ) {
+    const size_t m = strcspn ( buf, " \t\n" ) ;
+
+    if ( 4 == m && ! memcmp ( buf, "idle", 4 ) ) { s -> e . flags |= S2DB_IDLE ; }
+    else if ( 4 != m || memcmp ( buf, "boot", 4 ) ) { strerr_warnw2x ( "invalid start-class setting for ", s -> name ) ; }
+  }
+
+  for ( k = 0 ; tunefiles [ k ] ; ++ k ) {
+    if ( exists ( s -> name, tunefiles [ k ] ) ) {
+      s -> e . flags |= S2DB_TUNE ;
+      break ;
+    }
+  }
+
+  if ( stat ( path ( fn, s -> name, "log" ), & st ) < 0 ) {
+    if ( ENOENT != errno ) strerr_diefu2sys ( 111, "stat ", fn ) ;
+  } else if ( S_ISDIR( st . st_mode ) ) {
+    s -> e . flags |= S2DB_LOG ;
+    if ( exists ( s -> name, "log/down" ) ) { s -> e . flags |= S2DB_LOGDOWN ; }
+  }
+
+  readdeps ( s ) ;
+}
+
+static int byname ( void const * a, void const * b )
+{
+  return strcmp ( ( (struct svc_s const *) a ) -> name, ( (struct svc_s const *) b ) -> name ) ;
+}
+
+int main ( int argc, char const * const * argv )
+{
+  char const * out = NULL ;
+  struct svc_s * svc = NULL ;
+  size_t nsvc = 0, strsize = 0, k ;
+  DIR * dir ;
+
+  PROG = "s2db" ;
+
+  {
+    subgetopt_t l = SUBGETOPT_ZERO ;
+
+    while ( 1 ) {
+      const int opt = subgetopt_r ( argc, argv, "o:", & l ) ;
+
+      if ( 1 > opt ) { break ; }
+
+      switch ( opt ) {
+        case 'o' : out = l . arg ; break ;
+        default : dieusage () ;
+      }
+    }
+
+    argc -= l . ind ;
+    argv += l . ind ;
+  }
+
+  if ( 1 != argc ) dieusage () ;
+  scanroot = argv [ 0 ] ;
+
+  dir = opendir ( scanroot ) ;
+  if ( ! dir ) strerr_diefu2sys ( 111, "open directory ", scanroot ) ;
+
+  /* the directories stage2 would scan */
+  while ( 1 ) {
+    struct stat st ;
+    direntry * d ;
+
+    errno = 0 ;
+    d = readdir ( dir ) ;
+    if ( ! d ) { break ; }
+    if ( '.' == d -> d_name [ 0 ] ) { continue ; }
+
+    {
+      char fn [ strlen ( scanroot ) + strlen ( d -> d_name ) + 2 ] ;
+
+      memcpy ( fn, scanroot, strlen ( scanroot ) ) ;
+      fn [ strlen ( scanroot ) ] = '/' ;
+      memcpy ( fn + strlen ( scanroot ) + 1, d -> d_name, strlen ( d -> d_name ) + 1 ) ;
+
+      if ( stat ( fn, & st ) < 0 ) strerr_diefu2sys ( 111, "stat ", fn ) ;
+    }
+
+    if ( ! S_ISDIR( st . st_mode ) ) { continue ; }
+
+    svc = xrealloc ( svc, ( nsvc + 1 ) * sizeof ( * svc ) ) ;
+    memset ( svc + nsvc, 0, sizeof ( * svc ) ) ;
+    svc [ nsvc ] . name = xrealloc ( NULL, strlen ( d -> d_name ) + 1 ) ;
+    memcpy ( svc [ nsvc ] . name, d -> d_name, strlen ( d -> d_name ) + 1 ) ;
+    svc [ nsvc ] . e . dev = st . st_dev ;
+    svc [ nsvc ] . e . ino = st . st_ino ;
+    readsvc ( svc + nsvc ) ;
+    strsize += strlen ( d -> d_name ) + 1 + svc [ nsvc ] . depslen ;
+    ++ nsvc ;
+  }
+
+  if ( errno ) strerr_diefu2sys ( 111, "read directory ", scanroot ) ;
+  dir_close ( dir ) ;
+
+  qsort ( svc, nsvc, sizeof ( * svc ), byname ) ;
+
+  {
+    struct s2db_hdr_s h ;
+    const size_t ents = sizeof ( h ) + nsvc * sizeof ( struct s2db_ent_s ) ;
+    char * const buf = xrealloc ( NULL, ents + strsize + 1 ) ;
+    size_t pos = 0 ;
+
+    memset ( & h, 0, sizeof ( h ) ) ;
+    h . magic = S2DB_MAGIC ;
+    h . version = S2DB_VERSION ;
+    h . hdrsize = sizeof ( h ) ;
+    h . entsize = sizeof ( struct s2db_ent_s ) ;
+    h . count = nsvc ;
+    /* a final NUL, so every offset in it starts a terminated string */
+    h . strsize = strsize + 1 ;
+    h . gen = time ( NULL ) ;
+    memcpy ( buf, & h, sizeof ( h ) ) ;
+
+    for ( k = 0 ; k < nsvc ; ++ k ) {
+      struct s2db_ent_s * const e = & svc [ k ] . e ;
+      const size_t namelen = strlen ( svc [ k ] . name ) + 1 ;
+
+      e -> name = pos ;
+      memcpy ( buf + ents + pos, svc [ k ] . name, namelen ) ;
+      pos += namelen ;
+      e -> deps = pos ;
+      memcpy ( buf + ents + pos, svc [ k ] . deps, svc [ k ] . depslen ) ;
+      pos += svc [ k ] . depslen ;
+      memcpy ( buf + sizeof ( h ) + k * sizeof ( * e ), e, sizeof ( * e ) ) ;
+    }
+
+    buf [ ents + pos ] = 0 ;
+
+    if ( ! out ) {
+      char * const fn = xrealloc ( NULL, strlen ( scanroot ) + sizeof ( "/" S6_SVSCAN_CTLDIR "/db" ) ) ;
+
+      memcpy ( fn, scanroot, strlen ( scanroot ) ) ;
+      memcpy ( fn + strlen ( scanroot ), "/" S6_SVSCAN_CTLDIR "/db", sizeof ( "/" S6_SVSCAN_CTLDIR "/db" ) ) ;
+      out = fn ;
+    }
+
+    /* replaced, never rewritten in place: stage2 may have it mapped */
+    if ( ! openwritenclose_suffix ( out, buf, ents + pos + 1, ".new" ) ) strerr_diefu2sys ( 111, "write ", out ) ;
+  }
+
+  return 0 ;
+}
@@ -0,0 +1,102 @@
+/*
+ * the stage2 service database
+ *
+ * s2db compiles a scan directory into one file, which stage2 -D maps
+ * instead of reading the directory: a header, count fixed size
+ * entries sorted by name, then a string table of strsize bytes. the
+ * entries hold what stage2 would otherwise read from every service
+ * directory when it finds it. a value of S2DB_UNSET leaves the
+ * setting at stage2's default.
+ *
+ * the file is replaced as a whole (written under a temporary name and
+ * renamed into place), never modified: a mapping of it stays valid
+ * until it is unmapped.
+ */
+
+#ifndef S2DB_H
+#define S2DB_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define S2DB_MAGIC		0x42443253
+#define S2DB_VERSION		1
+#define S2DB_UNSET		0xffffffffU
+
+/* entry flags */
+enum {
+  /* the directory has a log subdirectory */
+  S2DB_LOG			= 0x0001,
+  S2DB_DOWN			= 0x0002,
+  S2DB_LOGDOWN			= 0x0004,
+  S2DB_CRITICAL			= 0x0008,
+  /* there is a listen file to read */
+  S2DB_LISTEN			= 0x0010,
+  /* there is at least one of the cpu and scheduling files to read */
+  S2DB_TUNE			= 0x0020,
+  S2DB_LOWPRIO			= 0x0040,
+  S2DB_SHED			= 0x0080,
+  /* start-class idle */
+  S2DB_IDLE			= 0x0100,
+  /* there is a probe file to read */
+  S2DB_PROBE			= 0x0200,
+} ;
+
+struct s2db_hdr_s {
+  uint32_t magic ;
+  uint32_t version ;
+  uint32_t hdrsize ;
+  uint32_t entsize ;
+  uint32_t count ;
+  uint32_t strsize ;
+  /* seconds since the epoch, when it was compiled */
+  int64_t gen ;
+} ;
+
+struct s2db_ent_s {
+  /* offsets in the string table: the name, and ndeps NUL terminated
+   * names of dependencies */
+  uint32_t name ;
+  uint32_t deps ;
+  uint32_t ndeps ;
+  uint32_t flags ;
+  /* of the directory when it was compiled */
+  uint64_t dev ;
+  uint64_t ino ;
+  uint32_t delaymax ;
+  uint32_t resetafter ;
+  uint32_t limit ;
+  uint32_t window ;
+  uint32_t notifyfd ;
+  uint32_t reserved ;
+} ;
+
+static inline struct s2db_ent_s const * s2db_ent ( struct s2db_hdr_s const * h, const uint32_t k )
+{
+  return (struct s2db_ent_s const *) ( (char const *) h + h -> hdrsize + (size_t) k * h -> entsize ) ;
+}
+
+static inline char const * s2db_str ( struct s2db_hdr_s const * h, const uint32_t off )
+{
+  return (char const *) h + h -> hdrsize + (size_t) h -> count * h -> entsize + off ;
+}
+
+/* binary search by name, NULL if not there */
+static inline struct s2db_ent_s const * s2db_find ( struct s2db_hdr_s const * h, char const * name )
+{
+  uint32_t lo = 0, hi = h -> count ;
+
+  while ( lo < hi ) {
+    const uint32_t mid = lo + ( hi - lo ) / 2 ;
+    struct s2db_ent_s const * const e = s2db_ent ( h, mid ) ;
+    const int c = strcmp ( name, s2db_str ( h, e -> name ) ) ;
+
+    if ( ! c ) { return e ; }
+    if ( 0 > c ) { hi = mid ; }
+    else { lo = mid + 1 ; }
+  }
+
+  return NULL ;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * the stage2 flight recorder
+ *
+ * stage2 keeps its last events in memory, a ring of fixed size
+ * records, and writes them to the file events in the s6-svscan
+ * control directory on 'd' on the control fifo, on S2CTL_EVENTS and
+ * before it executes the crash program after a panic. the ring
+ * starts empty when stage2 is started or re-executed.
+ *
+ * the file is a header, count records oldest first and nnames name
+ * entries: a struct s2ev_name_s directly followed by len bytes, the
+ * NUL terminated name of the service in that slot when the file was
+ * written (slot numbers are stable for the lifetime of a service,
+ * but may have been reused since an event).
+ * all integers are in host byte order.
+ */
+
+#ifndef S2EVENTS_H
+#define S2EVENTS_H
+
+#include <stdint.h>
+
+#define S2EV_MAGIC		0x56453253
+#define S2EV_VERSION		1
+#define S2EV_NOSLOT		0xffffffff
+
+/* event types, and what a and b hold */
+enum {
+  /* stage2 started: a = pid, S2EV_REEXEC */
+  S2EV_START			= 1,
+  /* a supervisor, logger or finish script spawned: a = pid, or 0
+   * and b = errno */
+  S2EV_SPAWN			= 2,
+  /* a child reaped: a = pid, b = wait status; S2EV_NOSLOT if it was
+   * none of ours */
+  S2EV_EXIT			= 3,
+  /* a = signal number */
+  S2EV_SIGNAL			= 4,
+  /* a control fifo command: a = the character */
+  S2EV_CONTROL			= 5,
+  /* a control socket request: a = op, b = count */
+  S2EV_REQUEST			= 6,
+  /* a scan root done: a = root, b = its services */
+  S2EV_SCAN			= 7,
+  /* a service found, or dropped once gone and down */
+  S2EV_ADD			= 8,
+  S2EV_DROP			= 9,
+  /* a = restarts within the window */
+  S2EV_QUARANTINE		= 10,
+  /* a = errno */
+  S2EV_PANIC			= 11,
+} ;
+
+/* event flags */
+enum {
+  S2EV_LOG			= 0x0001,
+  S2EV_FINISH			= 0x0002,
+  S2EV_REEXEC			= 0x0004,
+} ;
+
+struct s2ev_hdr_s {
+  uint32_t magic ;
+  uint32_t version ;
+  uint32_t hdrsize ;
+  uint32_t recsize ;
+  uint32_t count ;
+  uint32_t nnames ;
+  /* all events recorded: those beyond count were overwritten */
+  uint64_t total ;
+  /* wall clock when the ring started, microseconds since the epoch */
+  int64_t start ;
+  int32_t pid ;
+  uint32_t reserved ;
+} ;
+
+struct s2ev_s {
+  /* microseconds since start, as the event loop last read its clock */
+  uint64_t time ;
+  uint16_t type ;
+  uint16_t flags ;
+  /* service slot, or S2EV_NOSLOT */
+  uint32_t slot ;
+  int32_t a ;
+  int32_t b ;
+} ;
+
+struct s2ev_name_s {
+  uint32_t slot ;
+  uint32_t len ;
+} ;
+
+#endif
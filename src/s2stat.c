@@ -0,0 +1,256 @@
+/*
+ * print the service table from the stage2 status file, or with -e
+ * the events of a stage2 flight recorder dump
+ */
+
+#include "feat.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <skalibs/sgetopt.h>
+#include <skalibs/strerr2.h>
+#include <skalibs/sig.h>
+#include "s2ctl.h"
+#include "s2status.h"
+#include "s2events.h"
+
+#define USAGE			"s2stat [ -a ] statusfile | s2stat -e eventsfile"
+#define dieusage()		strerr_dieusage( 100, USAGE )
+
+static void show ( struct s2status_ent_s const * e, const time_t now )
+{
+  if ( e -> pid ) {
+    (void) printf ( "%s up (pid %ld) %lds", e -> name, (long) e -> pid, (long) ( now - e -> since ) ) ;
+  } else {
+    (void) printf ( "%s down", e -> name ) ;
+  }
+
+  if ( e -> logpid ) { (void) printf ( " log (pid %ld)", (long) e -> logpid ) ; }
+  if ( e -> restarts ) { (void) printf ( " restarts %lu", (unsigned long) e -> restarts ) ; }
+
+  if ( 0 <= e -> lastexit ) {
+    if ( WIFSIGNALED( e -> lastexit ) ) { (void) printf ( " last signal %d", WTERMSIG( e -> lastexit ) ) ; }
+    else { (void) printf ( " last exit %d", WEXITSTATUS( e -> lastexit ) ) ; }
+  }
+
+  if ( ! ( e -> flags & S2CTL_ACTIVE ) ) { (void) fputs ( " removed", stdout ) ; }
+  if ( e -> flags & S2CTL_QUARANTINE ) { (void) fputs ( " quarantined", stdout ) ; }
+  if ( e -> flags & S2CTL_QUEUED ) { (void) fputs ( " queued", stdout ) ; }
+  if ( e -> flags & S2CTL_STARTING ) { (void) fputs ( " starting", stdout ) ; }
+  if ( e -> flags & S2CTL_READY ) { (void) fputs ( " ready", stdout ) ; }
+  if ( e -> flags & S2CTL_WAITING ) { (void) fputs ( " waiting", stdout ) ; }
+  (void) putchar ( '\n' ) ;
+}
+
+/* the name of a slot in a dump, or its number */
+static char const * slotname ( char const * const * names, const uint32_t nslots, const uint32_t slot, char * buf, const size_t len )
+{
+  if ( slot < nslots && names [ slot ] ) { return names [ slot ] ; }
+
+  (void) snprintf ( buf, len, "#%lu", (unsigned long) slot ) ;
+  return buf ;
+}
+
+static void showexit ( const int wstat )
+{
+  if ( WIFSIGNALED( wstat ) ) { (void) printf ( " signal %s", sig_name ( WTERMSIG( wstat ) ) ) ; }
+  else { (void) printf ( " exit %d", WEXITSTATUS( wstat ) ) ; }
+}
+
+static void showevent ( struct s2ev_hdr_s const * h, struct s2ev_s const * e, char const * const * names, const uint32_t nslots )
+{
+  const int64_t t = h -> start + (int64_t) e -> time ;
+  const time_t sec = t / 1000000 ;
+  char const * const log = ( e -> flags & S2EV_LOG ) ? "/log" : "" ;
+  char const * const fin = ( e -> flags & S2EV_FINISH ) ? " finish" : "" ;
+  char buf [ 16 ] ;
+  char const * name ;
+  struct tm tm ;
+
+  (void) localtime_r ( & sec, & tm ) ;
+  (void) strftime ( buf, sizeof ( buf ), "%H:%M:%S", & tm ) ;
+  (void) printf ( "%s.%06ld ", buf, (long) ( t % 1000000 ) ) ;
+
+  name = slotname ( names, nslots, e -> slot, buf, sizeof ( buf ) ) ;
+
+  switch ( e -> type ) {
+    case S2EV_START :
+      (void) printf ( "start pid %ld%s", (long) e -> a, ( e -> flags & S2EV_REEXEC ) ? " re-executed" : "" ) ;
+      break ;
+    case S2EV_SPAWN :
+      if ( e -> a ) { (void) printf ( "spawn %s%s%s pid %ld", name, log, fin, (long) e -> a ) ; }
+      else { (void) printf ( "spawn %s%s%s failed: %s", name, log, fin, strerror ( e -> b ) ) ; }
+      break ;
+    case S2EV_EXIT :
+      if ( S2EV_NOSLOT == e -> slot ) { (void) printf ( "exit pid %ld, not a service", (long) e -> a ) ; }
+      else { (void) printf ( "exit %s%s%s pid %ld", name, log, fin, (long) e -> a ) ; }
+      showexit ( e -> b ) ;
+      break ;
+    case S2EV_SIGNAL :
+      (void) printf ( "signal %s", sig_name ( e -> a ) ) ;
+      break ;
+    case S2EV_CONTROL :
+      if ( 0x20 < e -> a && 0x7f > e -> a ) { (void) printf ( "control %c", e -> a ) ; }
+      else { (void) printf ( "control 0x%02x", (unsigned int) e -> a ) ; }
+      break ;
+    case S2EV_REQUEST :
+      (void) printf ( "request op %ld count %ld", (long) e -> a, (long) e -> b ) ;
+      break ;
+    case S2EV_SCAN :
+      (void) printf ( "scan root %ld: %ld services", (long) e -> a, (long) e -> b ) ;
+      break ;
+    case S2EV_ADD :
+      (void) printf ( "add %s", name ) ;
+      break ;
+    case S2EV_DROP :
+      (void) printf ( "drop %s", name ) ;
+      break ;
+    case S2EV_QUARANTINE :
+      (void) printf ( "quarantine %s%s restarts %ld", name, log, (long) e -> a ) ;
+      break ;
+    case S2EV_PANIC :
+      (void) printf ( "panic: %s", strerror ( e -> a ) ) ;
+      break ;
+    default :
+      (void) printf ( "unknown event %u", (unsigned int) e -> type ) ;
+      break ;
+  }
+
+  (void) putchar ( '\n' ) ;
+}
+
+/* print a flight recorder dump, oldest event first */
+static int events ( char const * fn )
+{
+  struct s2ev_hdr_s const * h ;
+  struct s2ev_name_s en ;
+  char const ** names = NULL ;
+  char const * p ;
+  struct stat st ;
+  size_t pos ;
+  uint32_t k, nslots = 0 ;
+  int fd ;
+
+  fd = open ( fn, O_RDONLY | O_CLOEXEC ) ;
+  if ( 0 > fd ) strerr_diefu2sys ( 111, "open ", fn ) ;
+  if ( fstat ( fd, & st ) < 0 ) strerr_diefu2sys ( 111, "stat ", fn ) ;
+  if ( (size_t) st . st_size < sizeof ( * h ) ) strerr_dief2x ( 111, "invalid events file: ", fn ) ;
+
+  p = mmap ( NULL, st . st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+  if ( MAP_FAILED == p ) strerr_diefu2sys ( 111, "map ", fn ) ;
+  (void) close ( fd ) ;
+
+  h = (struct s2ev_hdr_s const *) p ;
+  if ( S2EV_MAGIC != h -> magic || S2EV_VERSION != h -> version
+    || sizeof ( * h ) > h -> hdrsize || sizeof ( struct s2ev_s ) > h -> recsize
+    || (size_t) st . st_size < h -> hdrsize + (size_t) h -> count * h -> recsize )
+    strerr_dief2x ( 111, "invalid events file: ", fn ) ;
+
+  /* the names, by slot */
+  pos = h -> hdrsize + (size_t) h -> count * h -> recsize ;
+  for ( k = 0 ; k < h -> nnames ; ++ k ) {
+    if ( (size_t) st . st_size < pos + sizeof ( en ) ) { break ; }
+    memcpy ( & en, p + pos, sizeof ( en ) ) ;
+    pos += sizeof ( en ) ;
+    if ( ! en . len || (size_t) st . st_size < pos + en . len || p [ pos + en . len - 1 ] ) { break ; }
+
+    if ( en . slot >= nslots ) {
+      const uint32_t m = en . slot + 1 ;
+      char const ** const q = realloc ( names, m * sizeof ( char const * ) ) ;
+
+      if ( ! q ) strerr_diefu1sys ( 111, "allocate memory" ) ;
+      memset ( q + nslots, 0, ( m - nslots ) * sizeof ( char const * ) ) ;
+      names = q ;
+      nslots = m ;
+    }
+
+    names [ en . slot ] = p + pos ;
+    pos += en . len ;
+  }
+
+  if ( h -> total > h -> count ) {
+    (void) printf ( "%llu earlier events overwritten\n", (unsigned long long) ( h -> total - h -> count ) ) ;
+  }
+
+  for ( k = 0 ; k < h -> count ; ++ k ) {
+    struct s2ev_s e ;
+
+    memcpy ( & e, p + h -> hdrsize + (size_t) k * h -> recsize, sizeof ( e ) ) ;
+    showevent ( h, & e, names, nslots ) ;
+  }
+
+  free ( names ) ;
+  return 0 ;
+}
+
+int main ( int argc, char const * const * argv )
+{
+  struct s2status_hdr_s const * h ;
+  struct stat st ;
+  time_t now ;
+  uint32_t k, high ;
+  int fd, all = 0, ev = 0 ;
+
+  PROG = "s2stat" ;
+
+  {
+    subgetopt_t l = SUBGETOPT_ZERO ;
+
+    while ( 1 ) {
+      const int opt = subgetopt_r ( argc, argv, "ae", & l ) ;
+
+      if ( 1 > opt ) { break ; }
+
+      switch ( opt ) {
+        case 'a' : all = 1 ; break ;
+        case 'e' : ev = 1 ; break ;
+        default : dieusage () ;
+      }
+    }
+
+    argc -= l . ind ;
+    argv += l . ind ;
+  }
+
+  if ( 1 != argc ) dieusage () ;
+  if ( ev ) { return events ( argv [ 0 ] ) ; }
+
+  fd = open ( argv [ 0 ], O_RDONLY | O_CLOEXEC ) ;
+  if ( 0 > fd ) strerr_diefu2sys ( 111, "open ", argv [ 0 ] ) ;
+  if ( fstat ( fd, & st ) < 0 ) strerr_diefu2sys ( 111, "stat ", argv [ 0 ] ) ;
+  if ( (size_t) st . st_size < sizeof ( * h ) ) strerr_dief2x ( 111, "invalid status file: ", argv [ 0 ] ) ;
+
+  h = mmap ( NULL, st . st_size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+  if ( MAP_FAILED == h ) strerr_diefu2sys ( 111, "map ", argv [ 0 ] ) ;
+  (void) close ( fd ) ;
+
+  if ( S2STATUS_MAGIC != h -> magic || S2STATUS_VERSION != h -> version
+    || sizeof ( struct s2status_ent_s ) > h -> entsize
+    || (size_t) st . st_size < h -> hdrsize + (size_t) h -> nslots * h -> entsize )
+    strerr_dief2x ( 111, "invalid status file: ", argv [ 0 ] ) ;
+
+  now = time ( NULL ) ;
+  high = __atomic_load_n ( & h -> high, __ATOMIC_ACQUIRE ) ;
+  if ( high > h -> nslots ) { high = h -> nslots ; }
+
+  for ( k = 0 ; k < high ; ++ k ) {
+    struct s2status_ent_s e ;
+
+    s2status_get ( h, k, & e ) ;
+
+    if ( ! e . flags ) { continue ; }
+    if ( ! all && ! ( e . flags & S2CTL_ACTIVE ) && ! e . pid ) { continue ; }
+
+    show ( & e, now ) ;
+  }
+
+  return 0 ;
+}
@@ -0,0 +1,83 @@
+/*
+ * the stage2 status file
+ *
+ * with -m file, stage2 publishes its service table in that file,
+ * to be mapped read-only by any number of readers: a header followed
+ * by nslots fixed size entries, one per service slot (slot numbers
+ * are stable for the lifetime of a service). an unused slot has
+ * flags = 0.
+ *
+ * every entry is guarded by its own sequence counter, odd while
+ * stage2 is updating it: readers copy an entry and retry if the
+ * counter was odd or changed meanwhile (s2status_get () below).
+ * gen in the header grows after every batch of updates, so polling
+ * readers can tell whether anything changed at all.
+ */
+
+#ifndef S2STATUS_H
+#define S2STATUS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define S2STATUS_MAGIC		0x54533253
+#define S2STATUS_VERSION	1
+#define S2STATUS_NAMELEN	256
+
+struct s2status_hdr_s {
+  uint32_t magic ;
+  uint32_t version ;
+  uint32_t hdrsize ;
+  uint32_t entsize ;
+  uint32_t nslots ;
+  /* slots >= high are unused */
+  uint32_t high ;
+  int32_t pid ;
+  uint32_t reserved ;
+  uint64_t gen ;
+} ;
+
+struct s2status_ent_s {
+  uint32_t seq ;
+  /* S2CTL_ACTIVE ... from s2ctl.h, 0 if the slot is unused */
+  uint32_t flags ;
+  int32_t pid ;
+  int32_t logpid ;
+  /* deaths of the service and of its logger since stage2 knows it */
+  uint32_t restarts ;
+  uint32_t logrestarts ;
+  /* last wait status, -1 if there was none yet */
+  int32_t lastexit ;
+  int32_t loglastexit ;
+  /* wall clock times: last start, last change of this entry */
+  int64_t since ;
+  int64_t logsince ;
+  int64_t changed ;
+  char name [ S2STATUS_NAMELEN ] ;
+} ;
+
+static inline struct s2status_ent_s const * s2status_ent ( struct s2status_hdr_s const * h, const uint32_t k )
+{
+  return (struct s2status_ent_s const *) ( (char const *) h + h -> hdrsize + (size_t) k * h -> entsize ) ;
+}
+
+/* take a consistent copy of entry k, never blocks the writer */
+static inline void s2status_get ( struct s2status_hdr_s const * h, const uint32_t k, struct s2status_ent_s * e )
+{
+  struct s2status_ent_s const * const p = s2status_ent ( h, k ) ;
+
+  while ( 1 ) {
+    const uint32_t seq = __atomic_load_n ( & p -> seq, __ATOMIC_ACQUIRE ) ;
+
+    if ( seq & 1 ) { continue ; }
+
+    memcpy ( e, p, sizeof ( * e ) ) ;
+    __atomic_thread_fence ( __ATOMIC_ACQUIRE ) ;
+
+    if ( __atomic_load_n ( & p -> seq, __ATOMIC_RELAXED ) == seq ) { break ; }
+  }
+
+  e -> name [ S2STATUS_NAMELEN - 1 ] = 0 ;
+}
+
+#endif
@@ -3,13 +3,25 @@
  */
 
 #include "feat.h"
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
+#include <grp.h>
+#include <pwd.h>
 #include <skalibs/allreadwrite.h>
 #include <skalibs/sgetopt.h>
 #include <skalibs/types.h>
@@ -26,40 +38,365 @@
 #include "os.h"
 
 #if defined (OSLinux)
+#  include <sys/epoll.h>
 #  include <sys/prctl.h>
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#  include <sched.h>
 #  include <linux/vt.h>
 #  include <linux/kd.h>
+#  if defined (SYS_io_uring_setup) && defined (STATX_TYPE) && defined (__has_include)
+#    if __has_include (<linux/io_uring.h>)
+#      include <linux/io_uring.h>
+#      define SCAN_URING 1
+#    endif
+#  endif
 #endif
 
 #include "version.h"
+#include "s2ctl.h"
+#include "s2status.h"
+#include "s2db.h"
+#include "s2events.h"
 
-#define DIR_RETRY_TIMEOUT	3
-#define CHECK_RETRY_TIMEOUT	4
 #define FINISH_PROG		S6_SVSCAN_CTLDIR "/finish"
 #define CRASH_PROG		S6_SVSCAN_CTLDIR "/crash"
 #define SIGNAL_PROG		S6_SVSCAN_CTLDIR "/SIG"
 #define SIGNAL_PROG_LEN		(sizeof( SIGNAL_PROG ) - 1)
-#define USAGE			"s6-svscan [ -S | -s ] [ -c maxservices ] [ -t timeout ] [ -d notif ] [ dir ]"
+#define CONTROL_SOCKET		S6_SVSCAN_CTLDIR "/" S2CTL_SOCKET
+#define METRICS_FILE		S6_SVSCAN_CTLDIR "/metrics"
+#define ROOTS_FILE		S6_SVSCAN_CTLDIR "/roots"
+#define EVENTS_FILE		S6_SVSCAN_CTLDIR "/events"
+#ifndef SUPERVISE_PROG
+#  define SUPERVISE_PROG	S6_BINPREFIX "s6-supervise"
+#endif
+#define USAGE			"s6-svscan [ -S | -s ] [ -I ] [ -c maxservices ] [ -t timeout ] [ -d notif ] [ -r rate ] [ -b burst ] [ -j maxstarting ] [ -m statusfile ] [ -p pidfile ] [ -D db ] [ -P stallms ] [ -i idlemax ] [ -L ] [ dir ]"
 #define dieusage()		strerr_dieusage( 100, USAGE )
 
 /* integer constants */
-emum {
+enum {
   DIR_RETRY_TIMEOUT			= 3,
   CHECK_RETRY_TIMEOUT			= 4,
+  RESTART_DELAY_MAX			= 60,
+  RESTART_RESET				= 10,
+  START_SETTLE				= 1,
+  READY_TIMEOUT				= 60,
+  FINISH_TIMEOUT			= 5,
+  MAX_EVENTS				= 32,
+  /* children reaped and requests of a client handled per loop
+   * iteration, before the other event sources get their turn */
+  REAP_BUDGET				= 64,
+  CLIENT_BUDGET				= 16,
+  EV_MAX_FDS				= 1024,
+  CLIENT_MAX				= 8,
+  LOG_CHUNK				= 4096,
+  LOG_READS				= 16,
+  LOG_RING				= 4096,
+  LOG_MAXSIZE				= 1048576,
+  LOG_MAXFILES				= 4,
+  DEPS_MAX				= 4096,
+  SCAN_BATCH				= 128,
+  ROOT_MAX				= 16,
+  ROOTS_CONF				= 4096,
+  /* records in the flight recorder, a power of two */
+  EVENT_RING				= 4096,
+  /* two seconds, the least an unprivileged trigger may use */
+  PSI_WINDOW				= 2000000,
+  PSI_CALM				= 10,
+  /* idle class: the quiet seconds it waits for, and at most */
+  SETTLE_TIME				= 5,
+  SETTLE_MAX				= 120,
+  /* percent of time stalled on cpu or io over the last 10 seconds */
+  SETTLE_PSI				= 10,
+  LISTEN_MAX				= 8,
+  LISTEN_CONF				= 1024,
+  PROBE_INTERVAL			= 10,
+  PROBE_TIMEOUT				= 2,
+  PROBE_FAILURES			= 3,
+  PROBE_REQ				= 512,
+  EXEC_MAX				= 4096,
+  EXEC_RLIMITS				= 16,
   FLAG_DIVERT_SIGNALS_OFF		= 0x01,
   FLAG_USE_MQUEUE			= 0x02,
   FLAG_USE_ABSTRACT			= 0x04,
   WANT_KILL				= 0x01,
 } ;
 
+/* timer kinds: restart of a service's or logger's supervisor,
+ * end of a service's startup phase, timeout of a service's or
+ * logger's finish script (in-process mode), idle timeout of an
+ * on-demand service, next health probe or its timeout
+ */
+enum {
+  TIMER_SERVICE				= 0,
+  TIMER_LOG				= 1,
+  TIMER_READY				= 2,
+  TIMER_FINISH				= 3,
+  TIMER_LOGFINISH			= 4,
+  TIMER_IDLE				= 5,
+  TIMER_PROBE				= 6,
+  TIMER_KINDS				= 7,
+} ;
+
+/* health probe kinds, see probe_open () */
+enum {
+  PROBE_CONNECT				= 0,
+  PROBE_HTTP				= 1,
+  PROBE_HEARTBEAT			= 2,
+} ;
+
+/* event loop tags (the upper 32 bits of an event's data) */
+enum {
+  EV_SELFPIPE				= 1,
+  EV_CONTROL				= 2,
+  EV_SVCONTROL				= 3,
+  EV_LISTEN				= 4,
+  EV_CLIENT				= 5,
+  EV_LOG				= 6,
+  EV_NOTIFY				= 7,
+  EV_ACTIVATE				= 8,
+  EV_PIDFD				= 9,
+  EV_PSI				= 10,
+  EV_PROBE				= 11,
+} ;
+
+/* resources used by the dead processes of a service (or its logger) */
+struct usage_s {
+  /* CPU time in microseconds */
+  uint64_t utime ;
+  uint64_t stime ;
+  uint64_t majflt ;
+  /* milliseconds they were up */
+  uint64_t uptime ;
+  /* KiB */
+  long maxrss ;
+  unsigned int failed ;
+  unsigned int signaled ;
+} ;
+
+/* log multiplexer state of a service */
+struct logmux_s {
+  int fd ;
+  uint64_t size ;
+  unsigned int maxsize ;
+  unsigned int maxfiles ;
+  unsigned int midline : 1 ;
+  unsigned int failing : 1 ;
+  unsigned int ringfull : 1 ;
+  /* the latest output */
+  size_t ringpos ;
+  char ring [ LOG_RING ] ;
+} ;
+
+/* the listening sockets of a service, see sockets_open () */
+struct sockets_s {
+  unsigned int n ;
+  unsigned int idle ;
+  unsigned int ondemand : 1 ;
+  /* the sockets are watched for the first client */
+  unsigned int armed : 1 ;
+  /* on-demand: a client came, the service should run */
+  unsigned int wanted : 1 ;
+  tain_t lastuse ;
+  int fd [ LISTEN_MAX ] ;
+} ;
+
+/* the health probe of a service, see probe_open () */
+struct probe_s {
+  union {
+    struct sockaddr sa ;
+    struct sockaddr_in in ;
+    struct sockaddr_in6 in6 ;
+    struct sockaddr_un un ;
+  } a ;
+  socklen_t alen ;
+  unsigned int kind ;
+  unsigned int interval ;
+  unsigned int timeout ;
+  unsigned int maxfails ;
+  /* failures in a row */
+  unsigned int fails ;
+  /* the connection of a probe under way, or the heartbeat socket */
+  int fd ;
+  /* http: the request is sent, the status line being read */
+  unsigned int reading : 1 ;
+  unsigned int got ;
+  char answer [ 12 ] ;
+  /* heartbeat: the service has been up for a whole interval, and a
+   * datagram came during the current one */
+  unsigned int armed : 1 ;
+  unsigned int beat : 1 ;
+  /* http: the request */
+  size_t len ;
+  char buf [ PROBE_REQ ] ;
+} ;
+
+/* a service started without ./run, see execinfo_load () */
+struct execinfo_s {
+  /* the newest mtime of the files it was read from */
+  struct timespec stamp ;
+  /* the strings argv, env and cwd point into */
+  char * strings ;
+  char const ** argv ;
+  /* VAR=value to set, VAR to unset */
+  char const ** env ;
+  size_t nenv ;
+  char const * cwd ;
+  uid_t uid ;
+  gid_t gid ;
+  unsigned int flaguser : 1 ;
+  unsigned int nrl ;
+  struct {
+    int res ;
+    struct rlimit rl ;
+  } rl [ EXEC_RLIMITS ] ;
+} ;
+
+/* an fd for a child: from in the parent, to in the child */
+struct fdmove_s {
+  int from ;
+  int to ;
+} ;
+
 struct svinfo_s {
   dev_t dev ;
   ino_t ino ;
+  char * name ;
   tain_t restartafter [ 2 ] ;
   pid_t pid [ 2 ] ;
   int p [ 2 ] ;
+  /* in-process mode: finish script pids and control fifos */
+  pid_t fpid [ 2 ] ;
+  int ctl [ 2 ] ;
+  /* position + 1 of the timers in the timer heap, 0 if unset */
+  size_t tpos [ TIMER_KINDS ] ;
+  /* links + 1 in the queue of pending starts, 0 if none */
+  unsigned int qnext, qprev ;
+  /* the scan root it belongs to, see rootof () */
+  unsigned int root ;
+  unsigned int flagused : 1 ;
   unsigned int flagactive : 1 ;
   unsigned int flaglog : 1 ;
+  unsigned int flagquarantine : 1 ;
+  unsigned int flagcritical : 1 ;
+  unsigned int flagqueued : 1 ;
+  unsigned int flagstarting : 1 ;
+  /* in-process mode: bit 0 (service) and 1 (logger) set if wanted down */
+  unsigned int down : 2 ;
+  /* readiness and dependencies, see startwaiting () */
+  unsigned int flagready : 1 ;
+  unsigned int flagwaiting : 1 ;
+  unsigned int flagnodeps : 1 ;
+  unsigned int flagdepwarn : 1 ;
+  unsigned int visit : 2 ;
+  /* restart accounting, see backoff () */
+  tain_t startedat [ 2 ] ;
+  tain_t windowstart ;
+  unsigned int fails [ 2 ] ;
+  unsigned int windowcount ;
+  /* history, for the status file */
+  unsigned int restarts [ 2 ] ;
+  int wstat [ 2 ] ;
+  time_t since [ 2 ] ;
+  struct usage_s usage [ 2 ] ;
+  /* with -L: the log multiplexer state, NULL without a log directory */
+  struct logmux_s * lm ;
+  /* the services this one needs: ndeps NUL terminated names, and the
+   * slots they were last found in */
+  char * deps ;
+  unsigned int * depidx ;
+  unsigned int ndeps ;
+  /* the fd the service signals readiness on (0: none), and our end:
+   * the pipe (in-process mode) or the event fifo of s6-supervise */
+  unsigned int notifyfd ;
+  int nfd ;
+  /* sockets bound for the service, NULL if none */
+  struct sockets_s * ls ;
+  /* its health probe, NULL if none */
+  struct probe_s * pr ;
+  /* cpu, memory and scheduling settings, NULL if none */
+  struct tune_s * tune ;
+  /* in-process mode: the parsed argv file, NULL for ./run */
+  struct execinfo_s * ex ;
+  /* adopted processes that are not our children, see adopt () */
+  int pidfd [ 2 ] ;
+  /* restart policy, read from the service directory */
+  unsigned int delaymax ;
+  unsigned int resetafter ;
+  unsigned int limit ;
+  unsigned int window ;
+  /* templates, see instances (): a directory name@ is never started
+   * itself, its instances name@inst run its definition with inst as
+   * argument and share its settings. tpl is the template's slot + 1
+   * in an instance, ninst the number of instances in a template. */
+  unsigned int tpl ;
+  unsigned int ninst ;
+  unsigned int flagtemplate : 1 ;
+  /* created by a control request, not listed in the instances file */
+  unsigned int flagdynamic : 1 ;
+  /* under pressure, see pressure_begin (): not restarted, stopped */
+  unsigned int flaglowprio : 1 ;
+  unsigned int flagshed : 1 ;
+  unsigned int flagdeferred : 1 ;
+  unsigned int flagshedding : 1 ;
+  /* start class idle: held back by admit () until the system settles */
+  unsigned int flagidleclass : 1 ;
+  unsigned int flagheld : 1 ;
+} ;
+
+/* the pid index: a process of service i, open addressing with
+ * linear probing. v is i << 2 | isfinish << 1 | islog. */
+struct pident_s {
+  pid_t pid ;
+  unsigned int v ;
+} ;
+
+/* a growing output buffer */
+struct buf_s {
+  char * s ;
+  size_t len, max ;
+} ;
+
+/* a connection to the control socket: a buffer for the request being
+ * read and one for the replies not yet written
+ */
+struct client_s {
+  int fd ;
+  size_t inlen ;
+  struct buf_s out ;
+  size_t outpos ;
+  int waiting ;
+  char in [ sizeof ( struct s2ctl_hdr_s ) + S2CTL_MAXREQ ] ;
+} ;
+
+/* per-service timer, kept in a binary min-heap ordered by deadline */
+struct timer_s {
+  tain_t when ;
+  unsigned int i ;
+  unsigned int kind ;
+} ;
+
+/* a scan root: the scan directory (roots [ 0 ]) or one listed in
+ * ROOTS_FILE. each has its own rescan deadline, capacity, spawn rate
+ * limiter and queue of pending starts.
+ */
+struct root_s {
+  /* NULL for the scan directory */
+  char const * path ;
+  size_t len ;
+  tain_t timeout ;
+  tain_t deadline ;
+  int wantscan ;
+  size_t max, nused ;
+  /* a token bucket refilled with ratelimit tokens (in thousandths)
+   * per second up to burst tokens */
+  unsigned int ratelimit, burst ;
+  uint64_t tokens ;
+  tain_t tokenstamp ;
+  unsigned int qhead, qtail ;
+  /* the wantkill bits for a service whose directory is gone, 0 to
+   * leave it running until a prune */
+  unsigned int kill ;
 } ;
 
 /* set process resource (upper) limits */
@@ -77,23 +414,206 @@ static int set_rlimits ( void )
   return setrlimit ( RLIMIT_CORE, & rlim ) ;
 }
 
-static size_t max = 500, n = 0 ;
+/* n is the high-water mark of used slots in services [],
+ * nused the number of slots actually in use. slots are never moved,
+ * so their indices can be kept in the timer heap and in event tags.
+ */
+static size_t max = 500, n = 0, nused = 0, ntimers = 0 ;
+/* a cap on the number of services in their startup phase; the
+ * spawn rate limiters are per root.
+ */
+static unsigned int maxstarting = 0, nstarting = 0 ;
+/* the scan roots, and the one scan () is going through */
+static struct root_s roots [ ROOT_MAX ] = { { .burst = 1 } } ;
+static unsigned int nroots = 1, scanroot = 0 ;
 static int wantreap = 1 ;
+/* scan every root */
 static int wantscan = 1 ;
+static int wantdeps = 0 ;
+static int wantreexec = 0 ;
+/* a client has requests left over when its budget ran out */
+static int wantclients = 0 ;
+static struct pident_s * pids ;
+static size_t pidmask ;
+/* the loop: reaped children (of them, processes that were none of
+ * ours), iterations, and the time they took to handle what woke
+ * them up, in microseconds */
+static uint64_t nreaped = 0 ;
+static uint64_t norphans = 0 ;
+static uint64_t nloops = 0 ;
+static uint64_t loopbusy = 0 ;
+static uint64_t loopmax = 0 ;
+/* scans (of one root or more), the time they took and that of the
+ * last one, in microseconds */
+static uint64_t nscans = 0 ;
+static uint64_t scanbusy = 0 ;
+static uint64_t scanlast = 0 ;
+/* with -P: the PSI trigger threshold in microseconds of stall per
+ * second, and whether a trigger fired in the last PSI_CALM seconds */
+static unsigned int psistall = 0 ;
+static int pressure = 0 ;
+static tain_t pressureuntil ;
+/* until the idle class goes: when at the latest, whether things are
+ * quiet and when they will have been for long enough, the next look
+ * at the load */
+static int settling = 1 ;
+static int wantsettle = 0 ;
+static int quiet = 0 ;
+static unsigned int settlemax = SETTLE_MAX ;
+static tain_t settleuntil ;
+static tain_t settleat ;
+static tain_t settlepoll ;
 static unsigned int wantkill = 0 ;
 static int cont = 1 ;
+static int inproc = 0 ;
+static int logmux = 0 ;
+static int evfd = -1 ;
+static int lsfd = -1 ;
+static sigset_t trapped ;
+#ifndef STAGE2_FORK
+static posix_spawnattr_t spawnattr ;
+#endif
 static unsigned long int what = 0, got_sig = 0 ;
 static char const * finish_arg = "reboot" ;
-static tain_t deadline, defaulttimeout ;
 static struct svinfo_s * services ;
+static struct timer_s * timers ;
+static struct client_s clients [ CLIENT_MAX ] ;
+/* the status file and the slots that changed since it was updated */
+static char const * statusfn = NULL ;
+/* with -D: the service database mapped, see scan_db () */
+static char const * dbfn = NULL ;
+static struct s2db_hdr_s const * db = NULL ;
+static size_t dbsize = 0 ;
+static dev_t dbdev ;
+static ino_t dbino ;
+static struct s2status_hdr_s * status = NULL ;
+static unsigned int * dirty ;
+static unsigned char * dirtymark ;
+static size_t ndirty = 0 ;
+/* the flight recorder: the ring, the events recorded, and when it
+ * started, on the clock of the loop and on the wall clock */
+static struct s2ev_s events [ EVENT_RING ] ;
+static uint64_t nevents = 0 ;
+static tain_t evstamp ;
+static int64_t evstart = 0 ;
 
+static void runfinish ( const unsigned int, const unsigned int, const int ) ;
+static void account ( const unsigned int, const unsigned int, const int, const int, struct rusage const * ) ;
+static void metrics_write ( void ) ;
+static void finished ( const unsigned int, const unsigned int ) ;
+static void wantstart ( const unsigned int, const unsigned int ) ;
+static void sockets_close ( const unsigned int ) ;
+static void probe_close ( const unsigned int ) ;
+static void tune_free ( const unsigned int ) ;
+static void adopt_unwatch ( const unsigned int, const unsigned int ) ;
+static int buf_put ( struct buf_s *, void const *, const size_t ) ;
+static void execinfo_free ( const unsigned int ) ;
+static int svtell ( const unsigned int, const unsigned int, char const *, const size_t ) ;
 static void panicnosp ( const char * ) gccattr_noreturn ;
 
+/* record an event: a handful of stores, the time is the one the loop
+ * last read */
+static void event ( const unsigned int type, const unsigned int flags, const unsigned int slot, const int a, const int b )
+{
+  struct s2ev_s * const e = events + ( nevents ++ & ( EVENT_RING - 1 ) ) ;
+
+  e -> time = (uint64_t) ( STAMP . sec . x - evstamp . sec . x ) * 1000000 + STAMP . nano / 1000 - evstamp . nano / 1000 ;
+  e -> type = type ;
+  e -> flags = flags ;
+  e -> slot = slot ;
+  e -> a = a ;
+  e -> b = b ;
+}
+
+/* the times of the events are relative to this */
+static void events_init ( void )
+{
+  struct timespec ts ;
+
+  (void) clock_gettime ( CLOCK_REALTIME, & ts ) ;
+  tain_now_g () ;
+  evstamp = STAMP ;
+  evstart = (int64_t) ts . tv_sec * 1000000 + ts . tv_nsec / 1000 ;
+}
+
+/* write the ring and the names of the services to EVENTS_FILE, see
+ * s2events.h. allocates nothing: a panic does it too.
+ */
+static int events_dump ( void )
+{
+  struct s2ev_hdr_s h ;
+  const size_t pos = nevents & ( EVENT_RING - 1 ) ;
+  char buf [ 4096 ] ;
+  size_t len = 0 ;
+  unsigned int i ;
+  int fd ;
+
+  memset ( & h, 0, sizeof ( h ) ) ;
+  h . magic = S2EV_MAGIC ;
+  h . version = S2EV_VERSION ;
+  h . hdrsize = sizeof ( h ) ;
+  h . recsize = sizeof ( struct s2ev_s ) ;
+  h . count = ( EVENT_RING < nevents ) ? EVENT_RING : nevents ;
+  h . total = nevents ;
+  h . start = evstart ;
+  h . pid = getpid () ;
+
+  for ( i = 0 ; services && i < n ; ++ i ) { h . nnames += services [ i ] . flagused ; }
+
+  fd = open ( EVENTS_FILE ".new", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00600 ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  if ( allwrite ( fd, (char const *) & h, sizeof ( h ) ) < sizeof ( h )
+    || ( EVENT_RING < nevents && allwrite ( fd, (char const *) ( events + pos ), ( EVENT_RING - pos ) * sizeof ( struct s2ev_s ) )
+      < ( EVENT_RING - pos ) * sizeof ( struct s2ev_s ) )
+    || allwrite ( fd, (char const *) events, pos * sizeof ( struct s2ev_s ) ) < pos * sizeof ( struct s2ev_s ) ) { goto err ; }
+
+  for ( i = 0 ; services && i < n ; ++ i ) {
+    struct s2ev_name_s e ;
+
+    if ( ! services [ i ] . flagused ) { continue ; }
+
+    e . slot = i ;
+    e . len = strlen ( services [ i ] . name ) + 1 ;
+
+    if ( sizeof ( buf ) < len + sizeof ( e ) + e . len ) {
+      if ( allwrite ( fd, buf, len ) < len ) { goto err ; }
+      len = 0 ;
+    }
+
+    if ( sizeof ( buf ) < sizeof ( e ) + e . len ) {
+      if ( allwrite ( fd, (char const *) & e, sizeof ( e ) ) < sizeof ( e )
+        || allwrite ( fd, services [ i ] . name, e . len ) < e . len ) { goto err ; }
+      continue ;
+    }
+
+    memcpy ( buf + len, & e, sizeof ( e ) ) ;
+    memcpy ( buf + len + sizeof ( e ), services [ i ] . name, e . len ) ;
+    len += sizeof ( e ) + e . len ;
+  }
+
+  if ( allwrite ( fd, buf, len ) < len ) { goto err ; }
+
+  fd_close ( fd ) ;
+  return rename ( EVENTS_FILE ".new", EVENTS_FILE ) ;
+
+err :
+  {
+    const int e = errno ;
+
+    fd_close ( fd ) ;
+    errno = e ;
+  }
+  return -1 ;
+}
+
 static void panicnosp ( const char * errmsg )
 {
   char const * eargv [ 2 ] = { CRASH_PROG, 0 } ;
 
+  event ( S2EV_PANIC, 0, S2EV_NOSLOT, errno, 0 ) ;
   strerr_warnwu1sys ( errmsg ) ;
+  if ( events_dump () < 0 ) { strerr_warnwu2sys ( "write ", EVENTS_FILE ) ; }
   strerr_warnw2x ( "executing into ", eargv [ 0 ] ) ;
   //(void) execve ( eargv [ 0 ], (char * const *) eargv, (char * const *) environ ) ;
   (void) execv ( eargv [ 0 ], (char * const *) eargv ) ;
@@ -112,376 +632,6256 @@ static void panic ( char const * errmsg )
   panicnosp ( errmsg ) ;
 }
 
-static void killthem ( void )
+/* the timer heap: timers [ 0 ] is always the next timer to expire */
+static void timer_place ( size_t k, struct timer_s const * t )
 {
-  unsigned int i = 0 ;
+  timers [ k ] = * t ;
+  services [ t -> i ] . tpos [ t -> kind ] = k + 1 ;
+}
 
-  if ( ! wantkill ) { return ; }
+static void timer_up ( size_t k )
+{
+  const struct timer_s t = timers [ k ] ;
 
-  for ( i = 0 ; i < n ; ++ i ) {
-    if ( ! ( wantkill & 1 ) && services [ i ] . flagactive ) { continue ; }
+  while ( k ) {
+    const size_t parent = ( k - 1 ) >> 1 ;
 
-    if ( services [ i ] . pid [ 0 ] ) {
-      (void) kill ( services [ i ] . pid [ 0 ], ( wantkill & 2 ) ? SIGTERM : SIGHUP ) ;
-    }
+    if ( ! tain_less ( & t . when, & timers [ parent ] . when ) ) { break ; }
 
-    if ( services [ i ] . flaglog && services [ i ] . pid [ 1 ] ) {
-      (void) kill ( services [ i ] . pid [ 1 ], ( wantkill & 4 ) ? SIGTERM : SIGHUP ) ;
-    }
+    timer_place ( k, timers + parent ) ;
+    k = parent ;
   }
 
-  wantkill = 0 ;
+  timer_place ( k, & t ) ;
 }
 
-static void term ( void )
+static void timer_down ( size_t k )
 {
-  cont = 0 ;
-  wantkill = 3 ;
+  const struct timer_s t = timers [ k ] ;
+
+  while ( 1 ) {
+    size_t c = ( k << 1 ) + 1 ;
+
+    if ( c >= ntimers ) { break ; }
+
+    if ( c + 1 < ntimers && tain_less ( & timers [ c + 1 ] . when, & timers [ c ] . when ) ) { ++ c ; }
+
+    if ( ! tain_less ( & timers [ c ] . when, & t . when ) ) { break ; }
+
+    timer_place ( k, timers + c ) ;
+    k = c ;
+  }
+
+  timer_place ( k, & t ) ;
 }
 
-static void hup ( void )
+static void timer_cancel ( const unsigned int i, const unsigned int kind )
 {
-  cont = 0 ;
-  wantkill = 1 ;
+  const size_t k = services [ i ] . tpos [ kind ] ;
+
+  if ( ! k ) { return ; }
+
+  services [ i ] . tpos [ kind ] = 0 ;
+
+  if ( k < ntimers ) {
+    timers [ k - 1 ] = timers [ -- ntimers ] ;
+    timer_down ( k - 1 ) ;
+    timer_up ( services [ timers [ k - 1 ] . i ] . tpos [ timers [ k - 1 ] . kind ] - 1 ) ;
+  } else {
+    -- ntimers ;
+  }
 }
 
-static void quit ( void )
+/* (re)arm a timer of a service */
+static void timer_set ( const unsigned int i, const unsigned int kind, tain_t const * when )
 {
-  cont = 0 ;
-  wantkill = 7 ;
+  size_t k = services [ i ] . tpos [ kind ] ;
+
+  if ( k ) {
+    const int earlier = tain_less ( when, & timers [ k - 1 ] . when ) ;
+
+    timers [ k - 1 ] . when = * when ;
+
+    if ( earlier ) { timer_up ( k - 1 ) ; }
+    else { timer_down ( k - 1 ) ; }
+  } else {
+    timers [ ntimers ] . when = * when ;
+    timers [ ntimers ] . i = i ;
+    timers [ ntimers ] . kind = kind ;
+    timer_up ( ntimers ++ ) ;
+  }
 }
 
-static void intr ( void )
+static size_t pidhash ( const pid_t pid )
 {
-  finish_arg = "reboot" ;
-  term () ;
+  return ( (uint32_t) pid * 2654435761u ) & pidmask ;
 }
 
-static void usr1 ( void )
+/* the slot of pid in the index, or of the free entry it would go to */
+static size_t pidslot ( const pid_t pid )
 {
-  finish_arg = "poweroff" ;
-  term () ;
+  size_t k = pidhash ( pid ) ;
+
+  while ( pids [ k ] . pid && pids [ k ] . pid != pid ) { k = ( k + 1 ) & pidmask ; }
+
+  return k ;
 }
 
-static void handle_signals ( void )
+static void piddel ( const pid_t pid )
 {
+  size_t k = pidslot ( pid ), j = k ;
+
+  if ( ! pids [ k ] . pid ) { return ; }
+
+  /* backward shift: move up the entries that would not be found
+   * past the hole any more */
   while ( 1 ) {
-    switch ( selfpipe_read () ) {
-      case -1 : panic ( "selfpipe_read" ) ;
-      case 0 : return ; break ;
-      case SIGCHLD : wantreap = 1 ; break ;
-      case SIGALRM : wantscan = 1 ; break ;
-      case SIGABRT : cont = 0 ; break ;
-      case SIGTERM : term() ; break ;
-      case SIGHUP : hup() ; break ;
-      case SIGQUIT : quit() ; break ;
-      case SIGINT : intr() ; break ;
+    size_t h ;
+
+    j = ( j + 1 ) & pidmask ;
+    if ( ! pids [ j ] . pid ) { break ; }
+
+    h = pidhash ( pids [ j ] . pid ) ;
+    if ( ( ( j - h ) & pidmask ) < ( ( j - k ) & pidmask ) ) { continue ; }
+
+    pids [ k ] = pids [ j ] ;
+    k = j ;
+  }
+
+  pids [ k ] . pid = 0 ;
+}
+
+/* set a pid of a service, keeping the index in step */
+static void pidset ( const unsigned int i, const unsigned int islog, const unsigned int isfinish, const pid_t pid )
+{
+  pid_t * const p = isfinish ? services [ i ] . fpid + islog : services [ i ] . pid + islog ;
+
+  if ( 0 < * p ) { piddel ( * p ) ; }
+  * p = pid ;
+
+  if ( 0 < pid ) {
+    const size_t k = pidslot ( pid ) ;
+
+    pids [ k ] . pid = pid ;
+    pids [ k ] . v = i << 2 | isfinish << 1 | islog ;
+  }
+}
+
+/* remember to publish the state of a service */
+static void svdirty ( const unsigned int i )
+{
+  if ( ! status || dirtymark [ i ] ) { return ; }
+
+  dirtymark [ i ] = 1 ;
+  dirty [ ndirty ++ ] = i ;
+}
+
+/* the queue of services waiting for the spawn rate limiter,
+ * an intrusive doubly linked list through the service slots.
+ */
+static void queue_push ( const unsigned int i )
+{
+  struct root_s * const r = roots + services [ i ] . root ;
+
+  if ( services [ i ] . flagqueued ) { return ; }
+
+  svdirty ( i ) ;
+  services [ i ] . flagqueued = 1 ;
+  services [ i ] . qnext = 0 ;
+  services [ i ] . qprev = r -> qtail ;
+
+  if ( r -> qtail ) { services [ r -> qtail - 1 ] . qnext = i + 1 ; }
+  else { r -> qhead = i + 1 ; }
+
+  r -> qtail = i + 1 ;
+}
+
+static void queue_remove ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct root_s * const r = roots + sv -> root ;
+
+  if ( ! sv -> flagqueued ) { return ; }
+
+  svdirty ( i ) ;
+
+  if ( sv -> qprev ) { services [ sv -> qprev - 1 ] . qnext = sv -> qnext ; }
+  else { r -> qhead = sv -> qnext ; }
+
+  if ( sv -> qnext ) { services [ sv -> qnext - 1 ] . qprev = sv -> qprev ; }
+  else { r -> qtail = sv -> qprev ; }
+
+  sv -> flagqueued = 0 ;
+  sv -> qnext = sv -> qprev = 0 ;
+}
+
+/* is a start pending in some queue ? */
+static int queued ( void )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; k < nroots ; ++ k ) {
+    if ( roots [ k ] . qhead ) { return 1 ; }
+  }
+
+  return 0 ;
+}
+
+/* the startup phase of a service is over */
+static void started ( const unsigned int i )
+{
+  if ( ! services [ i ] . flagstarting ) { return ; }
+
+  svdirty ( i ) ;
+  services [ i ] . flagstarting = 0 ;
+  timer_cancel ( i, TIMER_READY ) ;
+  -- nstarting ;
+}
+
+/* a service is up and ready: its dependants may start */
+static void ready ( const unsigned int i )
+{
+  if ( services [ i ] . flagready ) { return ; }
+
+  svdirty ( i ) ;
+  services [ i ] . flagready = 1 ;
+  started ( i ) ;
+  wantdeps = 1 ;
+}
+
+/* the event loop backend: epoll(7) on Linux, iopause elsewhere */
+#if defined (OSLinux)
+static int ev_init ( void )
+{
+  evfd = epoll_create1 ( EPOLL_CLOEXEC ) ;
+  return evfd ;
+}
+
+static int ev_add ( const int fd, const uint32_t kind, const uint32_t i )
+{
+  struct epoll_event e ;
+
+  e . events = EPOLLIN ;
+  e . data . u64 = ( (uint64_t) kind << 32 ) | i ;
+
+  return epoll_ctl ( evfd, EPOLL_CTL_ADD, fd, & e ) ;
+}
+
+/* wait for fd to become writable instead of readable, or back */
+static int ev_mod ( const int fd, const uint32_t kind, const uint32_t i, const int out )
+{
+  struct epoll_event e ;
+
+  e . events = out ? EPOLLOUT : EPOLLIN ;
+  e . data . u64 = ( (uint64_t) kind << 32 ) | i ;
+
+  return epoll_ctl ( evfd, EPOLL_CTL_MOD, fd, & e ) ;
+}
+
+/* edge triggered: one event per new arrival, nothing to drain */
+static int ev_edge ( const int fd, const uint32_t kind, const uint32_t i )
+{
+  struct epoll_event e ;
+
+  e . events = EPOLLIN | EPOLLET ;
+  e . data . u64 = ( (uint64_t) kind << 32 ) | i ;
+
+  return epoll_ctl ( evfd, EPOLL_CTL_ADD, fd, & e ) ;
+}
+
+/* exceptional conditions only, for PSI triggers */
+static int ev_pri ( const int fd, const uint32_t kind, const uint32_t i )
+{
+  struct epoll_event e ;
+
+  e . events = EPOLLPRI ;
+  e . data . u64 = ( (uint64_t) kind << 32 ) | i ;
+
+  return epoll_ctl ( evfd, EPOLL_CTL_ADD, fd, & e ) ;
+}
+
+static void ev_del ( const int fd )
+{
+  (void) epoll_ctl ( evfd, EPOLL_CTL_DEL, fd, NULL ) ;
+}
+
+/* wait until something happens on a registered fd or until the deadline
+ * has passed. returns the number of ready events stored in tags.
+ */
+static int ev_wait ( uint64_t * tags, const unsigned int len, tain_t const * deadline )
+{
+  int i, r, ms = -1 ;
+  struct epoll_event e [ MAX_EVENTS ] ;
+
+  if ( ! tain_future ( deadline ) ) { ms = 0 ; }
+  else {
+    tain_t t ;
+
+    tain_sub ( & t, deadline, & STAMP ) ;
+    ms = tain_to_millisecs ( & t ) ;
+    /* do not wake up early and spin until the deadline is reached */
+    if ( 0 <= ms && ms < 0x7fffffff ) { ++ ms ; }
+  }
+
+  r = epoll_wait ( evfd, e, ( MAX_EVENTS < len ) ? MAX_EVENTS : len, ms ) ;
+  tain_now_g () ;
+
+  if ( 0 > r ) { return ( EINTR == errno ) ? 0 : r ; }
+
+  for ( i = 0 ; i < r ; ++ i ) {
+    /* a client or a probed service going away is its handler's
+     * business, not ours */
+    if ( e [ i ] . events & ( EPOLLERR | EPOLLHUP ) && ! ( e [ i ] . events & EPOLLIN )
+      && EV_CLIENT != e [ i ] . data . u64 >> 32 && EV_PROBE != e [ i ] . data . u64 >> 32 ) {
+      errno = EIO ;
+      return -1 ;
+    }
+
+    tags [ i ] = e [ i ] . data . u64 ;
+  }
+
+  return r ;
+}
+#else
+static iopause_fd evx [ EV_MAX_FDS ] ;
+static uint64_t evtag [ EV_MAX_FDS ] ;
+static unsigned int nevx = 0 ;
+
+static int ev_init ( void )
+{
+  nevx = 0 ;
+  return 0 ;
+}
+
+static int ev_add ( const int fd, const uint32_t kind, const uint32_t i )
+{
+  if ( EV_MAX_FDS <= nevx ) {
+    errno = ENFILE ;
+    return -1 ;
+  }
+
+  evx [ nevx ] . fd = fd ;
+  evx [ nevx ] . events = IOPAUSE_READ ;
+  evtag [ nevx ++ ] = ( (uint64_t) kind << 32 ) | i ;
+
+  return 0 ;
+}
+
+static int ev_mod ( const int fd, const uint32_t kind, const uint32_t i, const int out )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; k < nevx ; ++ k ) {
+    if ( evx [ k ] . fd == fd ) {
+      evx [ k ] . events = out ? IOPAUSE_WRITE : IOPAUSE_READ ;
+      evtag [ k ] = ( (uint64_t) kind << 32 ) | i ;
+      return 0 ;
+    }
+  }
+
+  errno = ENOENT ;
+  return -1 ;
+}
+
+/* no edge triggering here: do not watch at all */
+static int ev_edge ( const int fd, const uint32_t kind, const uint32_t i )
+{
+  (void) fd ;
+  (void) kind ;
+  (void) i ;
+  return 0 ;
+}
+
+static void ev_del ( const int fd )
+{
+  unsigned int i ;
+
+  for ( i = 0 ; i < nevx ; ++ i ) {
+    if ( evx [ i ] . fd == fd ) {
+      evx [ i ] = evx [ -- nevx ] ;
+      evtag [ i ] = evtag [ nevx ] ;
+      break ;
+    }
+  }
+}
+
+static int ev_wait ( uint64_t * tags, const unsigned int len, tain_t const * deadline )
+{
+  unsigned int i, j = 0 ;
+  const int r = iopause_g ( evx, nevx, deadline ) ;
+
+  if ( 0 >= r ) { return r ; }
+
+  for ( i = 0 ; i < nevx && j < len ; ++ i ) {
+    if ( evx [ i ] . revents & IOPAUSE_EXCEPT && EV_CLIENT != evtag [ i ] >> 32 && EV_PROBE != evtag [ i ] >> 32 ) {
+      errno = EIO ;
+      return -1 ;
     }
+
+    if ( evx [ i ] . revents ) { tags [ j ++ ] = evtag [ i ] ; }
+  }
+
+  return j ;
+}
+#endif
+
+/* readiness notification: in-process mode reads the pipe it gave the
+ * service as its notification-fd, otherwise stage2 subscribes to the
+ * events of s6-supervise through a fifo in its event directory.
+ */
+#define NOTIFY_FIFO		"/event/ftrig1stage2"
+
+static void notify_close ( const unsigned int i )
+{
+  if ( 0 > services [ i ] . nfd ) { return ; }
+
+  ev_del ( services [ i ] . nfd ) ;
+  fd_close ( services [ i ] . nfd ) ;
+  services [ i ] . nfd = -1 ;
+}
+
+static void notify_subscribe ( const unsigned int i )
+{
+  char const * const name = services [ i ] . name ;
+  const size_t len = strlen ( name ) ;
+  char fn [ len + sizeof ( NOTIFY_FIFO ) ] ;
+  int fd ;
+
+  memcpy ( fn, name, len ) ;
+  memcpy ( fn + len, "/event", 7 ) ;
+
+  if ( mkdir ( fn, 0700 ) < 0 && EEXIST != errno ) {
+    strerr_warnwu2sys ( "mkdir ", fn ) ;
+    return ;
+  }
+
+  memcpy ( fn + len, NOTIFY_FIFO, sizeof ( NOTIFY_FIFO ) ) ;
+
+  if ( mkfifo ( fn, 0600 ) < 0 && EEXIST != errno ) {
+    strerr_warnwu2sys ( "mkfifo ", fn ) ;
+    return ;
+  }
+
+  /* read-write: s6-supervise can always open it, and no EOF ever */
+  fd = open ( fn, O_RDWR | O_NONBLOCK | O_CLOEXEC ) ;
+
+  if ( 0 > fd || 0 > ev_add ( fd, EV_NOTIFY, i ) ) {
+    strerr_warnwu2sys ( "watch ", fn ) ;
+    if ( 0 <= fd ) { fd_close ( fd ) ; }
+    return ;
+  }
+
+  services [ i ] . nfd = fd ;
+}
+
+static void notify_unsubscribe ( const unsigned int i )
+{
+  char const * const name = services [ i ] . name ;
+  const size_t len = strlen ( name ) ;
+  char fn [ len + sizeof ( NOTIFY_FIFO ) ] ;
+
+  if ( 0 > services [ i ] . nfd ) { return ; }
+
+  notify_close ( i ) ;
+  memcpy ( fn, name, len ) ;
+  memcpy ( fn + len, NOTIFY_FIFO, sizeof ( NOTIFY_FIFO ) ) ;
+  (void) unlink ( fn ) ;
+}
+
+static void handle_notify ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+
+  while ( 0 <= sv -> nfd ) {
+    char buf [ 64 ] ;
+    ssize_t k, r = sanitize_read ( fd_read ( sv -> nfd, buf, sizeof ( buf ) ) ) ;
+
+    if ( 0 >= r ) {
+      if ( 0 > r ) {
+        if ( EPIPE != errno ) { strerr_warnwu2sys ( "read readiness notification of ", sv -> name ) ; }
+        notify_close ( i ) ;
+      }
+      return ;
+    }
+
+    for ( k = 0 ; k < r ; ++ k ) {
+      if ( inproc ) {
+        /* the s6 convention: a newline, then the fd is useless */
+        if ( '\n' != buf [ k ] ) { continue ; }
+        ready ( i ) ;
+        notify_close ( i ) ;
+        return ;
+      } else if ( 'U' == buf [ k ] ) {
+        ready ( i ) ;
+      } else if ( 'd' == buf [ k ] && sv -> flagready ) {
+        svdirty ( i ) ;
+        sv -> flagready = 0 ;
+      }
+    }
+  }
+}
+
+/* release a service slot */
+static void svfree ( const unsigned int i )
+{
+  unsigned int k ;
+
+  event ( S2EV_DROP, 0, i, 0, 0 ) ;
+  queue_remove ( i ) ;
+  started ( i ) ;
+  if ( inproc ) { notify_close ( i ) ; }
+  else { notify_unsubscribe ( i ) ; }
+  sockets_close ( i ) ;
+  probe_close ( i ) ;
+  adopt_unwatch ( i, 0 ) ;
+  adopt_unwatch ( i, 1 ) ;
+  tune_free ( i ) ;
+  execinfo_free ( i ) ;
+  if ( services [ i ] . tpl ) { -- services [ services [ i ] . tpl - 1 ] . ninst ; }
+  else {
+    free ( services [ i ] . deps ) ;
+    free ( services [ i ] . depidx ) ;
+  }
+  services [ i ] . tpl = 0 ;
+  services [ i ] . flagtemplate = services [ i ] . flagdynamic = 0 ;
+  services [ i ] . deps = NULL ;
+  services [ i ] . depidx = NULL ;
+  services [ i ] . ndeps = 0 ;
+  services [ i ] . flagready = services [ i ] . flagwaiting = 0 ;
+  wantdeps = 1 ;
+
+  for ( k = 0 ; k < TIMER_KINDS ; ++ k ) { timer_cancel ( i, k ) ; }
+
+  for ( k = 0 ; k < 2 ; ++ k ) {
+    if ( 0 <= services [ i ] . ctl [ k ] ) {
+      ev_del ( services [ i ] . ctl [ k ] ) ;
+      fd_close ( services [ i ] . ctl [ k ] ) ;
+      services [ i ] . ctl [ k ] = -1 ;
+    }
+  }
+  free ( services [ i ] . name ) ;
+  svdirty ( i ) ;
+  services [ i ] . name = NULL ;
+  services [ i ] . flagused = 0 ;
+  -- nused ;
+  -- roots [ services [ i ] . root ] . nused ;
+
+  while ( n && ! services [ n - 1 ] . flagused ) { -- n ; }
+}
+
+/* what the wantkill bits how say, for one service */
+static void killsv ( const unsigned int i, const unsigned int how )
+{
+  if ( inproc ) {
+    /* what s6-supervise does on SIGTERM and SIGHUP: bring the
+     * service down, or just not restart it once it dies */
+    services [ i ] . down |= ( how & 4 ) ? 3 : 1 ;
+
+    if ( ( how & 2 ) && services [ i ] . pid [ 0 ] ) {
+      (void) kill ( services [ i ] . pid [ 0 ], SIGTERM ) ;
+      (void) kill ( services [ i ] . pid [ 0 ], SIGCONT ) ;
+    }
+
+    if ( ( how & 4 ) && services [ i ] . flaglog && services [ i ] . pid [ 1 ] ) {
+      (void) kill ( services [ i ] . pid [ 1 ], SIGTERM ) ;
+      (void) kill ( services [ i ] . pid [ 1 ], SIGCONT ) ;
+    }
+
+    return ;
+  }
+
+  if ( services [ i ] . pid [ 0 ] ) {
+    (void) kill ( services [ i ] . pid [ 0 ], ( how & 2 ) ? SIGTERM : SIGHUP ) ;
+  }
+
+  if ( services [ i ] . flaglog && services [ i ] . pid [ 1 ] ) {
+    (void) kill ( services [ i ] . pid [ 1 ], ( how & 4 ) ? SIGTERM : SIGHUP ) ;
+  }
+}
+
+static void killthem ( void )
+{
+  unsigned int i = 0 ;
+
+  if ( ! wantkill ) { return ; }
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    if ( ! services [ i ] . flagused ) { continue ; }
+    if ( ! ( wantkill & 1 ) && services [ i ] . flagactive ) { continue ; }
+
+    killsv ( i, wantkill ) ;
+  }
+
+  wantkill = 0 ;
+}
+
+static void term ( void )
+{
+  cont = 0 ;
+  wantkill = 3 ;
+}
+
+static void hup ( void )
+{
+  cont = 0 ;
+  wantkill = 1 ;
+}
+
+static void quit ( void )
+{
+  cont = 0 ;
+  wantkill = 7 ;
+}
+
+static void intr ( void )
+{
+  finish_arg = "reboot" ;
+  term () ;
+}
+
+static void usr1 ( void )
+{
+  finish_arg = "poweroff" ;
+  term () ;
+}
+
+static void handle_signals ( void )
+{
+  while ( 1 ) {
+    const int sig = selfpipe_read () ;
+
+    if ( 0 < sig ) { event ( S2EV_SIGNAL, 0, S2EV_NOSLOT, sig, 0 ) ; }
+
+    switch ( sig ) {
+      case -1 : panic ( "selfpipe_read" ) ;
+      case 0 : return ; break ;
+      case SIGCHLD : wantreap = 1 ; break ;
+      case SIGALRM : wantscan = 1 ; break ;
+      case SIGABRT : cont = 0 ; break ;
+      case SIGTERM : term() ; break ;
+      case SIGHUP : hup() ; break ;
+      case SIGQUIT : quit() ; break ;
+      case SIGINT : intr() ; break ;
+    }
+  }
+}
+
+static void handle_diverted_signals ( void )
+{
+  while ( 1 ) {
+    const int sig = selfpipe_read () ;
+
+    if ( 0 < sig ) { event ( S2EV_SIGNAL, 0, S2EV_NOSLOT, sig, 0 ) ; }
+
+    switch ( sig ) {
+      case -1 : panic ( "selfpipe_read" ) ;
+      case 0 : return ; break ;
+      case SIGCHLD : wantreap = 1 ; break ;
+      case SIGALRM : wantscan = 1 ; break ;
+      case SIGABRT : cont = 0 ; break ;
+      default :
+        {
+          char const * const name = sig_name ( sig ) ;
+          const size_t len = strlen ( name ) ;
+          char fn [ SIGNAL_PROG_LEN + len + 1 ] ;
+          const char * const newargv [ 2 ] = { fn, 0 } ;
+
+          (void) memcpy ( fn, SIGNAL_PROG, SIGNAL_PROG_LEN ) ;
+          (void) memcpy ( fn + SIGNAL_PROG_LEN, name, len + 1 ) ;
+
+          if  ( ! child_spawn0 ( newargv [ 0 ], newargv, (char const **) environ ) )
+            strerr_warnwu2sys ( "spawn ", newargv [ 0 ] ) ;
+        }
+        break ;
+    }
+  }
+}
+
+/* clear the quarantine of all services and give them a fresh start */
+static void unquarantine ( void )
+{
+  unsigned int i ;
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    if ( ! services [ i ] . flagused ) { continue ; }
+
+    svdirty ( i ) ;
+    services [ i ] . flagquarantine = 0 ;
+    services [ i ] . fails [ 0 ] = services [ i ] . fails [ 1 ] = 0 ;
+    services [ i ] . windowcount = 0 ;
+  }
+
+  wantscan = 1 ;
+}
+
+static void handle_control ( const int fd )
+{
+  while ( 1 ) {
+    char c = 0 ;
+    const ssize_t r = sanitize_read ( fd_read ( fd, & c, 1 ) ) ;
+
+    if ( r < 0 ) panic ( "read control pipe" ) ;
+    else if ( ! r ) break ;
+
+    event ( S2EV_CONTROL, 0, S2EV_NOSLOT, (unsigned char) c, 0 ) ;
+
+    switch ( c ) {
+      case 'p' : finish_arg = "poweroff" ; break ;
+      case 'h' : hup () ; return ;
+      case 'r' : finish_arg = "reboot" ; break ;
+      case 'a' : wantscan = 1 ; break ;
+      case 't' : term () ; return ;
+      case 's' : finish_arg = "halt" ; break ;
+      case 'z' : wantreap = 1 ; break ;
+      case 'c' : unquarantine () ; break ;
+      case 'm' : metrics_write () ; break ;
+      case 'd' :
+        if ( events_dump () < 0 ) { strerr_warnwu2sys ( "write ", EVENTS_FILE ) ; }
+        break ;
+      case 'e' : wantreexec = 1 ; break ;
+      case 'b' : cont = 0 ; return ;
+      case 'n' : wantkill = 2 ; break ;
+      case 'N' : wantkill = 6 ; break ;
+      case '6' :
+      case 'i' : intr () ; return ;
+      case 'q' : quit () ; return ;
+      case '0' : finish_arg = "halt" ; term () ; return ;
+      case '7' : usr1 () ; return ;
+      case '8' : finish_arg = "other" ; term () ; return ;
+      default : {
+          char s [ 2 ] = { c, 0 } ;
+          strerr_warnw2x ( "received unknown control command: ", s ) ;
+        }
+        break ;
+    }
+  }
+}
+
+/* restart accounting for a dead supervisor (or logger):
+ * the restart delay doubles with every death that happens before
+ * the process has been up for resetafter seconds, up to delaymax.
+ * a service dying more than limit times within window seconds is
+ * quarantined: it is not restarted until told so via the control fifo.
+ */
+static void backoff ( const unsigned int i, const unsigned int islog )
+{
+  struct svinfo_s * const sv = services + i ;
+  unsigned int delay = 1 ;
+  tain_t t ;
+
+  tain_addsec ( & t, & sv -> startedat [ islog ], sv -> resetafter ) ;
+  if ( ! tain_less ( & STAMP, & t ) ) { sv -> fails [ islog ] = 0 ; }
+
+  if ( sv -> fails [ islog ] ) {
+    delay = ( 16 > sv -> fails [ islog ] ) ? 1u << sv -> fails [ islog ] : sv -> delaymax ;
+    if ( delay > sv -> delaymax ) { delay = sv -> delaymax ; }
+  }
+
+  ++ sv -> fails [ islog ] ;
+  tain_addsec_g ( & sv -> restartafter [ islog ], delay ? delay : 1 ) ;
+
+  if ( ! sv -> limit ) { return ; }
+
+  tain_addsec ( & t, & sv -> windowstart, sv -> window ) ;
+
+  if ( ! tain_less ( & STAMP, & t ) ) {
+    sv -> windowstart = STAMP ;
+    sv -> windowcount = 0 ;
+  }
+
+  if ( ++ sv -> windowcount > sv -> limit ) {
+    char fmt [ UINT_FMT ] ;
+
+    fmt [ uint_fmt ( fmt, sv -> windowcount ) ] = 0 ;
+    sv -> flagquarantine = 1 ;
+    event ( S2EV_QUARANTINE, islog ? S2EV_LOG : 0, i, sv -> windowcount, 0 ) ;
+    strerr_warnw5x ( "quarantined ", sv -> name, islog ? "/log" : "", ": restarts in window: ", fmt ) ;
+  }
+}
+
+/* the directory a service is defined in: its own, or its template's */
+static char const * svdir ( const unsigned int i )
+{
+  return services [ i ] . tpl ? services [ services [ i ] . tpl - 1 ] . name : services [ i ] . name ;
+}
+
+/* the instance argument of a service, NULL if it is not an instance */
+static char const * svinst ( const unsigned int i )
+{
+  return services [ i ] . tpl ? services [ i ] . name + strlen ( svdir ( i ) ) : NULL ;
+}
+
+/* read a small configuration file from a service directory into buf.
+ * a missing file reads as empty. returns the length read or -1.
+ */
+static ssize_t svfile_read ( char const * name, char const * file, char * buf, const size_t len )
+{
+  const size_t namelen = strlen ( name ), filelen = strlen ( file ) ;
+  char fn [ namelen + filelen + 2 ] ;
+  ssize_t r ;
+
+  memcpy ( fn, name, namelen ) ;
+  fn [ namelen ] = '/' ;
+  memcpy ( fn + namelen + 1, file, filelen + 1 ) ;
+  r = openreadnclose ( fn, buf, len - 1 ) ;
+
+  if ( 0 > r ) {
+    if ( ENOENT == errno ) { r = 0 ; }
+    else { strerr_warnwu2sys ( "read ", fn ) ; }
+  }
+
+  buf [ ( 0 < r ) ? r : 0 ] = 0 ;
+
+  return r ;
+}
+
+/* does a marker file exist in a service directory ? */
+static int svfile_exists ( char const * name, char const * file )
+{
+  const size_t namelen = strlen ( name ), filelen = strlen ( file ) ;
+  char fn [ namelen + filelen + 2 ] ;
+
+  memcpy ( fn, name, namelen ) ;
+  fn [ namelen ] = '/' ;
+  memcpy ( fn + namelen + 1, file, filelen + 1 ) ;
+
+  return 0 == access ( fn, F_OK ) ;
+}
+
+/* read an unsigned integer setting, dflt if the file is missing */
+static unsigned int svfile_uint ( char const * name, char const * file, const unsigned int dflt )
+{
+  unsigned int u = dflt ;
+  char buf [ UINT_FMT + 2 ] ;
+
+  if ( 0 < svfile_read ( name, file, buf, sizeof ( buf ) ) && ! uint_scan ( buf, & u ) ) {
+    strerr_warnw4x ( "invalid ", file, " setting for ", name ) ;
+    u = dflt ;
+  }
+
+  return u ;
+}
+
+/* The log multiplexer.
+   With -L, stage2 reads the log pipes of all services itself instead
+   of running a logger for each: every line gets a timestamp and goes
+   to name/log/current, which is rotated by size, and the latest output
+   is kept in a small ring per service. The pipe lives as long as the
+   service slot, so no output is lost when the service restarts. */
+
+/* where the log files of a service go: name/log, or name@/log/inst
+ * for an instance. s has room for LOGDIR_LEN( i ) bytes, returns the
+ * length.
+ */
+#define LOGDIR_LEN(i)	( strlen ( svdir ( i ) ) + ( svinst ( i ) ? strlen ( svinst ( i ) ) + 1 : 0 ) + 5 )
+
+static size_t logmux_dir ( const unsigned int i, char * s )
+{
+  char const * const dir = svdir ( i ) ;
+  char const * const inst = svinst ( i ) ;
+  size_t m = strlen ( dir ) ;
+
+  memcpy ( s, dir, m ) ;
+  memcpy ( s + m, "/log", 5 ) ;
+  m += 4 ;
+
+  if ( inst ) {
+    s [ m ++ ] = '/' ;
+    memcpy ( s + m, inst, strlen ( inst ) + 1 ) ;
+    m += strlen ( inst ) ;
+  }
+
+  return m ;
+}
+
+static int logmux_openfile ( const unsigned int i )
+{
+  char fn [ LOGDIR_LEN( i ) + sizeof ( "/current" ) ] ;
+  const size_t m = logmux_dir ( i, fn ) ;
+  int fd ;
+
+  memcpy ( fn + m, "/current", sizeof ( "/current" ) ) ;
+
+  fd = open ( fn, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 00644 ) ;
+  if ( 0 > fd ) { strerr_warnwu2sys ( "open ", fn ) ; }
+
+  return fd ;
+}
+
+/* current becomes current.1, current.1 becomes current.2 and so on,
+ * keeping at most maxfiles old files */
+static void logmux_rotate ( const unsigned int i )
+{
+  struct logmux_s * const lm = services [ i ] . lm ;
+  char from [ LOGDIR_LEN( i ) + sizeof ( "/current" ) + UINT_FMT + 1 ] ;
+  char to [ sizeof ( from ) ] ;
+  const size_t base = logmux_dir ( i, from ) + sizeof ( "/current" ) - 1 ;
+  unsigned int k ;
+
+  memcpy ( from + base - 8, "/current", sizeof ( "/current" ) ) ;
+  memcpy ( to, from, base + 1 ) ;
+
+  if ( ! lm -> maxfiles ) { (void) unlink ( from ) ; }
+
+  for ( k = lm -> maxfiles ; k ; -- k ) {
+    to [ base ] = '.' ;
+    to [ base + 1 + uint_fmt ( to + base + 1, k ) ] = 0 ;
+
+    if ( 1 < k ) {
+      from [ base ] = '.' ;
+      from [ base + 1 + uint_fmt ( from + base + 1, k - 1 ) ] = 0 ;
+    } else {
+      from [ base ] = 0 ;
+    }
+
+    if ( rename ( from, to ) < 0 && ENOENT != errno )
+      strerr_warnwu4sys ( "rename ", from, " to ", to ) ;
+  }
+
+  if ( 0 <= lm -> fd ) { fd_close ( lm -> fd ) ; }
+  lm -> fd = logmux_openfile ( i ) ;
+  lm -> size = 0 ;
+}
+
+static void logmux_write ( const unsigned int i, char const * s, const size_t len )
+{
+  struct logmux_s * const lm = services [ i ] . lm ;
+  size_t k, w ;
+
+  for ( k = 0 ; k < len ; k += w ) {
+    w = LOG_RING - lm -> ringpos ;
+    if ( w > len - k ) { w = len - k ; }
+
+    memcpy ( lm -> ring + lm -> ringpos, s + k, w ) ;
+    lm -> ringpos += w ;
+
+    if ( LOG_RING == lm -> ringpos ) {
+      lm -> ringpos = 0 ;
+      lm -> ringfull = 1 ;
+    }
+  }
+
+  if ( lm -> maxsize && lm -> size && lm -> size + len > lm -> maxsize ) { logmux_rotate ( i ) ; }
+  if ( 0 > lm -> fd ) { lm -> fd = logmux_openfile ( i ) ; }
+  if ( 0 > lm -> fd ) { return ; }
+
+  w = allwrite ( lm -> fd, s, len ) ;
+  lm -> size += w ;
+
+  if ( w < len ) {
+    /* complain once, not for every line while the disk is full */
+    if ( ! lm -> failing ) { strerr_warnwu2sys ( "write log of ", services [ i ] . name ) ; }
+    lm -> failing = 1 ;
+  } else {
+    lm -> failing = 0 ;
+  }
+}
+
+/* stamp the lines of a chunk of output and log it */
+static void logmux_put ( const unsigned int i, char const * s, const size_t len, char const * stamp, const size_t stamplen )
+{
+  struct logmux_s * const lm = services [ i ] . lm ;
+  char out [ LOG_CHUNK << 1 ] ;
+  size_t k = 0, m = 0 ;
+
+  while ( k < len ) {
+    char const * const nl = memchr ( s + k, '\n', len - k ) ;
+    const size_t l = nl ? (size_t) ( nl - s ) + 1 - k : len - k ;
+
+    if ( m + stamplen + l > sizeof ( out ) ) {
+      logmux_write ( i, out, m ) ;
+      m = 0 ;
+    }
+
+    if ( ! lm -> midline ) {
+      memcpy ( out + m, stamp, stamplen ) ;
+      m += stamplen ;
+    }
+
+    memcpy ( out + m, s + k, l ) ;
+    m += l ;
+    k += l ;
+    lm -> midline = ! nl ;
+  }
+
+  if ( m ) { logmux_write ( i, out, m ) ; }
+}
+
+/* ISO 8601 UTC time with microseconds, and a space */
+static size_t logmux_stamp ( char * s, const size_t len )
+{
+  struct timespec ts ;
+  struct tm tm ;
+  size_t m ;
+
+  (void) clock_gettime ( CLOCK_REALTIME, & ts ) ;
+  (void) gmtime_r ( & ts . tv_sec, & tm ) ;
+  m = strftime ( s, len, "%Y-%m-%dT%H:%M:%S", & tm ) ;
+  m += snprintf ( s + m, len - m, ".%06ldZ ", ts . tv_nsec / 1000 ) ;
+
+  return m ;
+}
+
+/* read what a service wrote, at most LOG_READS chunks at a time
+ * so that one chatty service cannot hold up the loop */
+static void logmux_read ( const unsigned int i )
+{
+  char stamp [ 64 ] ;
+  size_t stamplen = 0 ;
+  unsigned int k ;
+
+  for ( k = 0 ; k < LOG_READS ; ++ k ) {
+    char buf [ LOG_CHUNK ] ;
+    const ssize_t r = sanitize_read ( fd_read ( services [ i ] . p [ 0 ], buf, sizeof ( buf ) ) ) ;
+
+    if ( 0 >= r ) {
+      if ( 0 > r ) { strerr_warnwu2sys ( "read log pipe of ", services [ i ] . name ) ; }
+      return ;
+    }
+
+    if ( ! stamplen ) { stamplen = logmux_stamp ( stamp, sizeof ( stamp ) ) ; }
+    logmux_put ( i, buf, r, stamp, stamplen ) ;
+  }
+}
+
+static int logmux_open ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  const size_t namelen = strlen ( svdir ( i ) ) ;
+  char dir [ LOGDIR_LEN( i ) ] ;
+  struct logmux_s * const lm = malloc ( sizeof ( struct logmux_s ) ) ;
+  struct stat st ;
+
+  if ( ! lm ) { return -1 ; }
+
+  /* an instance has its own directory under the template's */
+  if ( logmux_dir ( i, dir ) > namelen + 4 && mkdir ( dir, 00755 ) < 0 && EEXIST != errno )
+    strerr_warnwu2sys ( "create ", dir ) ;
+  dir [ namelen + 4 ] = 0 ;
+
+  sv -> lm = lm ;
+  lm -> maxsize = svfile_uint ( dir, "max-size", LOG_MAXSIZE ) ;
+  lm -> maxfiles = svfile_uint ( dir, "max-files", LOG_MAXFILES ) ;
+  lm -> midline = lm -> failing = lm -> ringfull = 0 ;
+  lm -> ringpos = 0 ;
+  lm -> size = 0 ;
+  lm -> fd = logmux_openfile ( i ) ;
+  if ( 0 <= lm -> fd && 0 == fstat ( lm -> fd, & st ) ) { lm -> size = st . st_size ; }
+
+  if ( ndelay_on ( sv -> p [ 0 ] ) < 0 || ev_add ( sv -> p [ 0 ], EV_LOG, i ) < 0 ) {
+    const int e = errno ;
+
+    if ( 0 <= lm -> fd ) { fd_close ( lm -> fd ) ; }
+    free ( lm ) ;
+    sv -> lm = NULL ;
+    errno = e ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+/* log what is left in the pipe and let go of it */
+static void logmux_close ( const unsigned int i )
+{
+  struct logmux_s * const lm = services [ i ] . lm ;
+
+  logmux_read ( i ) ;
+  if ( lm -> midline ) { logmux_write ( i, "\n", 1 ) ; }
+  ev_del ( services [ i ] . p [ 0 ] ) ;
+  if ( 0 <= lm -> fd ) { fd_close ( lm -> fd ) ; }
+  free ( lm ) ;
+  services [ i ] . lm = NULL ;
+}
+
+/* close the log pipe of a service that is going away */
+static void closepipe ( const unsigned int i )
+{
+  if ( services [ i ] . lm ) { logmux_close ( i ) ; }
+
+  fd_close ( services [ i ] . p [ 1 ] ) ; services [ i ] . p [ 1 ] = -1 ;
+  fd_close ( services [ i ] . p [ 0 ] ) ; services [ i ] . p [ 0 ] = -1 ;
+}
+
+
+/* socket activation.
+ * a service directory may hold a "listen" file, one socket per line:
+ * "tcp address port", "udp address port" or "unix path". stage2 binds
+ * them when it finds the service, so clients can connect before the
+ * server is up, and hands them to it as fds 3 and up with LISTEN_FDS
+ * set (a run script using sd_listen_fds () adds LISTEN_PID=$$).
+ * with "on-demand" in the "activation" file, the service is started
+ * on the first client only, and stopped again after "idle-timeout"
+ * seconds without a new one (0: never).
+ */
+
+/* bind the socket described by line, modified in place */
+static int sock_bind ( char const * name, char * line )
+{
+  union {
+    struct sockaddr sa ;
+    struct sockaddr_in in ;
+    struct sockaddr_in6 in6 ;
+    struct sockaddr_un un ;
+  } a ;
+  char * w [ 4 ] ;
+  unsigned int nw = 0, port = 0 ;
+  socklen_t alen = 0 ;
+  int fd, type = SOCK_STREAM, one = 1 ;
+
+  while ( nw < 4 ) {
+    while ( ' ' == * line || '\t' == * line ) { ++ line ; }
+    if ( ! * line ) { break ; }
+    w [ nw ++ ] = line ;
+    while ( * line && ' ' != * line && '\t' != * line ) { ++ line ; }
+    if ( * line ) { * line ++ = 0 ; }
+  }
+
+  memset ( & a, 0, sizeof ( a ) ) ;
+
+  if ( 2 == nw && ! strcmp ( w [ 0 ], "unix" ) && strlen ( w [ 1 ] ) < sizeof ( a . un . sun_path ) ) {
+    struct stat st ;
+
+    a . un . sun_family = AF_UNIX ;
+    strcpy ( a . un . sun_path, w [ 1 ] ) ;
+    alen = sizeof ( a . un ) ;
+    /* a leftover from a previous instance */
+    if ( 0 == lstat ( w [ 1 ], & st ) && S_ISSOCK( st . st_mode ) ) { (void) unlink ( w [ 1 ] ) ; }
+  } else if ( 3 == nw && ( ! strcmp ( w [ 0 ], "tcp" ) || ! strcmp ( w [ 0 ], "udp" ) )
+    && uint0_scan ( w [ 2 ], & port ) && port < 65536 ) {
+    type = ( 'u' == w [ 0 ] [ 0 ] ) ? SOCK_DGRAM : SOCK_STREAM ;
+
+    if ( 1 == inet_pton ( AF_INET, w [ 1 ], & a . in . sin_addr ) ) {
+      a . in . sin_family = AF_INET ;
+      a . in . sin_port = htons ( port ) ;
+      alen = sizeof ( a . in ) ;
+    } else if ( 1 == inet_pton ( AF_INET6, w [ 1 ], & a . in6 . sin6_addr ) ) {
+      a . in6 . sin6_family = AF_INET6 ;
+      a . in6 . sin6_port = htons ( port ) ;
+      alen = sizeof ( a . in6 ) ;
+    }
+  }
+
+  if ( ! alen ) {
+    strerr_warnw2x ( "invalid listen setting for ", name ) ;
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  fd = socket ( a . sa . sa_family, type | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  if ( ( AF_UNIX != a . sa . sa_family && setsockopt ( fd, SOL_SOCKET, SO_REUSEADDR, & one, sizeof ( one ) ) < 0 )
+    || bind ( fd, & a . sa, alen ) < 0 || ( SOCK_STREAM == type && listen ( fd, SOMAXCONN ) < 0 ) ) {
+    const int e = errno ;
+
+    fd_close ( fd ) ;
+    errno = e ;
+    return -1 ;
+  }
+
+  return fd ;
+}
+
+/* bind the sockets of a new service, if it has any */
+static void sockets_open ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct sockets_s * ls ;
+  char buf [ LISTEN_CONF ] ;
+  char * line = buf ;
+
+  if ( 0 >= svfile_read ( sv -> name, "listen", buf, sizeof ( buf ) ) ) { return ; }
+
+  ls = malloc ( sizeof ( * ls ) ) ;
+  if ( ! ls ) {
+    strerr_warnwu2sys ( "set up sockets for ", sv -> name ) ;
+    return ;
+  }
+
+  memset ( ls, 0, sizeof ( * ls ) ) ;
+
+  while ( * line ) {
+    char * const end = strchr ( line, '\n' ) ;
+    int fd ;
+
+    if ( end ) { * end = 0 ; }
+
+    if ( * line && '#' != * line ) {
+      if ( LISTEN_MAX <= ls -> n ) {
+        strerr_warnw2x ( "too many sockets for ", sv -> name ) ;
+        break ;
+      }
+
+      fd = sock_bind ( sv -> name, line ) ;
+
+      if ( 0 <= fd ) { ls -> fd [ ls -> n ++ ] = fd ; }
+      else if ( EINVAL != errno ) { strerr_warnwu2sys ( "bind a socket for ", sv -> name ) ; }
+    }
+
+    if ( ! end ) { break ; }
+    line = end + 1 ;
+  }
+
+  if ( ! ls -> n ) {
+    free ( ls ) ;
+    return ;
+  }
+
+  if ( 0 < svfile_read ( sv -> name, "activation", buf, sizeof ( buf ) ) && ! strncmp ( buf, "on-demand", 9 ) ) {
+    ls -> ondemand = 1 ;
+    ls -> idle = svfile_uint ( sv -> name, "idle-timeout", 0 ) ;
+  }
+
+  if ( sv -> notifyfd && sv -> notifyfd < 3 + ls -> n ) {
+    strerr_warnw2x ( "notification-fd clashes with the sockets of ", sv -> name ) ;
+    sv -> notifyfd = 0 ;
+  }
+
+  sv -> ls = ls ;
+}
+
+/* watch the sockets for the first client (edge: for any new client) */
+static void sockets_watch ( const unsigned int i, const int edge )
+{
+  struct sockets_s * const ls = services [ i ] . ls ;
+  unsigned int k ;
+
+  if ( ls -> armed ) { return ; }
+
+  for ( k = 0 ; k < ls -> n ; ++ k ) {
+    if ( 0 > ( edge ? ev_edge : ev_add ) ( ls -> fd [ k ], EV_ACTIVATE, i ) )
+      strerr_warnwu2sys ( "watch the sockets of ", services [ i ] . name ) ;
+  }
+
+  ls -> armed = 1 ;
+}
+
+static void sockets_unwatch ( const unsigned int i )
+{
+  struct sockets_s * const ls = services [ i ] . ls ;
+  unsigned int k ;
+
+  if ( ! ls -> armed ) { return ; }
+
+  for ( k = 0 ; k < ls -> n ; ++ k ) { ev_del ( ls -> fd [ k ] ) ; }
+
+  ls -> armed = 0 ;
+}
+
+static void sockets_close ( const unsigned int i )
+{
+  struct sockets_s * const ls = services [ i ] . ls ;
+  unsigned int k ;
+
+  if ( ! ls ) { return ; }
+
+  sockets_unwatch ( i ) ;
+  for ( k = 0 ; k < ls -> n ; ++ k ) { fd_close ( ls -> fd [ k ] ) ; }
+  free ( ls ) ;
+  services [ i ] . ls = NULL ;
+}
+
+/* has an on-demand service been stopped for being idle ? */
+static int sockets_idle ( const unsigned int i )
+{
+  return services [ i ] . ls && services [ i ] . ls -> ondemand && ! services [ i ] . ls -> wanted ;
+}
+
+/* a client came: start an on-demand service. while it runs, new
+ * clients only push back its idle timeout.
+ */
+static void handle_activate ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct sockets_s * const ls = sv -> ls ;
+  tain_t t ;
+
+  if ( ! sv -> flagactive ) {
+    sockets_unwatch ( i ) ;
+    return ;
+  }
+
+  ls -> lastuse = STAMP ;
+
+  if ( ls -> wanted ) { return ; }
+
+  svdirty ( i ) ;
+  sockets_unwatch ( i ) ;
+  ls -> wanted = 1 ;
+
+  if ( ! inproc && sv -> pid [ 0 ] ) {
+    if ( svtell ( i, 0, "u", 1 ) < 0 ) { strerr_warnwu2sys ( "start on demand ", sv -> name ) ; }
+  } else if ( ! sv -> pid [ 0 ] && ! sv -> fpid [ 0 ] && ! sv -> tpos [ TIMER_SERVICE ] ) {
+    wantstart ( i, 0 ) ;
+  }
+
+  if ( ls -> idle ) {
+    tain_addsec_g ( & t, ls -> idle ) ;
+    timer_set ( i, TIMER_IDLE, & t ) ;
+    sockets_watch ( i, 1 ) ;
+  }
+}
+
+/* the idle timeout of an on-demand service has expired: stop it
+ * unless a client came meanwhile, and wait for the next one
+ */
+static void idle ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct sockets_s * const ls = sv -> ls ;
+  tain_t t ;
+
+  if ( ! ls || ! ls -> wanted ) { return ; }
+
+  tain_addsec ( & t, & ls -> lastuse, ls -> idle ) ;
+
+  if ( tain_future ( & t ) ) {
+    timer_set ( i, TIMER_IDLE, & t ) ;
+    return ;
+  }
+
+  svdirty ( i ) ;
+  sockets_unwatch ( i ) ;
+  ls -> wanted = 0 ;
+
+  if ( inproc ) {
+    /* the reaper puts the sockets back on watch */
+    if ( sv -> pid [ 0 ] ) {
+      (void) kill ( sv -> pid [ 0 ], SIGTERM ) ;
+      (void) kill ( sv -> pid [ 0 ], SIGCONT ) ;
+    }
+  } else {
+    if ( sv -> pid [ 0 ] && svtell ( i, 0, "d", 1 ) < 0 ) { strerr_warnwu2sys ( "stop idle ", sv -> name ) ; }
+    sockets_watch ( i, 0 ) ;
+  }
+}
+
+
+/* health probes.
+ * a service directory may hold a "probe" file, one line:
+ * "tcp address port" or "unix path" (connecting is enough),
+ * "http address port path" (a GET must answer 2xx or 3xx) or
+ * "heartbeat path" (stage2 binds a datagram socket there, the service
+ * sends anything to it at least once per interval). stage2 probes a
+ * ready service every "probe-interval" seconds, gives a connection
+ * "probe-timeout" seconds, and restarts the service after
+ * "probe-failures" failures in a row. all of it runs from the event
+ * loop, no process is spawned for a probe.
+ */
+
+static int probe_parse ( char const * name, char * line, struct probe_s * pr )
+{
+  char * w [ 4 ] ;
+  unsigned int nw = 0, port = 0 ;
+
+  while ( nw < 4 ) {
+    while ( ' ' == * line || '\t' == * line ) { ++ line ; }
+    if ( ! * line ) { break ; }
+    w [ nw ++ ] = line ;
+    while ( * line && ' ' != * line && '\t' != * line && '\n' != * line ) { ++ line ; }
+    if ( * line ) { * line ++ = 0 ; }
+  }
+
+  if ( 2 == nw && ( ! strcmp ( w [ 0 ], "unix" ) || ! strcmp ( w [ 0 ], "heartbeat" ) )
+    && strlen ( w [ 1 ] ) < sizeof ( pr -> a . un . sun_path ) ) {
+    pr -> kind = ( 'h' == w [ 0 ] [ 0 ] ) ? PROBE_HEARTBEAT : PROBE_CONNECT ;
+    pr -> a . un . sun_family = AF_UNIX ;
+    strcpy ( pr -> a . un . sun_path, w [ 1 ] ) ;
+    pr -> alen = sizeof ( pr -> a . un ) ;
+  } else if ( ( ( 3 == nw && ! strcmp ( w [ 0 ], "tcp" ) ) || ( 4 == nw && ! strcmp ( w [ 0 ], "http" ) ) )
+    && uint0_scan ( w [ 2 ], & port ) && port && port < 65536 ) {
+    pr -> kind = ( 4 == nw ) ? PROBE_HTTP : PROBE_CONNECT ;
+
+    if ( 1 == inet_pton ( AF_INET, w [ 1 ], & pr -> a . in . sin_addr ) ) {
+      pr -> a . in . sin_family = AF_INET ;
+      pr -> a . in . sin_port = htons ( port ) ;
+      pr -> alen = sizeof ( pr -> a . in ) ;
+    } else if ( 1 == inet_pton ( AF_INET6, w [ 1 ], & pr -> a . in6 . sin6_addr ) ) {
+      pr -> a . in6 . sin6_family = AF_INET6 ;
+      pr -> a . in6 . sin6_port = htons ( port ) ;
+      pr -> alen = sizeof ( pr -> a . in6 ) ;
+    }
+
+    /* the request is sent as is, once connected */
+    if ( 4 == nw && pr -> alen ) {
+      const size_t pathlen = strlen ( w [ 3 ] ), addrlen = strlen ( w [ 1 ] ) ;
+
+      if ( '/' != w [ 3 ] [ 0 ] || pathlen + addrlen + 64 > PROBE_REQ ) { pr -> alen = 0 ; }
+      else {
+        memcpy ( pr -> buf, "GET ", 4 ) ; pr -> len = 4 ;
+        memcpy ( pr -> buf + pr -> len, w [ 3 ], pathlen ) ; pr -> len += pathlen ;
+        memcpy ( pr -> buf + pr -> len, " HTTP/1.0\r\nHost: ", 17 ) ; pr -> len += 17 ;
+        memcpy ( pr -> buf + pr -> len, w [ 1 ], addrlen ) ; pr -> len += addrlen ;
+        memcpy ( pr -> buf + pr -> len, "\r\nConnection: close\r\n\r\n", 23 ) ; pr -> len += 23 ;
+      }
+    }
+  }
+
+  if ( ! pr -> alen ) {
+    strerr_warnw2x ( "invalid probe setting for ", name ) ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+/* the socket a heartbeat comes to */
+static int probe_heartbeat ( struct probe_s * pr )
+{
+  struct stat st ;
+  int fd ;
+
+  /* a leftover from a previous instance */
+  if ( 0 == lstat ( pr -> a . un . sun_path, & st ) && S_ISSOCK( st . st_mode ) ) { (void) unlink ( pr -> a . un . sun_path ) ; }
+
+  fd = socket ( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  if ( bind ( fd, & pr -> a . sa, pr -> alen ) < 0 ) {
+    const int e = errno ;
+
+    fd_close ( fd ) ;
+    errno = e ;
+    return -1 ;
+  }
+
+  return fd ;
+}
+
+/* set up the probe of a new service, if it has one */
+static void probe_open ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct probe_s * pr ;
+  char buf [ LISTEN_CONF ] ;
+  tain_t t ;
+
+  if ( sv -> flagtemplate || 0 >= svfile_read ( sv -> name, "probe", buf, sizeof ( buf ) ) ) { return ; }
+
+  pr = malloc ( sizeof ( * pr ) ) ;
+  if ( ! pr ) {
+    strerr_warnwu2sys ( "set up the probe of ", sv -> name ) ;
+    return ;
+  }
+
+  memset ( pr, 0, sizeof ( * pr ) ) ;
+  pr -> fd = -1 ;
+
+  if ( probe_parse ( sv -> name, buf, pr ) < 0 ) {
+    free ( pr ) ;
+    return ;
+  }
+
+  if ( PROBE_HEARTBEAT == pr -> kind ) {
+    pr -> fd = probe_heartbeat ( pr ) ;
+
+    if ( 0 > pr -> fd || ev_add ( pr -> fd, EV_PROBE, i ) < 0 ) {
+      strerr_warnwu2sys ( "bind the heartbeat socket of ", sv -> name ) ;
+      if ( 0 <= pr -> fd ) { fd_close ( pr -> fd ) ; }
+      free ( pr ) ;
+      return ;
+    }
+  }
+
+  pr -> interval = svfile_uint ( sv -> name, "probe-interval", PROBE_INTERVAL ) ;
+  pr -> timeout = svfile_uint ( sv -> name, "probe-timeout", PROBE_TIMEOUT ) ;
+  pr -> maxfails = svfile_uint ( sv -> name, "probe-failures", PROBE_FAILURES ) ;
+  if ( ! pr -> interval ) { pr -> interval = 1 ; }
+  if ( ! pr -> timeout ) { pr -> timeout = 1 ; }
+  if ( ! pr -> maxfails ) { pr -> maxfails = 1 ; }
+  sv -> pr = pr ;
+
+  /* spread the probes of many services found at once */
+  tain_addsec_g ( & t, 1 + i % pr -> interval ) ;
+  timer_set ( i, TIMER_PROBE, & t ) ;
+}
+
+/* the connection of a probe under way is done with */
+static void probe_hangup ( struct probe_s * pr )
+{
+  if ( PROBE_HEARTBEAT == pr -> kind || 0 > pr -> fd ) { return ; }
+
+  ev_del ( pr -> fd ) ;
+  fd_close ( pr -> fd ) ;
+  pr -> fd = -1 ;
+  pr -> reading = 0 ;
+  pr -> got = 0 ;
+}
+
+static void probe_close ( const unsigned int i )
+{
+  struct probe_s * const pr = services [ i ] . pr ;
+
+  if ( ! pr ) { return ; }
+
+  probe_hangup ( pr ) ;
+
+  if ( PROBE_HEARTBEAT == pr -> kind ) {
+    ev_del ( pr -> fd ) ;
+    fd_close ( pr -> fd ) ;
+    (void) unlink ( pr -> a . un . sun_path ) ;
+  }
+
+  free ( pr ) ;
+  services [ i ] . pr = NULL ;
+  timer_cancel ( i, TIMER_PROBE ) ;
+}
+
+/* is there anything to probe ? a stopped service would fail */
+static int probe_due ( const unsigned int i )
+{
+  struct svinfo_s const * const sv = services + i ;
+
+  return sv -> flagactive && sv -> pid [ 0 ] && sv -> flagready && ! sv -> flagshedding ;
+}
+
+/* the outcome of a probe: restart the service after maxfails
+ * failures in a row, probe again after interval seconds
+ */
+static void probe_done ( const unsigned int i, char const * failure )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct probe_s * const pr = sv -> pr ;
+  tain_t t ;
+
+  probe_hangup ( pr ) ;
+
+  if ( ! failure ) { pr -> fails = 0 ; }
+  else if ( ++ pr -> fails >= pr -> maxfails ) {
+    strerr_warnw4x ( "restarting ", sv -> name, " after failed health probes, the last one: ", failure ) ;
+    pr -> fails = 0 ;
+    pr -> armed = 0 ;
+
+    if ( inproc ) {
+      (void) kill ( sv -> pid [ 0 ], SIGTERM ) ;
+      (void) kill ( sv -> pid [ 0 ], SIGCONT ) ;
+    } else if ( svtell ( i, 0, "t", 1 ) < 0 ) {
+      strerr_warnwu2sys ( "restart ", sv -> name ) ;
+    }
+  }
+
+  tain_addsec_g ( & t, pr -> interval ) ;
+  timer_set ( i, TIMER_PROBE, & t ) ;
+}
+
+/* connected: done, unless there is a request to send */
+static void probe_connected ( const unsigned int i )
+{
+  struct probe_s * const pr = services [ i ] . pr ;
+
+  if ( PROBE_HTTP != pr -> kind ) {
+    probe_done ( i, NULL ) ;
+    return ;
+  }
+
+  /* it fits in any socket buffer */
+  if ( fd_write ( pr -> fd, pr -> buf, pr -> len ) < (ssize_t) pr -> len ) {
+    probe_done ( i, "cannot send the request" ) ;
+    return ;
+  }
+
+  pr -> reading = 1 ;
+  if ( ev_mod ( pr -> fd, EV_PROBE, i, 0 ) < 0 ) { probe_done ( i, "cannot watch the connection" ) ; }
+}
+
+static void probe_start ( const unsigned int i )
+{
+  struct probe_s * const pr = services [ i ] . pr ;
+  tain_t t ;
+
+  tain_addsec_g ( & t, pr -> timeout ) ;
+  timer_set ( i, TIMER_PROBE, & t ) ;
+
+  pr -> fd = socket ( pr -> a . sa . sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ;
+
+  if ( 0 > pr -> fd ) {
+    strerr_warnwu2sys ( "create a probe socket for ", services [ i ] . name ) ;
+    probe_done ( i, NULL ) ;
+    return ;
+  }
+
+  if ( 0 == connect ( pr -> fd, & pr -> a . sa, pr -> alen ) ) {
+    if ( ev_add ( pr -> fd, EV_PROBE, i ) < 0 ) { probe_done ( i, "cannot watch the connection" ) ; }
+    else { probe_connected ( i ) ; }
+    return ;
+  }
+
+  if ( EINPROGRESS != errno ) {
+    probe_done ( i, "connection refused" ) ;
+    return ;
+  }
+
+  if ( ev_add ( pr -> fd, EV_PROBE, i ) < 0 || ev_mod ( pr -> fd, EV_PROBE, i, 1 ) < 0 )
+    probe_done ( i, "cannot watch the connection" ) ;
+}
+
+/* the probe timer: time for the next probe, or the one under way
+ * has timed out
+ */
+static void probe_timer ( const unsigned int i )
+{
+  struct probe_s * const pr = services [ i ] . pr ;
+
+  if ( ! pr ) { return ; }
+
+  if ( PROBE_HEARTBEAT == pr -> kind ) {
+    const int beat = pr -> beat ;
+
+    pr -> beat = 0 ;
+
+    if ( ! probe_due ( i ) ) { pr -> armed = 0 ; }
+    else if ( ! pr -> armed ) { pr -> armed = 1 ; }
+    else if ( ! beat ) {
+      probe_done ( i, "no heartbeat" ) ;
+      return ;
+    }
+
+    probe_done ( i, NULL ) ;
+  } else if ( 0 <= pr -> fd ) {
+    probe_done ( i, "timed out" ) ;
+  } else if ( probe_due ( i ) ) {
+    probe_start ( i ) ;
+  } else {
+    probe_done ( i, NULL ) ;
+  }
+}
+
+/* the connection of a probe is ready, or a heartbeat came */
+static void handle_probe ( const unsigned int i )
+{
+  struct probe_s * const pr = services [ i ] . pr ;
+
+  if ( ! pr || 0 > pr -> fd ) { return ; }
+
+  if ( PROBE_HEARTBEAT == pr -> kind ) {
+    char c ;
+
+    while ( 0 <= recv ( pr -> fd, & c, 1, 0 ) ) { pr -> beat = 1 ; }
+    return ;
+  }
+
+  if ( ! pr -> reading ) {
+    int e = 0 ;
+    socklen_t elen = sizeof ( e ) ;
+
+    if ( getsockopt ( pr -> fd, SOL_SOCKET, SO_ERROR, & e, & elen ) < 0 || e ) { probe_done ( i, "connection refused" ) ; }
+    else { probe_connected ( i ) ; }
+    return ;
+  }
+
+  /* the status line, "HTTP/1.x NNN" */
+  {
+    const ssize_t r = fd_read ( pr -> fd, pr -> answer + pr -> got, sizeof ( pr -> answer ) - pr -> got ) ;
+
+    if ( 0 > r && EAGAIN == errno ) { return ; }
+
+    if ( 0 < r ) {
+      pr -> got += r ;
+      if ( pr -> got < sizeof ( pr -> answer ) ) { return ; }
+    }
+
+    if ( pr -> got < sizeof ( pr -> answer ) || memcmp ( pr -> answer, "HTTP/1.", 7 )
+      || ( '2' != pr -> answer [ 9 ] && '3' != pr -> answer [ 9 ] ) )
+      probe_done ( i, "bad answer" ) ;
+    else probe_done ( i, NULL ) ;
+  }
+}
+
+/* First essential function: the reaper.
+ * s6-svscan must wait() for all children,
+ * including ones it doesn't know it has.
+ * Dead active services get their restart timer armed for 1 second.
+ */
+static void reaped ( const unsigned int i, const unsigned int islog, const int isfinish, const int wstat, struct rusage const * ru )
+{
+  event ( S2EV_EXIT, ( islog ? S2EV_LOG : 0 ) | ( isfinish ? S2EV_FINISH : 0 ), i,
+    isfinish ? services [ i ] . fpid [ islog ] : services [ i ] . pid [ islog ], wstat ) ;
+  svdirty ( i ) ;
+  account ( i, islog, isfinish, wstat, ru ) ;
+
+  if ( isfinish ) {
+    finished ( i, islog ) ;
+    if ( ! services [ i ] . flagactive && ! services [ i ] . pid [ 0 ] && ! services [ i ] . pid [ 1 ]
+      && ! services [ i ] . fpid [ 0 ] && ! services [ i ] . fpid [ 1 ] ) svfree ( i ) ;
+    return ;
+  }
+
+  pidset ( i, islog, 0, 0 ) ;
+  services [ i ] . wstat [ islog ] = wstat ;
+  ++ services [ i ] . restarts [ islog ] ;
+  tain_addsec_g ( & services [ i ] . restartafter [ islog ], 1 ) ;
+  if ( ! islog ) {
+    started ( i ) ;
+    services [ i ] . flagready = 0 ;
+    services [ i ] . flagshedding = 0 ;
+    if ( inproc ) { notify_close ( i ) ; }
+  }
+
+  if ( services [ i ] . flagactive ) {
+    /* stopping an idle service is no failure */
+    if ( islog || ! sockets_idle ( i ) ) backoff ( i, islog ) ;
+    if ( inproc ) runfinish ( i, islog, wstat ) ;
+    if ( ! services [ i ] . flagquarantine && ! services [ i ] . fpid [ islog ] )
+      timer_set ( i, islog, & services [ i ] . restartafter [ islog ] ) ;
+  } else {
+    if ( services [ i ] . flaglog ) {
+ /*
+    BLACK MAGIC:
+     - we need to close the pipe early:
+       * as soon as the writer exits so the logger can exit on EOF
+       * or as soon as the logger exits so the writer can crash on EPIPE
+     - but if the same service gets reactivated before the second
+       supervise process exits, ouch: we've lost the pipe
+     - so we can't reuse the same service even if it gets reactivated
+     - so we're marking a dying service with a closed pipe
+     - if the scanner sees a service with p[0] = -1 it won't flag
+       it as active (and won't restart the dead supervise)
+     - but if the service gets reactivated we want it to restart
+       as soon as the 2nd supervise process dies
+     - so the scanner marks such a process with p[0] = -2
+     - and the reaper triggers a scan when it finds a -2.
+ */
+      if (services[i].p[0] >= 0) closepipe(i) ;
+      else if (services[i].p[0] == -2) roots[services[i].root].wantscan = 1 ;
+    }
+
+    if (!services[i].pid[0] && (!services[i].flaglog || !services[i].pid[1])
+      && !services[i].fpid[0] && !services[i].fpid[1])
+      svfree ( i ) ;
+  }
+}
+
+static void reap ( void )
+{
+  unsigned int budget = REAP_BUDGET ;
+
+  if ( ! wantreap ) return ;
+
+  wantreap = 0 ;
+  tain_now_g () ;
+
+  while ( 1 ) {
+    int wstat = 0 ;
+    struct rusage ru ;
+    pid_t r ;
+
+    /* more of them, maybe: the next iteration goes on */
+    if ( ! budget -- ) {
+      wantreap = 1 ;
+      break ;
+    }
+
+    r = wait4 ( -1, & wstat, WNOHANG, & ru ) ;
+
+    if ( r < 0 )
+      if ( errno != ECHILD ) panic ( "wait4" ) ;
+      else break ;
+    else if ( ! r ) break ;
+    else {
+      const size_t k = pidslot ( r ) ;
+      const unsigned int v = pids [ k ] . v ;
+
+      ++ nreaped ;
+
+      if ( ! pids [ k ] . pid ) {
+        ++ norphans ;
+        event ( S2EV_EXIT, 0, S2EV_NOSLOT, r, wstat ) ;
+        continue ;
+      }
+
+      reaped ( v >> 2, v & 1, ( v >> 1 ) & 1, wstat, & ru ) ;
+    }
+  }
+}
+
+
+/* crash recovery.
+ * with -p file (ADOPT_FILE by default for process 1), stage2 keeps
+ * the pids of its supervisors (of its services with -I) in that file,
+ * by the device and inode of their directories. after a crash, the
+ * new stage2 checks the pids it finds there: a process that still
+ * runs, with the same start time (and that is s6-supervise, without
+ * -I), is adopted when its directory is found instead of started a
+ * second time. a process that is not our child any more is watched
+ * through a pidfd. a service and its logger are adopted together or
+ * not at all, on the pipe between them, found through /proc.
+ */
+#define ADOPT_FILE		"/run/stage2.pids"
+#define ADOPT_MAGIC		0x50413253
+#define ADOPT_VERSION		1
+
+struct adopt_hdr_s {
+  uint32_t magic ;
+  uint32_t version ;
+  uint32_t entsize ;
+  uint32_t count ;
+} ;
+
+struct adopt_ent_s {
+  uint64_t dev ;
+  uint64_t ino ;
+  int32_t pid [ 2 ] ;
+  /* in clock ticks after boot, see proc(5) */
+  uint64_t start [ 2 ] ;
+} ;
+
+static char const * adoptfn = NULL ;
+/* per slot, what the file says */
+static struct adopt_ent_s * adoptlast ;
+
+#if defined (OSLinux)
+static size_t adoptn = 0 ;
+static int adoptforce = 1, adoptfailing = 0 ;
+/* what the previous stage2 left running and no directory claimed yet */
+static struct adopt_ent_s * adopted = NULL ;
+static size_t nadopted = 0 ;
+
+/* the parent and start time of a live (not zombie) process */
+static int proc_stat ( const pid_t pid, pid_t * ppid, uint64_t * start )
+{
+  char fn [ sizeof ( "/proc//stat" ) + PID_FMT ] ;
+  char buf [ 1024 ] ;
+  char * s ;
+  unsigned long int u ;
+  unsigned int k, pp ;
+  ssize_t r ;
+
+  memcpy ( fn, "/proc/", 6 ) ;
+  memcpy ( fn + 6 + pid_fmt ( fn + 6, pid ), "/stat", 6 ) ;
+
+  r = openreadnclose ( fn, buf, sizeof ( buf ) - 1 ) ;
+  if ( 0 >= r ) { return -1 ; }
+  buf [ r ] = 0 ;
+
+  /* the command name may hold anything: the fields start after its ) */
+  s = strrchr ( buf, ')' ) ;
+  if ( ! s || ' ' != s [ 1 ] || 'Z' == s [ 2 ] || 'X' == s [ 2 ] ) { return -1 ; }
+  s += 2 ;
+
+  /* state is field 3, ppid 4 and starttime 22 */
+  for ( k = 3 ; k < 22 ; ++ k ) {
+    s = strchr ( s, ' ' ) ;
+    if ( ! s ) { return -1 ; }
+    ++ s ;
+    if ( 3 == k && ! uint_scan ( s, & pp ) ) { return -1 ; }
+  }
+
+  if ( ! ulong_scan ( s, & u ) ) { return -1 ; }
+
+  * ppid = pp ;
+  * start = u ;
+  return 0 ;
+}
+
+static int pidfd_open_ ( const pid_t pid )
+{
+#ifdef SYS_pidfd_open
+  const int fd = syscall ( SYS_pidfd_open, pid, 0 ) ;
+
+  if ( 0 <= fd ) { (void) coe ( fd ) ; }
+  return fd ;
+#else
+  (void) pid ;
+  errno = ENOSYS ;
+  return -1 ;
+#endif
+}
+
+/* without -I, only an s6-supervise is worth adopting */
+static int adopt_cmdline ( const pid_t pid )
+{
+  char fn [ sizeof ( "/proc//cmdline" ) + PID_FMT ] ;
+  char buf [ 256 ] ;
+  char const * s ;
+  ssize_t r ;
+
+  if ( inproc ) { return 1 ; }
+
+  memcpy ( fn, "/proc/", 6 ) ;
+  memcpy ( fn + 6 + pid_fmt ( fn + 6, pid ), "/cmdline", 9 ) ;
+
+  r = openreadnclose ( fn, buf, sizeof ( buf ) - 1 ) ;
+  if ( 0 >= r ) { return 0 ; }
+  buf [ r ] = 0 ;
+
+  s = strrchr ( buf, '/' ) ;
+  return ! strcmp ( s ? s + 1 : buf, "s6-supervise" ) ;
+}
+
+static void adopt_kill ( struct adopt_ent_s const * e )
+{
+  unsigned int j ;
+
+  for ( j = 0 ; j < 2 ; ++ j ) {
+    if ( 0 >= e -> pid [ j ] ) { continue ; }
+    (void) kill ( e -> pid [ j ], SIGTERM ) ;
+    (void) kill ( e -> pid [ j ], SIGCONT ) ;
+  }
+}
+
+/* read what the previous stage2 wrote, keep the pids that still
+ * belong to the processes it started
+ */
+static void adopt_load ( void )
+{
+  struct adopt_hdr_s h ;
+  struct stat st ;
+  size_t k ;
+  int fd = open ( adoptfn, O_RDONLY | O_CLOEXEC ) ;
+
+  if ( 0 > fd ) {
+    if ( ENOENT != errno ) { strerr_warnwu2sys ( "open ", adoptfn ) ; }
+    return ;
+  }
+
+  if ( fstat ( fd, & st ) < 0 || allread ( fd, (char *) & h, sizeof ( h ) ) < sizeof ( h ) ) {
+    strerr_warnwu2sys ( "read ", adoptfn ) ;
+    fd_close ( fd ) ;
+    return ;
+  }
+
+  if ( ADOPT_MAGIC != h . magic || ADOPT_VERSION != h . version || sizeof ( struct adopt_ent_s ) != h . entsize
+    || (size_t) st . st_size != sizeof ( h ) + (size_t) h . count * h . entsize ) {
+    strerr_warnw2x ( "ignoring invalid pid file ", adoptfn ) ;
+    fd_close ( fd ) ;
+    return ;
+  }
+
+  adopted = malloc ( ( h . count ? h . count : 1 ) * sizeof ( struct adopt_ent_s ) ) ;
+
+  if ( ! adopted || allread ( fd, (char *) adopted, h . count * sizeof ( struct adopt_ent_s ) ) < h . count * sizeof ( struct adopt_ent_s ) ) {
+    strerr_warnwu2sys ( "read ", adoptfn ) ;
+    free ( adopted ) ;
+    adopted = NULL ;
+    fd_close ( fd ) ;
+    return ;
+  }
+
+  fd_close ( fd ) ;
+
+  for ( k = 0 ; k < h . count ; ++ k ) {
+    struct adopt_ent_s * const e = adopted + nadopted ;
+    unsigned int j ;
+
+    * e = adopted [ k ] ;
+
+    for ( j = 0 ; j < 2 ; ++ j ) {
+      pid_t ppid ;
+      uint64_t start ;
+
+      if ( 0 >= e -> pid [ j ] ) { continue ; }
+      if ( proc_stat ( e -> pid [ j ], & ppid, & start ) < 0 || start != e -> start [ j ] || ! adopt_cmdline ( e -> pid [ j ] ) )
+        e -> pid [ j ] = 0 ;
+    }
+
+    if ( 0 < e -> pid [ 0 ] || 0 < e -> pid [ 1 ] ) { ++ nadopted ; }
+  }
+}
+
+/* the pipe from a service to its logger (or to stage2 with -L) */
+static int adopt_pipe ( const unsigned int i, struct adopt_ent_s const * e )
+{
+  struct svinfo_s * const sv = services + i ;
+  char fn [ sizeof ( "/proc//fd/1" ) + PID_FMT ] ;
+  char fn0 [ sizeof ( "/proc//fd/0" ) + PID_FMT ] ;
+  struct stat st [ 2 ] ;
+  int p [ 2 ] ;
+
+  memcpy ( fn, "/proc/", 6 ) ;
+  memcpy ( fn + 6 + pid_fmt ( fn + 6, e -> pid [ 0 ] ), "/fd/1", 6 ) ;
+  memcpy ( fn0, "/proc/", 6 ) ;
+  memcpy ( fn0 + 6 + pid_fmt ( fn0 + 6, e -> pid [ 1 ] ), "/fd/0", 6 ) ;
+
+  p [ 1 ] = open ( fn, O_WRONLY | O_CLOEXEC ) ;
+  if ( 0 > p [ 1 ] ) { return -1 ; }
+  p [ 0 ] = open ( logmux ? fn : fn0, O_RDONLY | O_CLOEXEC ) ;
+
+  if ( 0 > p [ 0 ] || fstat ( p [ 0 ], st ) < 0 || fstat ( p [ 1 ], st + 1 ) < 0 || ! S_ISFIFO( st [ 0 ] . st_mode )
+    || st [ 0 ] . st_ino != st [ 1 ] . st_ino || st [ 0 ] . st_dev != st [ 1 ] . st_dev ) {
+    if ( 0 <= p [ 0 ] ) { fd_close ( p [ 0 ] ) ; }
+    fd_close ( p [ 1 ] ) ;
+    return -1 ;
+  }
+
+  fd_close ( sv -> p [ 0 ] ) ;
+  fd_close ( sv -> p [ 1 ] ) ;
+  sv -> p [ 0 ] = p [ 0 ] ;
+  sv -> p [ 1 ] = p [ 1 ] ;
+  return 0 ;
+}
+
+static void adopt_unwatch ( const unsigned int i, const unsigned int islog )
+{
+  if ( 0 > services [ i ] . pidfd [ islog ] ) { return ; }
+
+  ev_del ( services [ i ] . pidfd [ islog ] ) ;
+  fd_close ( services [ i ] . pidfd [ islog ] ) ;
+  services [ i ] . pidfd [ islog ] = -1 ;
+}
+
+/* take over what the previous stage2 left running in the directory of
+ * a new slot, before anything is started for it
+ */
+static void adopt ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct adopt_ent_s e ;
+  size_t k ;
+  unsigned int j ;
+
+  for ( k = 0 ; k < nadopted ; ++ k )
+    if ( adopted [ k ] . ino == sv -> ino && adopted [ k ] . dev == sv -> dev ) { break ; }
+
+  if ( k == nadopted ) { return ; }
+
+  e = adopted [ k ] ;
+  adopted [ k ] = adopted [ -- nadopted ] ;
+
+  if ( ! sv -> flaglog ) { e . pid [ 1 ] = 0 ; }
+  else if ( ( ! logmux && 0 >= e . pid [ 1 ] ) || 0 >= e . pid [ 0 ] ) { goto kill ; }
+
+  for ( j = 0 ; j < 2 ; ++ j ) {
+    pid_t ppid ;
+    uint64_t start ;
+
+    if ( 0 >= e . pid [ j ] ) { continue ; }
+    if ( proc_stat ( e . pid [ j ], & ppid, & start ) < 0 ) { goto kill ; }
+    if ( getpid () == ppid ) { continue ; }
+
+    /* not our child: the reaper will not hear of it */
+    sv -> pidfd [ j ] = pidfd_open_ ( e . pid [ j ] ) ;
+    if ( 0 > sv -> pidfd [ j ] || ev_add ( sv -> pidfd [ j ], EV_PIDFD, ( i << 1 ) | j ) < 0 ) {
+      strerr_warnwu2sys ( "watch the adopted processes of ", sv -> name ) ;
+      goto kill ;
+    }
+  }
+
+  if ( sv -> flaglog && adopt_pipe ( i, & e ) < 0 ) {
+    strerr_warnwu2sys ( "find the log pipe of ", sv -> name ) ;
+    goto kill ;
+  }
+
+  for ( j = 0 ; j < 2 ; ++ j ) {
+    if ( 0 >= e . pid [ j ] ) { continue ; }
+    pidset ( i, j, 0, e . pid [ j ] ) ;
+    sv -> startedat [ j ] = STAMP ;
+    sv -> since [ j ] = time ( NULL ) ;
+  }
+
+  /* it was up before, it is as ready as it will get */
+  if ( sv -> pid [ 0 ] ) { sv -> flagready = 1 ; }
+  return ;
+
+kill :
+  adopt_unwatch ( i, 0 ) ;
+  adopt_unwatch ( i, 1 ) ;
+  strerr_warnw2x ( "not adopting the processes left running for ", sv -> name ) ;
+  adopt_kill ( & e ) ;
+}
+
+/* after the first scan: what no directory claimed has to go */
+static void adopt_forget ( void )
+{
+  size_t k ;
+
+  if ( ! adopted ) { return ; }
+
+  for ( k = 0 ; k < nadopted ; ++ k ) { adopt_kill ( adopted + k ) ; }
+  if ( nadopted ) { strerr_warnw1x ( "stopped processes left running for removed services" ) ; }
+
+  free ( adopted ) ;
+  adopted = NULL ;
+  nadopted = 0 ;
+}
+
+/* an adopted process that is not our child died */
+static void handle_pidfd ( const unsigned int i, const unsigned int islog )
+{
+  struct rusage ru ;
+
+  adopt_unwatch ( i, islog ) ;
+  if ( ! services [ i ] . pid [ islog ] ) { return ; }
+
+  /* no wait status and no resource usage for it */
+  memset ( & ru, 0, sizeof ( ru ) ) ;
+  tain_now_g () ;
+  reaped ( i, islog, 0, 0, & ru ) ;
+}
+
+/* rewrite the file when a pid changed */
+static void adopt_publish ( void )
+{
+  const size_t high = n > adoptn ? n : adoptn ;
+  size_t k, count = 0 ;
+  int changed = adoptforce ;
+
+  if ( ! adoptfn ) { return ; }
+
+  for ( k = 0 ; k < high ; ++ k ) {
+    struct svinfo_s const * const sv = services + k ;
+    struct adopt_ent_s * const e = adoptlast + k ;
+    unsigned int j ;
+
+    for ( j = 0 ; j < 2 ; ++ j ) {
+      const pid_t pid = ( k < n && sv -> flagused ) ? sv -> pid [ j ] : 0 ;
+      pid_t ppid ;
+
+      if ( pid == e -> pid [ j ] ) { continue ; }
+
+      changed = 1 ;
+      e -> pid [ j ] = pid ;
+      e -> start [ j ] = 0 ;
+      if ( pid && proc_stat ( pid, & ppid, e -> start + j ) < 0 ) { e -> pid [ j ] = 0 ; }
+    }
+
+    if ( k < n && sv -> flagused ) {
+      e -> dev = sv -> dev ;
+      e -> ino = sv -> ino ;
+    }
+
+    if ( e -> pid [ 0 ] || e -> pid [ 1 ] ) { ++ count ; }
+  }
+
+  adoptn = n ;
+
+  if ( ! changed ) { return ; }
+
+  {
+    struct adopt_hdr_s h = { ADOPT_MAGIC, ADOPT_VERSION, sizeof ( struct adopt_ent_s ), count } ;
+    char buf [ sizeof ( h ) + count * sizeof ( struct adopt_ent_s ) ] ;
+    size_t len = sizeof ( h ) ;
+
+    memcpy ( buf, & h, sizeof ( h ) ) ;
+
+    for ( k = 0 ; k < high ; ++ k ) {
+      if ( ! adoptlast [ k ] . pid [ 0 ] && ! adoptlast [ k ] . pid [ 1 ] ) { continue ; }
+      memcpy ( buf + len, adoptlast + k, sizeof ( struct adopt_ent_s ) ) ;
+      len += sizeof ( struct adopt_ent_s ) ;
+    }
+
+    if ( ! openwritenclose_suffix ( adoptfn, buf, len, ".new" ) ) {
+      if ( ! adoptfailing ) { strerr_warnwu2sys ( "write ", adoptfn ) ; }
+      adoptforce = adoptfailing = 1 ;
+      return ;
+    }
+  }
+
+  adoptforce = adoptfailing = 0 ;
+}
+#else
+static void adopt_load ( void ) { }
+static void adopt ( const unsigned int i ) { (void) i ; }
+static void adopt_forget ( void ) { }
+static void adopt_unwatch ( const unsigned int i, const unsigned int islog ) { (void) i ; (void) islog ; }
+static void handle_pidfd ( const unsigned int i, const unsigned int islog ) { (void) i ; (void) islog ; }
+static void adopt_publish ( void ) { }
+#endif
+
+
+/* Second essential function: the scanner.
+   It monitors the service directories and spawns a supervisor
+   if needed. */
+
+/* cpu placement and scheduling, applied by the child before exec:
+ * "cpuset" holds a cpu list like 0-3,8; "numa" holds "bind nodes",
+ * "interleave nodes", "preferred node" or "auto"; "sched" holds
+ * "other", "batch", "idle", "fifo prio" or "rr prio"; "nice" a nice
+ * value; "ioclass" holds "realtime level", "best-effort level" or
+ * "idle". services marked "heavy" (or with numa auto) are spread
+ * across the NUMA nodes. in supervise mode s6-supervise gets the
+ * settings and passes them on.
+ */
+#if defined (OSLinux)
+#define LONG_BITS		( 8 * sizeof ( unsigned long ) )
+#define NODE_SYS		"/sys/devices/system/node/"
+
+enum {
+  TUNE_MAXCPUS				= 1024,
+  TUNE_MAXNODES				= 64,
+  /* from <numaif.h> and <linux/ioprio.h> */
+  TUNE_MPOL_PREFERRED			= 1,
+  TUNE_MPOL_BIND			= 2,
+  TUNE_MPOL_INTERLEAVE			= 3,
+  TUNE_IOPRIO_CLASS_SHIFT		= 13,
+  TUNE_IOPRIO_WHO_PROCESS		= 1,
+} ;
+
+struct tune_s {
+  unsigned long cpus [ TUNE_MAXCPUS / LONG_BITS ] ;
+  unsigned long nodes [ TUNE_MAXNODES / LONG_BITS ] ;
+  /* -1: inherited */
+  int mpol ;
+  int policy ;
+  int prio ;
+  int ioprio ;
+  int nice ;
+  /* the node a heavy service was put on, -1 if none */
+  int node ;
+  unsigned int flagcpus : 1 ;
+  unsigned int flagnice : 1 ;
+} ;
+
+/* the online NUMA nodes (numanodes = -1 until read) and the number
+ * of heavy services on each */
+static unsigned long numaonline [ TUNE_MAXNODES / LONG_BITS ] ;
+static int numanodes = -1 ;
+static unsigned int nodeload [ TUNE_MAXNODES ] ;
+
+/* parse a list like 0-3,8 into a mask of nbits bits. returns the
+ * number of bits set, or -1 if the list is invalid
+ */
+static int bitlist_scan ( char const * s, unsigned long * mask, const unsigned int nbits )
+{
+  int count = 0 ;
+
+  memset ( mask, 0, nbits / 8 ) ;
+
+  while ( * s && ' ' != * s && '\t' != * s && '\n' != * s ) {
+    unsigned int a, b ;
+    size_t k = uint_scan ( s, & a ) ;
+
+    if ( ! k ) { return -1 ; }
+    s += k ;
+    b = a ;
+
+    if ( '-' == * s ) {
+      k = uint_scan ( ++ s, & b ) ;
+      if ( ! k || b < a ) { return -1 ; }
+      s += k ;
+    }
+
+    if ( b >= nbits ) { return -1 ; }
+
+    for ( ; a <= b ; ++ a, ++ count ) { mask [ a / LONG_BITS ] |= 1UL << ( a % LONG_BITS ) ; }
+
+    if ( ',' == * s ) { ++ s ; }
+  }
+
+  return count ;
+}
+
+/* if s starts with the word w, what follows it, else NULL */
+static char const * word ( char const * s, char const * w )
+{
+  const size_t len = strlen ( w ) ;
+
+  if ( strncmp ( s, w, len ) ) { return NULL ; }
+  s += len ;
+  if ( * s && ' ' != * s && '\t' != * s && '\n' != * s ) { return NULL ; }
+  while ( ' ' == * s || '\t' == * s ) { ++ s ; }
+
+  return s ;
+}
+
+static void numa_init ( void )
+{
+  char buf [ 256 ] ;
+  ssize_t r ;
+
+  if ( 0 <= numanodes ) { return ; }
+
+  numanodes = 0 ;
+  r = openreadnclose ( NODE_SYS "online", buf, sizeof ( buf ) - 1 ) ;
+  if ( 0 >= r ) { return ; }
+  buf [ r ] = 0 ;
+  r = bitlist_scan ( buf, numaonline, TUNE_MAXNODES ) ;
+  if ( 0 < r ) { numanodes = r ; }
+}
+
+/* put a heavy service on the online node with the fewest heavy
+ * services, and on the cpus of that node unless it has a cpuset
+ */
+static void tune_place ( char const * name, struct tune_s * t )
+{
+  char fn [ sizeof ( NODE_SYS "node/cpulist" ) + UINT_FMT ] ;
+  char buf [ 1024 ] ;
+  unsigned int k ;
+  int best = -1 ;
+  ssize_t r ;
+
+  numa_init () ;
+  if ( 2 > numanodes ) { return ; }
+
+  for ( k = 0 ; k < TUNE_MAXNODES ; ++ k ) {
+    if ( ! ( numaonline [ k / LONG_BITS ] & ( 1UL << ( k % LONG_BITS ) ) ) ) { continue ; }
+    if ( 0 > best || nodeload [ k ] < nodeload [ best ] ) { best = k ; }
+  }
+
+  t -> node = best ;
+  ++ nodeload [ best ] ;
+
+  if ( 0 > t -> mpol ) {
+    t -> mpol = TUNE_MPOL_PREFERRED ;
+    memset ( t -> nodes, 0, sizeof ( t -> nodes ) ) ;
+    t -> nodes [ best / LONG_BITS ] = 1UL << ( best % LONG_BITS ) ;
+  }
+
+  if ( t -> flagcpus ) { return ; }
+
+  memcpy ( fn, NODE_SYS "node", sizeof ( NODE_SYS "node" ) - 1 ) ;
+  k = sizeof ( NODE_SYS "node" ) - 1 ;
+  k += uint_fmt ( fn + k, best ) ;
+  memcpy ( fn + k, "/cpulist", sizeof ( "/cpulist" ) ) ;
+
+  r = openreadnclose ( fn, buf, sizeof ( buf ) - 1 ) ;
+  if ( 0 < r ) {
+    buf [ r ] = 0 ;
+    if ( 0 < bitlist_scan ( buf, t -> cpus, TUNE_MAXCPUS ) ) { t -> flagcpus = 1 ; }
+  }
+
+  if ( ! t -> flagcpus ) { strerr_warnwu2sys ( "read the cpus of the NUMA node for ", name ) ; }
+}
+
+/* read the settings of a new service */
+static void tune_load ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  char const * const name = sv -> name ;
+  struct tune_s t ;
+  char buf [ 1024 ] ;
+  char const * arg ;
+  unsigned int u ;
+  int any = 0, heavy = svfile_exists ( name, "heavy" ) ;
+
+  memset ( & t, 0, sizeof ( t ) ) ;
+  t . mpol = t . policy = t . ioprio = t . node = -1 ;
+
+  if ( 0 < svfile_read ( name, "cpuset", buf, sizeof ( buf ) ) ) {
+    if ( 0 < bitlist_scan ( buf, t . cpus, TUNE_MAXCPUS ) ) { t . flagcpus = any = 1 ; }
+    else { strerr_warnw2x ( "invalid cpuset setting for ", name ) ; }
+  }
+
+  if ( 0 < svfile_read ( name, "numa", buf, sizeof ( buf ) ) ) {
+    if ( word ( buf, "auto" ) ) { heavy = 1 ; }
+    else {
+      if ( ( arg = word ( buf, "bind" ) ) ) { t . mpol = TUNE_MPOL_BIND ; }
+      else if ( ( arg = word ( buf, "interleave" ) ) ) { t . mpol = TUNE_MPOL_INTERLEAVE ; }
+      else if ( ( arg = word ( buf, "preferred" ) ) ) { t . mpol = TUNE_MPOL_PREFERRED ; }
+
+      if ( 0 <= t . mpol && 0 < bitlist_scan ( arg, t . nodes, TUNE_MAXNODES ) ) { any = 1 ; }
+      else {
+        strerr_warnw2x ( "invalid numa setting for ", name ) ;
+        t . mpol = -1 ;
+      }
+    }
+  }
+
+  if ( 0 < svfile_read ( name, "sched", buf, sizeof ( buf ) ) ) {
+    t . prio = 0 ;
+    if ( word ( buf, "other" ) ) { t . policy = SCHED_OTHER ; }
+    else if ( word ( buf, "batch" ) ) { t . policy = SCHED_BATCH ; }
+    else if ( word ( buf, "idle" ) ) { t . policy = SCHED_IDLE ; }
+    else if ( ( arg = word ( buf, "fifo" ) ) && uint_scan ( arg, & u ) ) { t . policy = SCHED_FIFO ; t . prio = u ; }
+    else if ( ( arg = word ( buf, "rr" ) ) && uint_scan ( arg, & u ) ) { t . policy = SCHED_RR ; t . prio = u ; }
+
+    if ( 0 <= t . policy ) { any = 1 ; }
+    else { strerr_warnw2x ( "invalid sched setting for ", name ) ; }
+  }
+
+  if ( 0 < svfile_read ( name, "nice", buf, sizeof ( buf ) ) ) {
+    if ( int_scan ( buf, & t . nice ) && -20 <= t . nice && t . nice < 20 ) { t . flagnice = any = 1 ; }
+    else { strerr_warnw2x ( "invalid nice setting for ", name ) ; }
+  }
+
+  if ( 0 < svfile_read ( name, "ioclass", buf, sizeof ( buf ) ) ) {
+    if ( word ( buf, "idle" ) ) { t . ioprio = 3 << TUNE_IOPRIO_CLASS_SHIFT ; }
+    else if ( ( arg = word ( buf, "realtime" ) ) && uint_scan ( arg, & u ) && u < 8 ) { t . ioprio = 1 << TUNE_IOPRIO_CLASS_SHIFT | u ; }
+    else if ( ( arg = word ( buf, "best-effort" ) ) && uint_scan ( arg, & u ) && u < 8 ) { t . ioprio = 2 << TUNE_IOPRIO_CLASS_SHIFT | u ; }
+
+    if ( 0 <= t . ioprio ) { any = 1 ; }
+    else { strerr_warnw2x ( "invalid ioclass setting for ", name ) ; }
+  }
+
+  if ( ! any && ! heavy ) { return ; }
+
+  sv -> tune = malloc ( sizeof ( t ) ) ;
+  if ( ! sv -> tune ) {
+    strerr_warnwu2sys ( "store the scheduling settings of ", name ) ;
+    return ;
+  }
+
+  if ( heavy ) { tune_place ( name, & t ) ; }
+  memcpy ( sv -> tune, & t, sizeof ( t ) ) ;
+}
+
+static void tune_free ( const unsigned int i )
+{
+  struct tune_s * const t = services [ i ] . tune ;
+
+  if ( ! t ) { return ; }
+
+  /* the template's */
+  if ( services [ i ] . tpl ) {
+    services [ i ] . tune = NULL ;
+    return ;
+  }
+
+  if ( 0 <= t -> node ) { -- nodeload [ t -> node ] ; }
+  free ( t ) ;
+  services [ i ] . tune = NULL ;
+}
+
+/* in the child: only system calls, it may share our memory */
+static int tune_apply ( struct tune_s const * t )
+{
+  if ( t -> flagcpus && syscall ( SYS_sched_setaffinity, 0, sizeof ( t -> cpus ), t -> cpus ) < 0 ) { return -1 ; }
+  if ( 0 <= t -> mpol && syscall ( SYS_set_mempolicy, t -> mpol, t -> nodes, TUNE_MAXNODES + 1 ) < 0 ) { return -1 ; }
+  if ( 0 <= t -> ioprio && syscall ( SYS_ioprio_set, TUNE_IOPRIO_WHO_PROCESS, 0, t -> ioprio ) < 0 ) { return -1 ; }
+
+  if ( 0 <= t -> policy ) {
+    struct sched_param sp ;
+
+    memset ( & sp, 0, sizeof ( sp ) ) ;
+    sp . sched_priority = t -> prio ;
+    if ( sched_setscheduler ( 0, t -> policy, & sp ) < 0 ) { return -1 ; }
+  }
+
+  if ( t -> flagnice && setpriority ( PRIO_PROCESS, 0, t -> nice ) < 0 ) { return -1 ; }
+
+  return 0 ;
+}
+#else
+/* Linux only */
+static void tune_load ( const unsigned int i ) { (void) i ; }
+static void tune_free ( const unsigned int i ) { (void) i ; }
+static int tune_apply ( struct tune_s const * t ) { (void) t ; return 0 ; }
+#endif
+
+/* exec-direct, in-process mode only: a service directory with an
+ * "argv" file (one argument per line) has that run instead of ./run,
+ * with no shell in between. optional: "env/" (one variable per file,
+ * as with s6-envdir: the first line is the value, an empty file
+ * unsets it), "cwd" (relative to the service directory), "user"
+ * (a user name or uid:gid) and "rlimits" (lines of "resource soft
+ * [hard]", a limit can be "unlimited"). it is all read once and read
+ * again only when one of the files or env/ has a newer mtime (editing
+ * a variable in place needs a touch of env/).
+ */
+static char const * const execfiles [] = { "argv", "env", "cwd", "user", "rlimits", 0 } ;
+
+static struct {
+  char const * name ;
+  int res ;
+} const rlimitnames [] = {
+  { "as", RLIMIT_AS },
+  { "core", RLIMIT_CORE },
+  { "cpu", RLIMIT_CPU },
+  { "data", RLIMIT_DATA },
+  { "fsize", RLIMIT_FSIZE },
+  { "nofile", RLIMIT_NOFILE },
+  { "stack", RLIMIT_STACK },
+#ifdef RLIMIT_MEMLOCK
+  { "memlock", RLIMIT_MEMLOCK },
+#endif
+#ifdef RLIMIT_NPROC
+  { "nproc", RLIMIT_NPROC },
+#endif
+  { 0, 0 }
+} ;
+
+/* the newest mtime of the exec-direct files of a service. returns 0
+ * if it has no argv file, -1 on error
+ */
+static int execinfo_stamp ( char const * name, struct timespec * ts )
+{
+  const size_t namelen = strlen ( name ) ;
+  char fn [ namelen + sizeof ( "/rlimits" ) ] ;
+  unsigned int k ;
+
+  memcpy ( fn, name, namelen ) ;
+  fn [ namelen ] = '/' ;
+  ts -> tv_sec = ts -> tv_nsec = 0 ;
+
+  for ( k = 0 ; execfiles [ k ] ; ++ k ) {
+    struct stat st ;
+
+    strcpy ( fn + namelen + 1, execfiles [ k ] ) ;
+
+    if ( stat ( fn, & st ) < 0 ) {
+      if ( ENOENT != errno ) { return -1 ; }
+      if ( ! k ) { return 0 ; }
+      continue ;
+    }
+
+    if ( st . st_mtim . tv_sec > ts -> tv_sec
+      || ( st . st_mtim . tv_sec == ts -> tv_sec && st . st_mtim . tv_nsec > ts -> tv_nsec ) )
+      * ts = st . st_mtim ;
+  }
+
+  return 1 ;
+}
+
+/* add the lines of s to b as NUL terminated strings. returns how many */
+static size_t execinfo_lines ( struct buf_s * b, char const * s )
+{
+  size_t count = 0 ;
+
+  while ( * s ) {
+    char const * const end = strchr ( s, '\n' ) ;
+    const size_t len = end ? (size_t) ( end - s ) : strlen ( s ) ;
+
+    if ( len ) {
+      if ( buf_put ( b, s, len ) < 0 || buf_put ( b, "", 1 ) < 0 ) { return 0 ; }
+      ++ count ;
+    }
+
+    if ( ! end ) { break ; }
+    s = end + 1 ;
+  }
+
+  return count ;
+}
+
+/* add the variables in dir to b, as s6-envdir reads them */
+static ssize_t execinfo_env ( struct buf_s * b, char const * dir )
+{
+  const size_t dirlen = strlen ( dir ) ;
+  ssize_t count = 0 ;
+  DIR * d = opendir ( dir ) ;
+
+  if ( ! d ) { return ( ENOENT == errno ) ? 0 : -1 ; }
+
+  while ( 1 ) {
+    direntry * e ;
+    char val [ EXEC_MAX ] ;
+    ssize_t r ;
+
+    errno = 0 ;
+    e = readdir ( d ) ;
+    if ( ! e ) { break ; }
+    if ( '.' == e -> d_name [ 0 ] || strchr ( e -> d_name, '=' ) ) { continue ; }
+
+    {
+      const size_t len = strlen ( e -> d_name ) ;
+      char fn [ dirlen + len + 2 ] ;
+
+      memcpy ( fn, dir, dirlen ) ;
+      fn [ dirlen ] = '/' ;
+      memcpy ( fn + dirlen + 1, e -> d_name, len + 1 ) ;
+      r = openreadnclose ( fn, val, sizeof ( val ) ) ;
+      if ( 0 > r ) { break ; }
+    }
+
+    if ( buf_put ( b, e -> d_name, strlen ( e -> d_name ) ) < 0 ) { break ; }
+
+    if ( r ) {
+      size_t k, len = 0 ;
+
+      while ( len < (size_t) r && '\n' != val [ len ] ) { ++ len ; }
+      while ( len && ( ' ' == val [ len - 1 ] || '\t' == val [ len - 1 ] ) ) { -- len ; }
+      for ( k = 0 ; k < len ; ++ k ) { if ( ! val [ k ] ) { val [ k ] = '\n' ; } }
+      if ( buf_put ( b, "=", 1 ) < 0 || buf_put ( b, val, len ) < 0 ) { break ; }
+    }
+
+    if ( buf_put ( b, "", 1 ) < 0 ) { break ; }
+    ++ count ;
+  }
+
+  if ( errno ) { count = -1 ; }
+  dir_close ( d ) ;
+
+  return count ;
+}
+
+static int execinfo_user ( struct execinfo_s * ex, char const * s )
+{
+  unsigned int uid, gid ;
+  size_t k = uint_scan ( s, & uid ) ;
+
+  if ( k && ':' == s [ k ] && uint_scan ( s + k + 1, & gid ) ) {
+    ex -> uid = uid ;
+    ex -> gid = gid ;
+  } else {
+    char name [ 256 ] ;
+    struct passwd const * pw ;
+
+    for ( k = 0 ; s [ k ] && '\n' != s [ k ] && k < sizeof ( name ) - 1 ; ++ k ) { name [ k ] = s [ k ] ; }
+    name [ k ] = 0 ;
+
+    errno = 0 ;
+    pw = getpwnam ( name ) ;
+    if ( ! pw ) { return -1 ; }
+    ex -> uid = pw -> pw_uid ;
+    ex -> gid = pw -> pw_gid ;
+  }
+
+  ex -> flaguser = 1 ;
+
+  return 0 ;
+}
+
+static int execinfo_rlimits ( struct execinfo_s * ex, char * s )
+{
+  while ( * s ) {
+    char * const end = strchr ( s, '\n' ) ;
+    char * w [ 3 ] = { 0, 0, 0 } ;
+    unsigned int nw = 0, k ;
+
+    if ( end ) { * end = 0 ; }
+
+    while ( nw < 3 ) {
+      while ( ' ' == * s || '\t' == * s ) { ++ s ; }
+      if ( ! * s ) { break ; }
+      w [ nw ++ ] = s ;
+      while ( * s && ' ' != * s && '\t' != * s ) { ++ s ; }
+      if ( * s ) { * s ++ = 0 ; }
+    }
+
+    if ( nw ) {
+      rlim_t v [ 2 ] ;
+
+      for ( k = 0 ; rlimitnames [ k ] . name && strcmp ( rlimitnames [ k ] . name, w [ 0 ] ) ; ++ k ) ;
+      if ( ! rlimitnames [ k ] . name || 2 > nw || EXEC_RLIMITS <= ex -> nrl ) { return -1 ; }
+
+      for ( nw = 1 ; nw < 3 ; ++ nw ) {
+        char const * const a = w [ nw ] ? w [ nw ] : w [ 1 ] ;
+        unsigned int u ;
+
+        if ( ! strcmp ( a, "unlimited" ) ) { v [ nw - 1 ] = RLIM_INFINITY ; }
+        else if ( uint0_scan ( a, & u ) ) { v [ nw - 1 ] = u ; }
+        else { return -1 ; }
+      }
+
+      ex -> rl [ ex -> nrl ] . res = rlimitnames [ k ] . res ;
+      ex -> rl [ ex -> nrl ] . rl . rlim_cur = v [ 0 ] ;
+      ex -> rl [ ex -> nrl ++ ] . rl . rlim_max = v [ 1 ] ;
+    }
+
+    if ( ! end ) { break ; }
+    s = end + 1 ;
+  }
+
+  return 0 ;
+}
+
+/* read the exec-direct files of a service. returns NULL, with a
+ * warning, if they are unusable: then ./run is used
+ */
+static struct execinfo_s * execinfo_load ( char const * name, struct timespec const * stamp )
+{
+  const size_t namelen = strlen ( name ) ;
+  struct execinfo_s ex ;
+  struct execinfo_s * p ;
+  struct buf_s b = { 0, 0, 0 } ;
+  char buf [ EXEC_MAX ] ;
+  char dir [ namelen + sizeof ( "/env" ) ] ;
+  size_t argc, cwdpos = 0, k, pos ;
+  ssize_t nenv ;
+
+  memset ( & ex, 0, sizeof ( ex ) ) ;
+  ex . stamp = * stamp ;
+
+  if ( 0 > svfile_read ( name, "argv", buf, sizeof ( buf ) ) ) { goto err ; }
+  argc = execinfo_lines ( & b, buf ) ;
+  if ( ! argc ) {
+    strerr_warnw2x ( "invalid argv setting for ", name ) ;
+    goto err ;
+  }
+
+  memcpy ( dir, name, namelen ) ;
+  memcpy ( dir + namelen, "/env", sizeof ( "/env" ) ) ;
+  nenv = execinfo_env ( & b, dir ) ;
+  if ( 0 > nenv ) {
+    strerr_warnwu2sys ( "read ", dir ) ;
+    goto err ;
+  }
+
+  /* a relative cwd is relative to the service directory */
+  if ( 0 < svfile_read ( name, "cwd", buf, sizeof ( buf ) ) ) {
+    const size_t len = strcspn ( buf, "\n" ) ;
+
+    cwdpos = b . len + 1 ;
+    if ( ( '/' != buf [ 0 ] && ( buf_put ( & b, name, namelen ) < 0 || buf_put ( & b, "/", 1 ) < 0 ) )
+      || buf_put ( & b, buf, len ) < 0 || buf_put ( & b, "", 1 ) < 0 ) {
+      strerr_warnwu2sys ( "store the exec-direct settings of ", name ) ;
+      goto err ;
+    }
+  }
+
+  if ( 0 < svfile_read ( name, "user", buf, sizeof ( buf ) ) && execinfo_user ( & ex, buf ) < 0 ) {
+    strerr_warnw2x ( "invalid user setting for ", name ) ;
+    goto err ;
+  }
+
+  if ( 0 < svfile_read ( name, "rlimits", buf, sizeof ( buf ) ) && execinfo_rlimits ( & ex, buf ) < 0 ) {
+    strerr_warnw2x ( "invalid rlimits setting for ", name ) ;
+    goto err ;
+  }
+
+  p = malloc ( sizeof ( ex ) + ( argc + 1 + nenv + 1 ) * sizeof ( char const * ) ) ;
+  if ( ! p ) {
+    strerr_warnwu2sys ( "store the exec-direct settings of ", name ) ;
+    goto err ;
+  }
+
+  * p = ex ;
+  p -> strings = b . s ;
+  p -> argv = (char const **) ( p + 1 ) ;
+  p -> env = p -> argv + argc + 1 ;
+  p -> nenv = nenv ;
+  p -> cwd = cwdpos ? b . s + cwdpos - 1 : NULL ;
+
+  for ( k = 0, pos = 0 ; k < argc + nenv ; ++ k ) {
+    if ( k < argc ) { p -> argv [ k ] = b . s + pos ; }
+    else { p -> env [ k - argc ] = b . s + pos ; }
+    pos += strlen ( b . s + pos ) + 1 ;
+  }
+
+  p -> argv [ argc ] = 0 ;
+  p -> env [ nenv ] = 0 ;
+
+  return p ;
+
+ err:
+  free ( b . s ) ;
+  return NULL ;
+}
+
+static void execinfo_free ( const unsigned int i )
+{
+  if ( ! services [ i ] . ex ) { return ; }
+
+  free ( services [ i ] . ex -> strings ) ;
+  free ( services [ i ] . ex ) ;
+  services [ i ] . ex = NULL ;
+}
+
+/* the exec-direct settings of a service, read again if they changed */
+static struct execinfo_s const * execinfo_get ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct timespec ts ;
+  int r ;
+
+  if ( sv -> tpl ) { return execinfo_get ( sv -> tpl - 1 ) ; }
+
+  r = execinfo_stamp ( sv -> name, & ts ) ;
+
+  if ( 0 >= r ) {
+    if ( 0 > r ) { strerr_warnwu2sys ( "check the exec-direct settings of ", sv -> name ) ; }
+    execinfo_free ( i ) ;
+    return NULL ;
+  }
+
+  if ( sv -> ex && sv -> ex -> stamp . tv_sec == ts . tv_sec && sv -> ex -> stamp . tv_nsec == ts . tv_nsec )
+    return sv -> ex ;
+
+  execinfo_free ( i ) ;
+  sv -> ex = execinfo_load ( sv -> name, & ts ) ;
+
+  return sv -> ex ;
+}
+
+/* does env/ set or unset the variable var (VAR=value) ? */
+static int execinfo_sets ( struct execinfo_s const * ex, char const * var )
+{
+  const size_t len = strcspn ( var, "=" ) ;
+  size_t k ;
+
+  for ( k = 0 ; k < ex -> nenv ; ++ k )
+    if ( ! strncmp ( ex -> env [ k ], var, len ) && ( ! ex -> env [ k ] [ len ] || '=' == ex -> env [ k ] [ len ] ) )
+      return 1 ;
+
+  return 0 ;
+}
+
+/* in the child, after tune_apply (): only system calls */
+static int execinfo_apply ( struct execinfo_s const * ex )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; k < ex -> nrl ; ++ k )
+    if ( setrlimit ( ex -> rl [ k ] . res, & ex -> rl [ k ] . rl ) < 0 ) { return -1 ; }
+
+  if ( ex -> flaguser
+    && ( setgroups ( 1, & ex -> gid ) < 0 || setgid ( ex -> gid ) < 0 || setuid ( ex -> uid ) < 0 ) )
+    return -1 ;
+
+  return 0 ;
+}
+
+/* the fds for a child are first copied above all of them, so that
+ * moving one never clobbers the source of another
+ */
+static int fdmove_base ( struct fdmove_s const * mv, const unsigned int nmv )
+{
+  unsigned int k ;
+  int base = 2 ;
+
+  for ( k = 0 ; k < nmv ; ++ k ) {
+    if ( base < mv [ k ] . from ) { base = mv [ k ] . from ; }
+    if ( base < mv [ k ] . to ) { base = mv [ k ] . to ; }
+  }
+
+  return base + 1 ;
+}
+
+#ifdef STAGE2_FORK
+/* the traditional fork(2) spawn path, kept for comparison.
+ * spawn prog in directory cwd (NULL: ours) with environment envp,
+ * the nmv fds in mv and the settings in tune and ex (NULL: none).
+ * returns the pid, or 0 and sets errno.
+ */
+static pid_t spawnit ( char const * prog, char const * const * argv, char const * const * envp, char const * cwd,
+  struct fdmove_s const * mv, const unsigned int nmv, struct tune_s const * tune, struct execinfo_s const * ex )
+{
+  const int base = fdmove_base ( mv, nmv ) ;
+  const pid_t pid = fork () ;
+  unsigned int k ;
+
+  if ( pid ) { return ( 0 < pid ) ? pid : 0 ; }
+
+  PROG = "s6-svscan (child)" ;
+  selfpipe_finish () ;
+
+  for ( k = 0 ; k < nmv ; ++ k )
+    if ( dup2 ( mv [ k ] . from, base + k ) == -1 )
+      strerr_diefu2sys ( 111, "set fds for ", prog ) ;
+
+  for ( k = 0 ; k < nmv ; ++ k )
+    if ( fd_move ( mv [ k ] . to, base + k ) == -1 )
+      strerr_diefu2sys ( 111, "set fds for ", prog ) ;
+
+  if ( cwd && chdir ( cwd ) == -1 )
+    strerr_diefu2sys ( 111, "chdir to ", cwd ) ;
+
+  if ( tune && tune_apply ( tune ) < 0 )
+    strerr_diefu2sys ( 111, "apply the scheduling settings for ", prog ) ;
+
+  if ( ex && execinfo_apply ( ex ) < 0 )
+    strerr_diefu2sys ( 111, "set the limits and user for ", prog ) ;
+
+  xpathexec_run ( prog, argv, envp ) ;
+}
+#else
+/* set up the attributes shared by all spawned supervisors:
+ * they start with the signal mask and dispositions s6-svscan
+ * had before it trapped its signals (what selfpipe_finish()
+ * restored in the forked child before).
+ */
+static int spawn_init ( void )
+{
+  sigset_t empty ;
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF ;
+
+#ifdef POSIX_SPAWN_USEVFORK
+  flags |= POSIX_SPAWN_USEVFORK ;
+#endif
+  sigemptyset ( & empty ) ;
+  errno = posix_spawnattr_init ( & spawnattr ) ;
+  if ( errno ) { return -1 ; }
+  errno = posix_spawnattr_setflags ( & spawnattr, flags ) ;
+  if ( ! errno ) errno = posix_spawnattr_setsigmask ( & spawnattr, & empty ) ;
+  if ( ! errno ) errno = posix_spawnattr_setsigdefault ( & spawnattr, & trapped ) ;
+
+  return errno ? -1 : 0 ;
+}
+
+/* posix_spawn() cannot set what is in a struct tune_s, nor limits
+ * and a user: a child that needs them is spawned with vfork(), and
+ * only makes system calls until it execs. a failure is reported
+ * through err, which it shares with us.
+ */
+static pid_t spawnvfork ( char const * prog, char const * const * argv, char const * const * envp, char const * cwd,
+  struct fdmove_s const * mv, const unsigned int nmv, struct tune_s const * tune, struct execinfo_s const * ex )
+{
+  const int base = fdmove_base ( mv, nmv ) ;
+  volatile int err = 0 ;
+  pid_t pid ;
+
+  pid = vfork () ;
+  if ( 0 > pid ) { return 0 ; }
+
+  if ( ! pid ) {
+    struct sigaction sa ;
+    sigset_t empty ;
+    unsigned int k ;
+    int sig ;
+
+    /* what posix_spawn() does with spawnattr */
+    memset ( & sa, 0, sizeof ( sa ) ) ;
+    sa . sa_handler = SIG_DFL ;
+    for ( sig = 1 ; sig < NSIG ; ++ sig )
+      if ( 1 == sigismember ( & trapped, sig ) ) { (void) sigaction ( sig, & sa, NULL ) ; }
+    sigemptyset ( & empty ) ;
+
+    for ( k = 0 ; k < nmv ; ++ k )
+      if ( dup2 ( mv [ k ] . from, base + k ) < 0 ) { goto err ; }
+
+    for ( k = 0 ; k < nmv ; ++ k )
+      if ( dup2 ( base + k, mv [ k ] . to ) < 0 || close ( base + k ) < 0 ) { goto err ; }
+
+    if ( ( cwd && chdir ( cwd ) < 0 ) || ( tune && tune_apply ( tune ) < 0 ) || ( ex && execinfo_apply ( ex ) < 0 )
+      || sigprocmask ( SIG_SETMASK, & empty, NULL ) < 0 ) { goto err ; }
+
+    (void) execvpe ( prog, (char * const *) argv, (char * const *) envp ) ;
+  err:
+    err = errno ;
+    _exit ( 127 ) ;
+  }
+
+  if ( err ) {
+    (void) waitpid ( pid, NULL, 0 ) ;
+    errno = err ;
+    return 0 ;
+  }
+
+  return pid ;
+}
+
+/* spawn a child without copying our address space:
+ * posix_spawn() uses clone(CLONE_VM|CLONE_VFORK) on Linux, and
+ * the log pipe plumbing is done by file actions in the child.
+ * spawn prog in directory cwd (NULL: ours) with environment envp,
+ * the nmv fds in mv and the settings in tune and ex (NULL: none).
+ * returns the pid, or 0 and sets errno.
+ */
+static pid_t spawnit ( char const * prog, char const * const * argv, char const * const * envp, char const * cwd,
+  struct fdmove_s const * mv, const unsigned int nmv, struct tune_s const * tune, struct execinfo_s const * ex )
+{
+  const int base = fdmove_base ( mv, nmv ) ;
+  pid_t pid = 0 ;
+  posix_spawn_file_actions_t fa ;
+  unsigned int k ;
+
+  if ( tune || ( ex && ( ex -> nrl || ex -> flaguser ) ) )
+    return spawnvfork ( prog, argv, envp, cwd, mv, nmv, tune, ex ) ;
+
+  errno = posix_spawn_file_actions_init ( & fa ) ;
+  if ( errno ) { return 0 ; }
+
+  if ( 1 == nmv ) { errno = posix_spawn_file_actions_adddup2 ( & fa, mv [ 0 ] . from, mv [ 0 ] . to ) ; }
+  else {
+    for ( k = 0 ; ! errno && k < nmv ; ++ k )
+      errno = posix_spawn_file_actions_adddup2 ( & fa, mv [ k ] . from, base + k ) ;
+
+    for ( k = 0 ; ! errno && k < nmv ; ++ k ) {
+      errno = posix_spawn_file_actions_adddup2 ( & fa, base + k, mv [ k ] . to ) ;
+      if ( ! errno ) errno = posix_spawn_file_actions_addclose ( & fa, base + k ) ;
+    }
+  }
+
+  if ( ! errno && cwd ) { errno = posix_spawn_file_actions_addchdir_np ( & fa, cwd ) ; }
+
+  if ( ! errno )
+    errno = posix_spawnp ( & pid, prog, & fa, & spawnattr,
+      (char * const *) argv, (char * const *) envp ) ;
+
+  posix_spawn_file_actions_destroy ( & fa ) ;
+
+  return errno ? 0 : pid ;
+}
+#endif
+
+/* start the supervisor of a service or its logger,
+ * or in in-process mode the run script itself.
+ */
+static void trystart ( unsigned int i, char const * name, int islog )
+{
+  struct sockets_s const * const ls = islog ? NULL : services [ i ] . ls ;
+  struct execinfo_s const * const ex = ( inproc && ! islog ) ? execinfo_get ( i ) : NULL ;
+  /* the last argument, for the service and the logger alike */
+  char const * const inst = svinst ( i ) ;
+  const int ownenv = ls || ( ex && ex -> nenv ) ;
+  size_t envlen = 0, argc = 0, k, m = 0 ;
+  pid_t pid = 0 ;
+  int np [ 2 ] = { -1, -1 } ;
+  struct fdmove_s mv [ 2 + LISTEN_MAX ] ;
+  unsigned int nmv = 0 ;
+
+  while ( ownenv && environ [ envlen ] ) { ++ envlen ; }
+  while ( ex && ex -> argv [ argc ] ) { ++ argc ; }
+
+  {
+    char const * envp [ envlen + ( ex ? ex -> nenv : 0 ) + 2 ] ;
+    char const * xargv [ argc + 2 ] ;
+    char fds [ sizeof ( "LISTEN_FDS=" ) + UINT_FMT ] ;
+
+    if ( services [ i ] . flaglog ) {
+      mv [ nmv ] . from = services [ i ] . p [ ! islog ] ;
+      mv [ nmv ++ ] . to = ! islog ;
+    }
+
+    /* the sockets go to 3 and up */
+    for ( k = 0 ; ls && k < ls -> n ; ++ k ) {
+      mv [ nmv ] . from = ls -> fd [ k ] ;
+      mv [ nmv ++ ] . to = 3 + k ;
+    }
+
+    /* ours, minus what env/ sets or unsets and any LISTEN_ variables */
+    if ( ownenv ) {
+      for ( k = 0 ; k < envlen ; ++ k ) {
+        if ( ls && ! strncmp ( environ [ k ], "LISTEN_", 7 ) ) { continue ; }
+        if ( ex && execinfo_sets ( ex, environ [ k ] ) ) { continue ; }
+        envp [ m ++ ] = environ [ k ] ;
+      }
+
+      for ( k = 0 ; ex && k < ex -> nenv ; ++ k )
+        if ( strchr ( ex -> env [ k ], '=' ) ) { envp [ m ++ ] = ex -> env [ k ] ; }
+
+      if ( ls ) {
+        memcpy ( fds, "LISTEN_FDS=", 11 ) ;
+        fds [ 11 + uint_fmt ( fds + 11, ls -> n ) ] = 0 ;
+        envp [ m ++ ] = fds ;
+      }
+
+      envp [ m ] = 0 ;
+    }
+
+    if ( inproc && ! islog && services [ i ] . notifyfd ) {
+      if ( pipecoe ( np ) < 0 ) {
+        strerr_warnwu2sys ( "create notification pipe for ", name ) ;
+        np [ 0 ] = np [ 1 ] = -1 ;
+      } else {
+        mv [ nmv ] . from = np [ 1 ] ;
+        mv [ nmv ++ ] . to = services [ i ] . notifyfd ;
+      }
+    }
+
+    if ( ex ) {
+      memcpy ( xargv, ex -> argv, argc * sizeof ( char const * ) ) ;
+      xargv [ argc ] = inst ;
+      xargv [ argc + 1 ] = 0 ;
+      pid = spawnit ( xargv [ 0 ], xargv, ownenv ? envp : (char const * const *) environ,
+        ex -> cwd ? ex -> cwd : name, mv, nmv, services [ i ] . tune, ex ) ;
+    } else if ( inproc ) {
+      char const * cargv [ 3 ] = { "./run", inst, 0 } ;
+      pid = spawnit ( cargv [ 0 ], cargv, ownenv ? envp : (char const * const *) environ, name, mv, nmv,
+        islog ? NULL : services [ i ] . tune, NULL ) ;
+    } else {
+      char const * cargv [ 3 ] = { "s6-supervise", name, 0 } ;
+      pid = spawnit ( SUPERVISE_PROG, cargv, ownenv ? envp : (char const * const *) environ, NULL, mv, nmv,
+        islog ? NULL : services [ i ] . tune, NULL ) ;
+    }
+  }
+
+  if ( 0 <= np [ 1 ] ) { fd_close ( np [ 1 ] ) ; }
+
+  if ( 0 <= np [ 0 ] ) {
+    /* the service writes a newline to it when it is ready */
+    if ( pid && 0 <= ndelay_on ( np [ 0 ] ) && 0 <= ev_add ( np [ 0 ], EV_NOTIFY, i ) ) {
+      services [ i ] . nfd = np [ 0 ] ;
+    } else {
+      if ( pid ) { strerr_warnwu2sys ( "watch notification pipe of ", name ) ; }
+      fd_close ( np [ 0 ] ) ;
+    }
+  }
+
+  event ( S2EV_SPAWN, islog ? S2EV_LOG : 0, i, pid, pid ? 0 : errno ) ;
+
+  if ( ! pid ) {
+    tain_addsec_g ( & services [ i ] . restartafter [ islog ], CHECK_RETRY_TIMEOUT ) ;
+    timer_set ( i, islog, & services [ i ] . restartafter [ islog ] ) ;
+    strerr_warnwu2sys ( "spawn for ", name ) ;
+    return ;
+  }
+
+  pidset ( i, islog, 0, pid ) ;
+  services [ i ] . startedat [ islog ] = STAMP ;
+  services [ i ] . since [ islog ] = time ( NULL ) ;
+  svdirty ( i ) ;
+
+  /* without readiness notification, up is as good as ready */
+  if ( ! islog && ! services [ i ] . notifyfd ) { ready ( i ) ; }
+}
+
+/* in-process mode: run ./finish after ./run died, with the same
+ * arguments s6-supervise gives it. the restart waits until it is done.
+ */
+static void runfinish ( const unsigned int i, const unsigned int islog, const int wstat )
+{
+  struct svinfo_s * const sv = services + i ;
+  const size_t namelen = strlen ( svdir ( i ) ) ;
+  struct fdmove_s mv = { sv -> p [ ! islog ], ! islog } ;
+  char dir [ namelen + 5 ] ;
+  char code [ UINT_FMT ], sig [ UINT_FMT ] ;
+  char const * cargv [ 4 ] = { "./finish", code, sig, 0 } ;
+  tain_t t ;
+
+  memcpy ( dir, svdir ( i ), namelen ) ;
+  memcpy ( dir + namelen, islog ? "/log" : "", islog ? 5 : 1 ) ;
+
+  if ( ! svfile_exists ( dir, "finish" ) ) { return ; }
+
+  code [ uint_fmt ( code, WIFSIGNALED( wstat ) ? 256 : WEXITSTATUS( wstat ) ) ] = 0 ;
+  sig [ uint_fmt ( sig, WIFSIGNALED( wstat ) ? WTERMSIG( wstat ) : 0 ) ] = 0 ;
+  pidset ( i, islog, 1, spawnit ( cargv [ 0 ], cargv, (char const * const *) environ, dir, & mv, sv -> flaglog,
+    islog ? NULL : sv -> tune, NULL ) ) ;
+  event ( S2EV_SPAWN, ( islog ? S2EV_LOG : 0 ) | S2EV_FINISH, i, sv -> fpid [ islog ], sv -> fpid [ islog ] ? 0 : errno ) ;
+
+  if ( ! sv -> fpid [ islog ] ) {
+    strerr_warnwu3sys ( "spawn ", dir, "/finish" ) ;
+    return ;
+  }
+
+  tain_addsec_g ( & t, FINISH_TIMEOUT ) ;
+  timer_set ( i, TIMER_FINISH + islog, & t ) ;
+}
+
+static void retrydirlater ( void )
+{
+  tain_t a ;
+  tain_addsec_g ( & a, DIR_RETRY_TIMEOUT ) ;
+  if ( tain_less ( & a, & roots [ scanroot ] . deadline ) ) roots [ scanroot ] . deadline = a ;
+}
+
+/* a restart timer has expired: restart just this one supervisor,
+ * unless its directory has gone away in the meantime, in which
+ * case a scan sorts things out.
+ */
+/* start the supervisor of a service (islog = 0) or of its logger */
+static void svstart ( const unsigned int i, const unsigned int islog )
+{
+  if ( islog ) {
+    const size_t namelen = strlen ( svdir ( i ) ) ;
+    char tmp [ namelen + 5 ] ;
+
+    memcpy ( tmp, svdir ( i ), namelen ) ;
+    memcpy ( tmp + namelen, "/log", 5 ) ;
+    trystart ( i, tmp, 1 ) ;
+  } else {
+    trystart ( i, svdir ( i ), 0 ) ;
+  }
+}
+
+static void refill ( struct root_s * r )
+{
+  int ms ;
+  tain_t d ;
+
+  tain_sub ( & d, & STAMP, & r -> tokenstamp ) ;
+  ms = tain_to_millisecs ( & d ) ;
+  if ( 0 > ms || 60000 < ms ) { ms = 60000 ; }
+  tain_from_millisecs ( & d, ms ) ;
+  tain_add ( & r -> tokenstamp, & r -> tokenstamp, & d ) ;
+
+  r -> tokens += (uint64_t) ms * r -> ratelimit ;
+  if ( r -> tokens > (uint64_t) r -> burst * 1000 ) {
+    r -> tokens = (uint64_t) r -> burst * 1000 ;
+    r -> tokenstamp = STAMP ;
+  }
+}
+
+/* may another service of root r be started right now ? */
+static int spawn_allowed ( struct root_s * r )
+{
+  if ( pressure ) { return 0 ; }
+  if ( maxstarting && nstarting >= maxstarting ) { return 0 ; }
+  if ( ! r -> ratelimit ) { return 1 ; }
+
+  refill ( r ) ;
+
+  return 1000 <= r -> tokens ;
+}
+
+/* when will a rate limiter let the next queued service start ?
+ * (if it is the cap on starting services that holds it back,
+ * the end of a startup phase wakes us up anyway)
+ */
+static int queue_deadline ( tain_t * deadline )
+{
+  unsigned int k ;
+  int found = 0 ;
+
+  if ( pressure || ( maxstarting && nstarting >= maxstarting ) ) { return 0 ; }
+
+  for ( k = 0 ; k < nroots ; ++ k ) {
+    struct root_s const * const r = roots + k ;
+    tain_t d ;
+
+    if ( ! r -> qhead || ! r -> ratelimit || 1000 <= r -> tokens ) { continue ; }
+
+    tain_from_millisecs ( & d, (int) ( ( 1000 - r -> tokens + r -> ratelimit - 1 ) / r -> ratelimit ) ) ;
+    tain_add ( & d, & r -> tokenstamp, & d ) ;
+    if ( ! found || tain_less ( & d, deadline ) ) { * deadline = d ; }
+    found = 1 ;
+  }
+
+  return found ;
+}
+
+/* start a service's supervisor and put it in its startup phase */
+static void launch ( const unsigned int i )
+{
+  struct root_s * const r = roots + services [ i ] . root ;
+  tain_t t ;
+
+  if ( r -> ratelimit && 1000 <= r -> tokens ) { r -> tokens -= 1000 ; }
+
+  svstart ( i, 0 ) ;
+
+  if ( services [ i ] . pid [ 0 ] && ! services [ i ] . flagstarting ) {
+    svdirty ( i ) ;
+    services [ i ] . flagstarting = 1 ;
+    ++ nstarting ;
+    /* a service that notifies readiness ends its startup phase itself */
+    tain_addsec_g ( & t, services [ i ] . notifyfd ? READY_TIMEOUT : START_SETTLE ) ;
+    timer_set ( i, TIMER_READY, & t ) ;
+  }
+}
+
+/* start a supervisor now or, if the spawn rate limiter says so,
+ * queue the start. loggers and critical services are never queued,
+ * idle class ones wait for settle_release ().
+ */
+static void admit ( const unsigned int i )
+{
+  if ( services [ i ] . flagqueued ) { return ; }
+  else if ( services [ i ] . flagcritical ) { launch ( i ) ; }
+  else if ( settling && services [ i ] . flagidleclass ) {
+    if ( ! services [ i ] . flagheld ) { svdirty ( i ) ; }
+    services [ i ] . flagheld = 1 ;
+    wantsettle = 1 ;
+  }
+  else if ( ! roots [ services [ i ] . root ] . qhead && spawn_allowed ( roots + services [ i ] . root ) ) { launch ( i ) ; }
+  else { queue_push ( i ) ; }
+}
+
+/* a service with dependencies waits for startwaiting () */
+static void wantstart ( const unsigned int i, const unsigned int islog )
+{
+  if ( services [ i ] . down & ( 1u << islog ) ) { return ; }
+  else if ( islog ) { svstart ( i, 1 ) ; }
+  else if ( sockets_idle ( i ) ) { sockets_watch ( i, 0 ) ; }
+  else if ( services [ i ] . ndeps && ! services [ i ] . flagnodeps ) {
+    if ( ! services [ i ] . flagwaiting ) { svdirty ( i ) ; }
+    services [ i ] . flagwaiting = 1 ;
+    wantdeps = 1 ;
+  }
+  else { admit ( i ) ; }
+}
+
+/* the slot of dependency k of service i, or -1 if there is no such
+ * service (then it is ignored, with a warning)
+ */
+static int depslot ( const unsigned int i, const unsigned int k )
+{
+  struct svinfo_s * const sv = services + i ;
+  char const * dep = sv -> deps ;
+  unsigned int j, m ;
+
+  j = sv -> depidx [ k ] ;
+  for ( m = 0 ; m < k ; ++ m ) { dep += strlen ( dep ) + 1 ; }
+
+  if ( j < n && services [ j ] . flagused && services [ j ] . flagactive && ! strcmp ( services [ j ] . name, dep ) )
+    return j ;
+
+  for ( j = 0 ; j < n ; ++ j )
+    if ( services [ j ] . flagused && services [ j ] . flagactive && ! strcmp ( services [ j ] . name, dep ) ) break ;
+
+  if ( j < n ) {
+    sv -> depidx [ k ] = j ;
+    return j ;
+  }
+
+  if ( ! sv -> flagdepwarn ) {
+    strerr_warnw4x ( "ignoring missing dependency ", dep, " of ", sv -> name ) ;
+    sv -> flagdepwarn = 1 ;
+  }
+
+  return -1 ;
+}
+
+static int depsready ( const unsigned int i )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; k < services [ i ] . ndeps ; ++ k ) {
+    const int j = depslot ( i, k ) ;
+
+    /* clients can connect to bound sockets already */
+    if ( 0 <= j && ! services [ j ] . flagready && ! services [ j ] . ls ) { return 0 ; }
+  }
+
+  return 1 ;
+}
+
+/* depth first search through the waiting services: visit is 1 on
+ * the current path, 2 when done. a dependency on the path closes a
+ * cycle, which is broken by letting i ignore its dependencies.
+ * returns 1 if it found one.
+ */
+static int findcycle ( const unsigned int i )
+{
+  unsigned int k ;
+
+  services [ i ] . visit = 1 ;
+
+  for ( k = 0 ; k < services [ i ] . ndeps ; ++ k ) {
+    const int j = depslot ( i, k ) ;
+
+    if ( 0 > j || ! services [ j ] . flagwaiting ) { continue ; }
+
+    if ( 1 == services [ j ] . visit ) {
+      strerr_warnw4x ( "dependency cycle: starting ", services [ i ] . name, " without waiting for ", services [ j ] . name ) ;
+      services [ i ] . flagnodeps = 1 ;
+      return 1 ;
+    }
+
+    if ( ! services [ j ] . visit && findcycle ( j ) ) { return 1 ; }
+  }
+
+  services [ i ] . visit = 2 ;
+
+  return 0 ;
+}
+
+/* start the services whose dependencies are ready, and break the
+ * cycles that keep others waiting forever
+ */
+static void startwaiting ( void )
+{
+  while ( wantdeps ) {
+    unsigned int i, nwaiting = 0 ;
+
+    wantdeps = 0 ;
+
+    for ( i = 0 ; i < n ; ++ i ) {
+      struct svinfo_s * const sv = services + i ;
+
+      if ( ! sv -> flagused || ! sv -> flagwaiting ) { continue ; }
+
+      if ( sv -> flagnodeps || depsready ( i ) ) {
+        svdirty ( i ) ;
+        sv -> flagwaiting = 0 ;
+        if ( sv -> flagactive && ! sv -> flagquarantine && ! sv -> pid [ 0 ] && ! sv -> fpid [ 0 ] && ! ( sv -> down & 1 ) )
+          admit ( i ) ;
+      } else { ++ nwaiting ; }
+    }
+
+    if ( ! nwaiting ) { break ; }
+
+    /* waiting is fine as long as some dependency may still become
+     * ready: only a cycle of waiting services never will */
+    for ( i = 0 ; i < n ; ++ i ) { services [ i ] . visit = 0 ; }
+
+    for ( i = 0 ; i < n ; ++ i ) {
+      if ( ! services [ i ] . flagused || ! services [ i ] . flagwaiting || services [ i ] . visit ) { continue ; }
+      if ( findcycle ( i ) ) { wantdeps = 1 ; break ; }
+    }
+  }
+}
+
+/* start queued services as far as the rate limiters allow */
+static void drain_queue ( void )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; k < nroots ; ++ k ) {
+    struct root_s * const r = roots + k ;
+
+    while ( r -> qhead && spawn_allowed ( r ) ) {
+      const unsigned int i = r -> qhead - 1 ;
+
+      queue_remove ( i ) ;
+
+      if ( services [ i ] . flagactive && ! services [ i ] . flagquarantine && ! services [ i ] . pid [ 0 ]
+        && ! services [ i ] . fpid [ 0 ] && ! ( services [ i ] . down & 1 ) )
+        launch ( i ) ;
+    }
+  }
+}
+
+/* a restart timer has expired: restart just this one supervisor,
+ * unless its directory has gone away in the meantime, in which
+ * case a scan sorts things out.
+ */
+static void restart ( const unsigned int i, const unsigned int islog )
+{
+  struct stat st ;
+  struct svinfo_s * const sv = services + i ;
+
+  if ( ! sv -> flagactive || sv -> flagquarantine || sv -> pid [ islog ] || sv -> fpid [ islog ] ) { return ; }
+
+  /* until pressure_end () */
+  if ( pressure && ! islog && sv -> flaglowprio ) {
+    sv -> flagdeferred = 1 ;
+    return ;
+  }
+
+  if ( stat ( svdir ( i ), & st ) == -1 || st . st_ino != sv -> ino || st . st_dev != sv -> dev ) {
+    roots [ sv -> root ] . wantscan = 1 ;
+    return ;
+  }
+
+  wantstart ( i, islog ) ;
+}
+
+/* a finish script is done: restart the service if it is due */
+static void finished ( const unsigned int i, const unsigned int islog )
+{
+  struct svinfo_s * const sv = services + i ;
+
+  pidset ( i, islog, 1, 0 ) ;
+  timer_cancel ( i, TIMER_FINISH + islog ) ;
+
+  if ( ! sv -> flagactive || sv -> flagquarantine ) { return ; }
+
+  if ( tain_future ( & sv -> restartafter [ islog ] ) )
+    timer_set ( i, islog, & sv -> restartafter [ islog ] ) ;
+  else
+    restart ( i, islog ) ;
+}
+
+static void run_timers ( void )
+{
+  while ( ntimers && ! tain_future ( & timers [ 0 ] . when ) ) {
+    const unsigned int i = timers [ 0 ] . i ;
+    const unsigned int kind = timers [ 0 ] . kind ;
+
+    timer_cancel ( i, kind ) ;
+
+    switch ( kind ) {
+      case TIMER_SERVICE :
+      case TIMER_LOG :
+        restart ( i, kind ) ;
+        break ;
+      case TIMER_READY :
+        started ( i ) ;
+        break ;
+      case TIMER_FINISH :
+      case TIMER_LOGFINISH :
+        if ( services [ i ] . fpid [ kind - TIMER_FINISH ] )
+          (void) kill ( services [ i ] . fpid [ kind - TIMER_FINISH ], SIGKILL ) ;
+        break ;
+      case TIMER_IDLE :
+        idle ( i ) ;
+        break ;
+      case TIMER_PROBE :
+        probe_timer ( i ) ;
+        break ;
+    }
+  }
+}
+
+/* in-process mode: create and open the supervise/control fifo
+ * of a service (or its logger), like s6-supervise does.
+ */
+static int svcontrol_open ( const unsigned int i, const unsigned int islog )
+{
+  char const * const name = services [ i ] . name ;
+  const size_t namelen = strlen ( name ) ;
+  char fn [ namelen + sizeof ( "/log/supervise/control" ) ] ;
+  char * const s = fn + namelen + ( islog ? 4 : 0 ) ;
+  int fd ;
+
+  memcpy ( fn, name, namelen ) ;
+  memcpy ( fn + namelen, "/log", 4 ) ;
+  memcpy ( s, "/supervise", sizeof ( "/supervise" ) ) ;
+
+  if ( mkdir ( fn, 00700 ) == -1 && EEXIST != errno ) { goto err ; }
+
+  memcpy ( s, "/supervise/control", sizeof ( "/supervise/control" ) ) ;
+
+  if ( mkfifo ( fn, 00600 ) == -1 && EEXIST != errno ) { goto err ; }
+
+  /* opened read-write, so we never see EOF on it */
+  fd = open ( fn, O_RDWR | O_NONBLOCK | O_CLOEXEC ) ;
+
+  if ( 0 > fd ) { goto err ; }
+
+  if ( ev_add ( fd, EV_SVCONTROL, ( i << 1 ) | islog ) < 0 ) {
+    fd_close ( fd ) ;
+    goto err ;
+  }
+
+  return fd ;
+
+err :
+  strerr_warnwu2sys ( "set up control fifo ", fn ) ;
+  return -1 ;
+}
+
+/* the signals s6-svc can have sent, by command letter */
+static const struct { char c ; int sig ; } svsignals [] = {
+  { 'a', SIGALRM },
+  { 'b', SIGABRT },
+  { 'q', SIGQUIT },
+  { 'h', SIGHUP },
+  { 'k', SIGKILL },
+  { 't', SIGTERM },
+  { 'i', SIGINT },
+  { '1', SIGUSR1 },
+  { '2', SIGUSR2 },
+  { 'p', SIGSTOP },
+  { 'c', SIGCONT },
+  { 'y', SIGWINCH },
+  { 0, 0 },
+} ;
+
+static int svsignal ( const char c )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; svsignals [ k ] . c ; ++ k )
+    if ( svsignals [ k ] . c == c ) return svsignals [ k ] . sig ;
+
+  return 0 ;
+}
+
+static char svletter ( const int sig )
+{
+  unsigned int k ;
+
+  for ( k = 0 ; svsignals [ k ] . c ; ++ k )
+    if ( svsignals [ k ] . sig == sig ) return svsignals [ k ] . c ;
+
+  return 0 ;
+}
+
+/* in-process mode: carry out a command s6-svc sends to s6-supervise */
+static void svcommand ( const unsigned int i, const unsigned int islog, const char c )
+{
+  struct svinfo_s * const sv = services + i ;
+  const unsigned int bit = 1u << islog ;
+  int sig = 0 ;
+
+  svdirty ( i ) ;
+
+  switch ( c ) {
+    case 'u' :
+      sv -> down &= ~ bit ;
+      sv -> flagquarantine = 0 ;
+      sv -> fails [ islog ] = 0 ;
+      if ( ! sv -> pid [ islog ] && ! sv -> fpid [ islog ] ) { wantstart ( i, islog ) ; }
+      break ;
+    case 'o' :
+      sv -> down |= bit ;
+      if ( ! sv -> pid [ islog ] && ! sv -> fpid [ islog ] ) { svstart ( i, islog ) ; }
+      break ;
+    case 'd' :
+      sv -> down |= bit ;
+      if ( sv -> pid [ islog ] ) {
+        (void) kill ( sv -> pid [ islog ], SIGTERM ) ;
+        (void) kill ( sv -> pid [ islog ], SIGCONT ) ;
+      }
+      break ;
+    default :
+      sig = svsignal ( c ) ;
+      if ( ! sig ) {
+        char s [ 2 ] = { c, 0 } ;
+        strerr_warnw4x ( "unsupported command for ", sv -> name, ": ", s ) ;
+      } else if ( sv -> pid [ islog ] ) {
+        (void) kill ( sv -> pid [ islog ], sig ) ;
+      }
+      break ;
+  }
+}
+
+/* in-process mode: the commands s6-svc sends to s6-supervise */
+static void handle_svcontrol ( const unsigned int i, const unsigned int islog )
+{
+  struct svinfo_s * const sv = services + i ;
+
+  while ( 1 ) {
+    char buf [ 64 ] ;
+    ssize_t k, r = sanitize_read ( fd_read ( sv -> ctl [ islog ], buf, sizeof ( buf ) ) ) ;
+
+    if ( 0 >= r ) {
+      if ( 0 > r ) { strerr_warnwu2sys ( "read control fifo of ", sv -> name ) ; }
+      return ;
+    }
+
+    for ( k = 0 ; k < r ; ++ k ) { svcommand ( i, islog, buf [ k ] ) ; }
+  }
+}
+
+/* read the per-service settings, called once for a new service */
+/* keep ndeps NUL terminated names of services to wait for */
+static void setdeps ( const unsigned int i, char const * deps, const size_t len, const unsigned int ndeps )
+{
+  struct svinfo_s * const sv = services + i ;
+
+  if ( ! ndeps ) { return ; }
+
+  sv -> deps = malloc ( len ) ;
+  sv -> depidx = calloc ( ndeps, sizeof ( unsigned int ) ) ;
+
+  if ( ! sv -> deps || ! sv -> depidx ) {
+    strerr_warnwu2sys ( "store dependencies of ", sv -> name ) ;
+    free ( sv -> deps ) ;
+    free ( sv -> depidx ) ;
+    sv -> deps = NULL ;
+    sv -> depidx = NULL ;
+    return ;
+  }
+
+  memcpy ( sv -> deps, deps, len ) ;
+  sv -> ndeps = ndeps ;
+}
+
+/* the settings of a service, from its database entry */
+static void loadconf_db ( const unsigned int i, struct s2db_ent_s const * e )
+{
+  struct svinfo_s * const sv = services + i ;
+  char const * deps = s2db_str ( db, e -> deps ) ;
+  size_t len = 0 ;
+  unsigned int k ;
+
+  sv -> delaymax = ( S2DB_UNSET != e -> delaymax ) ? e -> delaymax : RESTART_DELAY_MAX ;
+  sv -> resetafter = ( S2DB_UNSET != e -> resetafter ) ? e -> resetafter : RESTART_RESET ;
+  sv -> limit = ( S2DB_UNSET != e -> limit ) ? e -> limit : 0 ;
+  sv -> window = ( S2DB_UNSET != e -> window ) ? e -> window : 0 ;
+  sv -> flagcritical = !! ( e -> flags & S2DB_CRITICAL ) ;
+  sv -> flaglowprio = !! ( e -> flags & S2DB_LOWPRIO ) ;
+  sv -> flagshed = !! ( e -> flags & S2DB_SHED ) ;
+  sv -> flagidleclass = !! ( e -> flags & S2DB_IDLE ) ;
+  sv -> notifyfd = ( S2DB_UNSET != e -> notifyfd ) ? e -> notifyfd : 0 ;
+  if ( e -> flags & S2DB_TUNE ) { tune_load ( i ) ; }
+
+  if ( sv -> notifyfd && sv -> notifyfd < 3 ) {
+    strerr_warnw2x ( "invalid notification-fd setting for ", sv -> name ) ;
+    sv -> notifyfd = 0 ;
+  }
+
+  for ( k = 0 ; k < e -> ndeps ; ++ k ) { len += strlen ( deps + len ) + 1 ; }
+  setdeps ( i, deps, len, e -> ndeps ) ;
+}
+
+/* an instance: the settings of its template, the dependencies and
+ * scheduling settings shared rather than copied
+ */
+static void loadconf_inst ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  struct svinfo_s const * const t = services + sv -> tpl - 1 ;
+
+  sv -> delaymax = t -> delaymax ;
+  sv -> resetafter = t -> resetafter ;
+  sv -> limit = t -> limit ;
+  sv -> window = t -> window ;
+  sv -> flagcritical = t -> flagcritical ;
+  sv -> flaglowprio = t -> flaglowprio ;
+  sv -> flagshed = t -> flagshed ;
+  sv -> flagidleclass = t -> flagidleclass ;
+  sv -> notifyfd = t -> notifyfd ;
+  sv -> tune = t -> tune ;
+  sv -> deps = t -> deps ;
+  sv -> depidx = t -> depidx ;
+  sv -> ndeps = t -> ndeps ;
+}
+
+static void loadconf ( const unsigned int i )
+{
+  struct svinfo_s * const sv = services + i ;
+  char const * const name = sv -> name ;
+  char buf [ 64 ] ;
+
+  if ( sv -> tpl ) {
+    loadconf_inst ( i ) ;
+    return ;
+  }
+
+  if ( db ) {
+    struct s2db_ent_s const * const e = s2db_find ( db, name ) ;
+
+    if ( e ) {
+      loadconf_db ( i, e ) ;
+      return ;
+    }
+  }
+
+  sv -> delaymax = svfile_uint ( name, "restart-delay-max", RESTART_DELAY_MAX ) ;
+  sv -> resetafter = svfile_uint ( name, "restart-reset", RESTART_RESET ) ;
+  sv -> limit = sv -> window = 0 ;
+  sv -> flagcritical = svfile_exists ( name, "critical" ) ;
+  sv -> flaglowprio = svfile_exists ( name, "low-priority" ) ;
+  sv -> flagshed = svfile_exists ( name, "sheddable" ) ;
+  sv -> flagidleclass = 0 ;
+  tune_load ( i ) ;
+
+  /* "start-class" holds "boot" (the default) or "idle" */
+  if ( 0 < svfile_read ( name, "start-class", buf, sizeof ( buf ) ) ) {
+    const size_t k = strcspn ( buf, " \t\n" ) ;
+
+    if ( 4 == k && ! memcmp ( buf, "idle", 4 ) ) { sv -> flagidleclass = 1 ; }
+    else if ( 4 != k || memcmp ( buf, "boot", 4 ) ) { strerr_warnw2x ( "invalid start-class setting for ", name ) ; }
+  }
+
+  /* "restart-limit" holds "N SECS": quarantine after N restarts in SECS seconds */
+  if ( 0 < svfile_read ( name, "restart-limit", buf, sizeof ( buf ) ) ) {
+    size_t k = uint_scan ( buf, & sv -> limit ) ;
+
+    while ( k && ( ' ' == buf [ k ] || '\t' == buf [ k ] ) ) { ++ k ; }
+
+    if ( ! k || ! uint_scan ( buf + k, & sv -> window ) ) {
+      strerr_warnw2x ( "invalid restart-limit setting for ", name ) ;
+      sv -> limit = sv -> window = 0 ;
+    }
+  }
+
+  sv -> notifyfd = svfile_uint ( name, "notification-fd", 0 ) ;
+
+  if ( sv -> notifyfd && sv -> notifyfd < 3 ) {
+    strerr_warnw2x ( "invalid notification-fd setting for ", name ) ;
+    sv -> notifyfd = 0 ;
+  }
+
+  /* "dependencies" holds the names of the services to wait for */
+  {
+    char deps [ DEPS_MAX ] ;
+    size_t k = 0, len = 0 ;
+    unsigned int ndeps = 0 ;
+
+    if ( 0 >= svfile_read ( name, "dependencies", deps, sizeof ( deps ) ) ) { return ; }
+
+    /* pack the names in place, NUL terminated */
+    while ( deps [ k ] ) {
+      size_t l, next ;
+
+      while ( deps [ k ] == ' ' || deps [ k ] == '\t' || deps [ k ] == '\n' ) { ++ k ; }
+      for ( l = k ; deps [ l ] && deps [ l ] != ' ' && deps [ l ] != '\t' && deps [ l ] != '\n' ; ++ l ) ;
+      if ( l == k ) { break ; }
+      next = deps [ l ] ? l + 1 : l ;
+
+      if ( deps [ k ] == '.' || memchr ( deps + k, '/', l - k ) || ( l - k == strlen ( name ) && ! memcmp ( deps + k, name, l - k ) ) ) {
+        strerr_warnw2x ( "invalid dependencies setting for ", name ) ;
+      } else {
+        memmove ( deps + len, deps + k, l - k ) ;
+        len += l - k ;
+        deps [ len ++ ] = 0 ;
+        ++ ndeps ;
+      }
+
+      k = next ;
+    }
+
+    setdeps ( i, deps, len, ndeps ) ;
+  }
+}
+
+/* the settings of a known service changed in the database */
+static void reconf ( const unsigned int i )
+{
+  unsigned int j ;
+
+  free ( services [ i ] . deps ) ;
+  free ( services [ i ] . depidx ) ;
+  services [ i ] . deps = NULL ;
+  services [ i ] . depidx = NULL ;
+  services [ i ] . ndeps = 0 ;
+  services [ i ] . flagdepwarn = 0 ;
+  tune_free ( i ) ;
+  probe_close ( i ) ;
+  loadconf ( i ) ;
+  probe_open ( i ) ;
+  svdirty ( i ) ;
+  wantdeps = 1 ;
+
+  /* what the instances of a template share went with it */
+  for ( j = 0 ; services [ i ] . ninst && j < n ; ++ j ) {
+    if ( services [ j ] . flagused && services [ j ] . tpl == i + 1 ) {
+      services [ j ] . flagdepwarn = 0 ;
+      loadconf ( j ) ;
+      svdirty ( j ) ;
+    }
+  }
+}
+
+/* Scan roots.
+   Besides the scan directory, stage2 scans the directories listed in
+   ROOTS_FILE, one per line:
+     path [ timeout=ms ] [ max=services ] [ rate=r ] [ burst=b ] [ kill=keep|term|all ]
+   timeout, max, rate and burst are what -t, -c, -r and -b are for the
+   scan directory, and default to them. kill says what becomes of a
+   service whose directory is gone: it runs until a prune ('n', 'N'),
+   or it gets what 'n' or 'N' send at once. every root is rescanned on
+   its own deadline, so a directory of short-lived jobs can churn
+   without the others being looked at. the services of a root are
+   named path/entry, path relative to the scan directory (which skips
+   it) unless absolute. */
+
+static char rootsbuf [ ROOTS_CONF ] ;
+
+/* the root a service name belongs to: the one with the longest path
+ * it starts with, 0 for the scan directory */
+static unsigned int rootof ( char const * name )
+{
+  unsigned int k, best = 0 ;
+
+  for ( k = 1 ; k < nroots ; ++ k ) {
+    if ( ! strncmp ( name, roots [ k ] . path, roots [ k ] . len ) && '/' == name [ roots [ k ] . len ]
+      && roots [ k ] . len > roots [ best ] . len ) { best = k ; }
+  }
+
+  return best ;
+}
+
+/* is the entry name of the scan directory where a root lives ? */
+static int rootdir ( char const * name )
+{
+  const size_t len = strlen ( name ) ;
+  unsigned int k ;
+
+  for ( k = 1 ; k < nroots ; ++ k ) {
+    if ( ! strncmp ( roots [ k ] . path, name, len ) && ( ! roots [ k ] . path [ len ] || '/' == roots [ k ] . path [ len ] ) ) { return 1 ; }
+  }
+
+  return 0 ;
+}
+
+/* no component of a root path is empty or starts with a dot */
+static int rootpath_ok ( char const * s )
+{
+  if ( '/' == * s ) { ++ s ; }
+
+  while ( 1 ) {
+    if ( ! * s || '/' == * s || '.' == * s ) { return 0 ; }
+    s += strcspn ( s, "/" ) ;
+    if ( ! * s ) { return 1 ; }
+    ++ s ;
+  }
+}
+
+/* read ROOTS_FILE. the table grows by the capacity of every root. */
+static void roots_load ( void )
+{
+  char * s = rootsbuf ;
+  const ssize_t r = openreadnclose ( ROOTS_FILE, rootsbuf, sizeof ( rootsbuf ) - 1 ) ;
+
+  if ( 0 > r ) {
+    if ( ENOENT != errno ) { strerr_warnwu2sys ( "read ", ROOTS_FILE ) ; }
+    return ;
+  }
+
+  rootsbuf [ r ] = 0 ;
+
+  while ( * s ) {
+    struct root_s * const rt = roots + nroots ;
+    char * line = s, * p ;
+    size_t len ;
+    int ok = 1 ;
+
+    len = strcspn ( s, "\n" ) ;
+    s += len ;
+    if ( * s ) { * s ++ = 0 ; }
+
+    while ( ' ' == * line || '\t' == * line ) { ++ line ; }
+    if ( ! * line || '#' == * line ) { continue ; }
+
+    if ( ROOT_MAX == nroots ) {
+      strerr_warnw2x ( "too many scan roots in ", ROOTS_FILE ) ;
+      break ;
+    }
+
+    len = strcspn ( line, " \t" ) ;
+    p = line + len ;
+    if ( * p ) { * p ++ = 0 ; }
+    while ( 1 < len && '/' == line [ len - 1 ] ) { line [ -- len ] = 0 ; }
+
+    if ( ! rootpath_ok ( line ) ) {
+      strerr_warnw3x ( "ignoring scan root ", line, ": invalid path" ) ;
+      continue ;
+    }
+
+    memset ( rt, 0, sizeof ( * rt ) ) ;
+    rt -> path = line ;
+    rt -> len = len ;
+    rt -> timeout = roots [ 0 ] . timeout ;
+    rt -> max = roots [ 0 ] . max ;
+    rt -> ratelimit = roots [ 0 ] . ratelimit ;
+    rt -> burst = roots [ 0 ] . burst ;
+
+    while ( ok && * p ) {
+      const size_t m = strcspn ( p, " \t" ) ;
+      char * const next = p [ m ] ? p + m + 1 : p + m ;
+      unsigned int u ;
+
+      p [ m ] = 0 ;
+
+      if ( ! m ) ;
+      else if ( ! strncmp ( p, "timeout=", 8 ) && uint0_scan ( p + 8, & u ) ) {
+        if ( u ) tain_from_millisecs ( & rt -> timeout, u ) ;
+        else rt -> timeout = tain_infinite_relative ;
+      }
+      else if ( ! strncmp ( p, "max=", 4 ) && uint0_scan ( p + 4, & u ) && u ) { rt -> max = u ; }
+      else if ( ! strncmp ( p, "rate=", 5 ) && uint0_scan ( p + 5, & u ) ) { rt -> ratelimit = u ; }
+      else if ( ! strncmp ( p, "burst=", 6 ) && uint0_scan ( p + 6, & u ) ) { rt -> burst = u ? u : 1 ; }
+      else if ( ! strcmp ( p, "kill=keep" ) ) { rt -> kill = 0 ; }
+      else if ( ! strcmp ( p, "kill=term" ) ) { rt -> kill = 2 ; }
+      else if ( ! strcmp ( p, "kill=all" ) ) { rt -> kill = 6 ; }
+      else {
+        strerr_warnw4x ( "ignoring scan root ", line, ": invalid setting ", p ) ;
+        ok = 0 ;
+      }
+
+      p = next ;
+    }
+
+    if ( ! ok ) { continue ; }
+
+    {
+      unsigned int k ;
+
+      for ( k = 1 ; k < nroots && strcmp ( roots [ k ] . path, line ) ; ++ k ) ;
+
+      if ( k < nroots ) {
+        strerr_warnw3x ( "ignoring scan root ", line, ": listed twice" ) ;
+        continue ;
+      }
+    }
+
+    max += rt -> max ;
+    ++ nroots ;
+  }
+}
+
+/* the slot of the directory dev/ino, n if there is none. nothing
+ * keeps the directory of a service that is down from being removed
+ * and its inode reused by a new one: then only the same name matches.
+ */
+static unsigned int svfind ( char const * name, const dev_t dev, const ino_t ino )
+{
+  unsigned int i = 0 ;
+
+  for ( ; i < n ; ++ i )
+    if ( services [ i ] . flagused && ! services [ i ] . tpl && services [ i ] . ino == ino && services [ i ] . dev == dev
+      && ( services [ i ] . pid [ 0 ] || services [ i ] . fpid [ 0 ] || ! strcmp ( services [ i ] . name, name ) ) ) break ;
+
+  return i ;
+}
+
+/* a service found again or for the first time: start what is due */
+static void svactivate ( const unsigned int i )
+{
+  services[i].flagactive = 1 ;
+  svdirty ( i ) ;
+
+  if ( services [ i ] . flagquarantine ) return ;
+
+  if ( services [ i ] . flaglog && ! logmux && ! services [ i ] . pid [ 1 ] && ! services [ i ] . fpid [ 1 ] ) {
+    if ( ! tain_future( & services [ i ] . restartafter [ 1 ] ) )
+      wantstart ( i, 1 ) ;
+    else timer_set ( i, TIMER_LOG, & services [ i ] . restartafter [ 1 ] ) ;
+  }
+
+  if ( ! services[i].pid[0] && ! services[i].fpid[0]) {
+    if (!tain_future(&services[i].restartafter[0]))
+      wantstart ( i, 0 ) ;
+    else timer_set ( i, TIMER_SERVICE, & services [ i ] . restartafter [ 0 ] ) ;
+  }
+}
+
+/* the slot of the instance inst of the template t, created if needed
+ * (dynamic: by a control request). returns -1 if it cannot be.
+ */
+static int instance ( const unsigned int t, char const * inst, const int dynamic )
+{
+  char const * const tname = services [ t ] . name ;
+  const size_t tlen = strlen ( tname ), ilen = strlen ( inst ) ;
+  char name [ tlen + ilen + 1 ] ;
+  unsigned int i ;
+
+  if ( ! ilen || '.' == inst [ 0 ] || strchr ( inst, '/' ) || NAME_MAX < tlen + ilen ) {
+    strerr_warnw4x ( "invalid instance name for ", tname, ": ", inst ) ;
+    return -1 ;
+  }
+
+  memcpy ( name, tname, tlen ) ;
+  memcpy ( name + tlen, inst, ilen + 1 ) ;
+
+  for ( i = 0 ; i < n ; ++ i )
+    if ( services [ i ] . flagused && ! strcmp ( services [ i ] . name, name ) ) break ;
+
+  if ( i < n ) {
+    if ( services [ i ] . tpl != t + 1 ) {
+      strerr_warnw3x ( "instance ", name, " clashes with a service directory" ) ;
+      return -1 ;
+    }
+
+    if ( dynamic ) { services [ i ] . flagdynamic = 1 ; }
+    return i ;
+  }
+
+  if ( nused >= max || roots [ services [ t ] . root ] . nused >= roots [ services [ t ] . root ] . max ) {
+    strerr_warnwu3x ( "start ", name, ": too many services" ) ;
+    return -1 ;
+  }
+
+  for ( i = 0 ; i < n && services [ i ] . flagused ; ++ i ) ;
+  memset ( & services [ i ], 0, sizeof ( struct svinfo_s ) ) ;
+  services [ i ] . ctl [ 0 ] = services [ i ] . ctl [ 1 ] = services [ i ] . nfd = -1 ;
+  services [ i ] . pidfd [ 0 ] = services [ i ] . pidfd [ 1 ] = -1 ;
+  services [ i ] . wstat [ 0 ] = services [ i ] . wstat [ 1 ] = -1 ;
+  services [ i ] . p [ 0 ] = services [ i ] . p [ 1 ] = -1 ;
+
+  if ( services [ t ] . flaglog && pipecoe ( services [ i ] . p ) < 0 ) {
+    strerr_warnwu1sys ( "pipecoe" ) ;
+    return -1 ;
+  }
+
+  services [ i ] . name = strdup ( name ) ;
+  if ( ! services [ i ] . name ) {
+    strerr_warnwu2sys ( "store name of ", name ) ;
+    if ( services [ t ] . flaglog ) {
+      fd_close ( services [ i ] . p [ 1 ] ) ;
+      fd_close ( services [ i ] . p [ 0 ] ) ;
+    }
+    return -1 ;
+  }
+
+  services [ i ] . tpl = t + 1 ;
+  services [ i ] . root = services [ t ] . root ;
+  services [ i ] . flagdynamic = !! dynamic ;
+  services [ i ] . flaglog = services [ t ] . flaglog ;
+  services [ i ] . dev = services [ t ] . dev ;
+  services [ i ] . ino = services [ t ] . ino ;
+  tain_copynow ( & services [ i ] . restartafter [ 0 ] ) ;
+  tain_copynow ( & services [ i ] . restartafter [ 1 ] ) ;
+  services [ i ] . windowstart = STAMP ;
+  services [ i ] . flagused = 1 ;
+  ++ services [ t ] . ninst ;
+  loadconf ( i ) ;
+  if ( logmux && services [ i ] . flaglog && logmux_open ( i ) < 0 )
+    strerr_warnwu2sys ( "set up log multiplexing for ", name ) ;
+  if ( svfile_exists ( tname, "down" ) ) { services [ i ] . down |= 1 ; }
+  if ( services [ i ] . flaglog && ! logmux && svfile_exists ( tname, "log/down" ) ) { services [ i ] . down |= 2 ; }
+  ++ nused ;
+  ++ roots [ services [ i ] . root ] . nused ;
+  if ( i == n ) { ++ n ; }
+  event ( S2EV_ADD, 0, i, 0, 0 ) ;
+
+  return i ;
+}
+
+static void inst_activate ( const unsigned int i )
+{
+  /* See BLACK MAGIC above. */
+  if ( services [ i ] . flaglog && services [ i ] . p [ 0 ] < 0 ) {
+    services [ i ] . p [ 0 ] = -2 ;
+    return ;
+  }
+
+  svactivate ( i ) ;
+}
+
+/* a template: its instances are those listed in its instances file
+ * (one name per line) and those created by control requests
+ */
+static void instances ( const unsigned int t )
+{
+  char buf [ 4096 ] ;
+  unsigned int i ;
+  size_t k = 0 ;
+
+  services [ t ] . flagactive = 1 ;
+
+  /* stage2 runs ./run with the instance as argument, s6-supervise cannot */
+  if ( ! inproc ) { return ; }
+
+  if ( 0 < svfile_read ( services [ t ] . name, "instances", buf, sizeof ( buf ) ) ) {
+    while ( buf [ k ] ) {
+      size_t l ;
+      int j ;
+
+      while ( buf [ k ] == ' ' || buf [ k ] == '\t' || buf [ k ] == '\n' ) { ++ k ; }
+      for ( l = k ; buf [ l ] && buf [ l ] != ' ' && buf [ l ] != '\t' && buf [ l ] != '\n' ; ++ l ) ;
+      if ( l == k ) { break ; }
+
+      {
+        const char c = buf [ l ] ;
+
+        buf [ l ] = 0 ;
+        j = instance ( t, buf + k, 0 ) ;
+        if ( 0 <= j ) { inst_activate ( j ) ; }
+        buf [ l ] = c ;
+      }
+
+      k = l ;
+    }
+  }
+
+  for ( i = 0 ; i < n ; ++ i )
+    if ( services [ i ] . flagused && services [ i ] . tpl == t + 1 && services [ i ] . flagdynamic && ! services [ i ] . flagactive )
+      inst_activate ( i ) ;
+}
+
+/* a start request for name@inst, with no such service yet */
+static int instance_new ( char const * name )
+{
+  char const * const at = strchr ( name, '@' ) ;
+  unsigned int t ;
+  int i ;
+
+  if ( ! inproc || ! at || ! at [ 1 ] ) { return -1 ; }
+
+  for ( t = 0 ; t < n ; ++ t ) {
+    if ( services [ t ] . flagused && services [ t ] . flagtemplate && services [ t ] . flagactive
+      && ! strncmp ( services [ t ] . name, name, at + 1 - name ) && ! services [ t ] . name [ at + 1 - name ] ) break ;
+  }
+
+  if ( t == n ) { return -1 ; }
+
+  i = instance ( t, at + 1, 1 ) ;
+  if ( 0 > i ) { return -1 ; }
+
+  services [ i ] . down &= ~ 1u ;
+  inst_activate ( i ) ;
+
+  return i ;
+}
+
+/* a service directory, found by scan () or in the database (e).
+ * haslog tells whether name/log is a directory, -1 to find out.
+ */
+static void checkdir ( char const * name, const dev_t dev, const ino_t ino, int haslog, struct s2db_ent_s const * e, const int changed )
+{
+  size_t namelen ;
+  unsigned int i ;
+
+  namelen = strlen(name) ;
+
+  i = svfind(name, dev, ino) ;
+
+  if ( i < n ) {
+    if ( e && changed ) reconf ( i ) ;
+    if ( services [ i ] . flagtemplate ) {
+      instances ( i ) ;
+      return ;
+    }
+    if (services[i].flaglog && (services[i].p[0] < 0)) {
+     /* See BLACK MAGIC above. */
+      services[i].p[0] = -2 ;
+      return ;
+    }
+  } else {
+    const unsigned int root = rootof(name) ;
+    if (nused >= max || roots[root].nused >= roots[root].max) {
+      strerr_warnwu3x("start supervisor for ", name, ": too many services") ;
+      return ;
+    } else {
+      struct stat su ;
+      char tmp[namelen + 5] ;
+      const int istemplate = namelen > 1 && name[namelen - 1] == '@' ;
+      for (i = 0 ; i < n && services[i].flagused ; i++) ;
+      memset(&services[i], 0, sizeof(struct svinfo_s)) ;
+      services[i].ctl[0] = services[i].ctl[1] = services[i].nfd = -1 ;
+      services[i].pidfd[0] = services[i].pidfd[1] = -1 ;
+      services[i].wstat[0] = services[i].wstat[1] = -1 ;
+      memcpy(tmp, name, namelen) ;
+      memcpy(tmp + namelen, "/log", 5) ;
+      if (e) haslog = !!(e->flags & S2DB_LOG) ;
+      else if (haslog >= 0) ;
+      else if (stat(tmp, &su) < 0)
+        if (errno == ENOENT) haslog = 0 ;
+        else {
+          strerr_warnwu2sys("stat ", tmp) ;
+          retrydirlater() ;
+          return ;
+        }
+      else haslog = S_ISDIR(su.st_mode) ;
+      if (istemplate) ;
+      else if (haslog && pipecoe(services[i].p) < 0) {
+        strerr_warnwu1sys("pipecoe") ;
+        retrydirlater() ;
+        return ;
+      }
+      services[i].flaglog = haslog ;
+      services[i].name = strdup(name) ;
+      if (!services[i].name) {
+        strerr_warnwu2sys("store name of ", name) ;
+        if (services[i].flaglog && !istemplate) {
+          fd_close(services[i].p[1]) ; services[i].p[1] = -1 ;
+          fd_close(services[i].p[0]) ; services[i].p[0] = -1 ;
+        }
+        retrydirlater() ;
+        return ;
+      }
+      services[i].ino = ino ;
+      services[i].dev = dev ;
+      services[i].root = root ;
+      if (istemplate) {
+        services[i].p[0] = services[i].p[1] = -1 ;
+        services[i].flagtemplate = 1 ;
+        services[i].flagused = 1 ;
+        loadconf(i) ;
+        ++ nused ;
+        ++ roots[root].nused ;
+        if (i == n) ++ n ;
+        event(S2EV_ADD, 0, i, 0, 0) ;
+        if (!inproc) strerr_warnw3x("ignoring template ", name, ": templates need -I") ;
+        instances(i) ;
+        return ;
+      }
+      tain_copynow(&services[i].restartafter[0]) ;
+      tain_copynow(&services[i].restartafter[1]) ;
+      services[i].windowstart = STAMP ;
+      services[i].flagused = 1 ;
+      adopt(i) ;
+      loadconf(i) ;
+      if (!e || (e->flags & S2DB_LISTEN)) sockets_open(i) ;
+      if (!e || (e->flags & S2DB_PROBE)) probe_open(i) ;
+      if (!inproc && services[i].notifyfd) notify_subscribe(i) ;
+      if (logmux && services[i].flaglog && logmux_open(i) < 0)
+        strerr_warnwu2sys("set up log multiplexing for ", name) ;
+      if (inproc) {
+        services[i].ctl[0] = svcontrol_open(i, 0) ;
+        if (e ? !!(e->flags & S2DB_DOWN) : svfile_exists(name, "down")) services[i].down |= 1 ;
+        if (services[i].flaglog && !logmux) {
+          services[i].ctl[1] = svcontrol_open(i, 1) ;
+          if (e ? !!(e->flags & S2DB_LOGDOWN) : svfile_exists(tmp, "down")) services[i].down |= 2 ;
+        }
+      }
+      ++ nused ;
+      ++ roots[root].nused ;
+      if (i == n) ++ n ;
+      event(S2EV_ADD, 0, i, 0, 0) ;
+    }
+  }
+  
+  svactivate ( i ) ;
+}
+
+static void check ( char const * name )
+{
+  struct stat st ;
+
+  if (name[0] == '.') return ;
+
+  if (stat(name, &st) == -1) {
+    strerr_warnwu2sys("stat ", name) ;
+    retrydirlater() ;
+    return ;
+  }
+
+  if ( ! S_ISDIR( st . st_mode ) ) return ;
+
+  checkdir ( name, st . st_dev, st . st_ino, -1, NULL, 0 ) ;
+}
+
+#ifdef SCAN_URING
+/* a full scan submits the statx () calls for a batch of directory
+ * entries at once, and those for name/log of the new ones in a second
+ * batch: one wait per batch instead of one per entry. the ring is set
+ * up at the first scan; without it (an old kernel, io_uring disabled)
+ * check () stats entry by entry.
+ */
+struct scanent_s {
+  struct statx st ;
+  struct statx lst ;
+  char name [ NAME_MAX + 1 ] ;
+  char log [ NAME_MAX + 5 ] ;
+  int res ;
+  int lres ;
+} ;
+
+static struct {
+  /* -1 before the first scan, -2 when unusable */
+  int fd ;
+  unsigned int tail ;
+  unsigned int sqmask ;
+  unsigned int cqmask ;
+  unsigned int * sqtail ;
+  unsigned int * sqarray ;
+  unsigned int * cqhead ;
+  unsigned int * cqtail ;
+  struct io_uring_sqe * sqes ;
+  struct io_uring_cqe * cqes ;
+  struct scanent_s * ent ;
+  unsigned int nent ;
+  /* the mappings, for ring_drop () */
+  char * sq ;
+  char * cq ;
+  size_t sqlen ;
+  size_t cqlen ;
+  size_t sqeslen ;
+} ring = { .fd = -1 } ;
+
+/* give up on the ring. the kernel may still write the results of
+ * requests in flight to the entries: then they stay allocated.
+ */
+static void ring_drop ( const int inflight )
+{
+  (void) munmap ( ring . sqes, ring . sqeslen ) ;
+  if ( ring . cq != ring . sq ) { (void) munmap ( ring . cq, ring . cqlen ) ; }
+  (void) munmap ( ring . sq, ring . sqlen ) ;
+  fd_close ( ring . fd ) ;
+  if ( ! inflight ) { free ( ring . ent ) ; }
+  ring . ent = NULL ;
+  ring . fd = -2 ;
+}
+
+static int ring_setup ( void )
+{
+  struct io_uring_params p ;
+  size_t sqlen, cqlen, sqeslen ;
+  char * sq = MAP_FAILED, * cq = MAP_FAILED ;
+  void * sqes = MAP_FAILED ;
+  int fd ;
+
+  memset ( & p, 0, sizeof ( p ) ) ;
+  fd = syscall ( SYS_io_uring_setup, SCAN_BATCH, & p ) ;
+  if ( 0 > fd ) { return -1 ; }
+  (void) coe ( fd ) ;
+
+  sqlen = p . sq_off . array + p . sq_entries * sizeof ( unsigned int ) ;
+  cqlen = p . cq_off . cqes + p . cq_entries * sizeof ( struct io_uring_cqe ) ;
+  sqeslen = p . sq_entries * sizeof ( struct io_uring_sqe ) ;
+  if ( ( p . features & IORING_FEAT_SINGLE_MMAP ) && cqlen > sqlen ) { sqlen = cqlen ; }
+
+  sq = mmap ( NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING ) ;
+  if ( MAP_FAILED == sq ) { goto err ; }
+
+  cq = ( p . features & IORING_FEAT_SINGLE_MMAP ) ? sq
+    : mmap ( NULL, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING ) ;
+  if ( MAP_FAILED == cq ) { goto err ; }
+
+  sqes = mmap ( NULL, sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES ) ;
+  if ( MAP_FAILED == sqes ) { goto err ; }
+
+  ring . ent = malloc ( SCAN_BATCH * sizeof ( struct scanent_s ) ) ;
+  if ( ! ring . ent ) { goto err ; }
+
+  ring . fd = fd ;
+  ring . sqmask = * (unsigned int *) ( sq + p . sq_off . ring_mask ) ;
+  ring . sqtail = (unsigned int *) ( sq + p . sq_off . tail ) ;
+  ring . sqarray = (unsigned int *) ( sq + p . sq_off . array ) ;
+  ring . tail = * ring . sqtail ;
+  ring . cqmask = * (unsigned int *) ( cq + p . cq_off . ring_mask ) ;
+  ring . cqhead = (unsigned int *) ( cq + p . cq_off . head ) ;
+  ring . cqtail = (unsigned int *) ( cq + p . cq_off . tail ) ;
+  ring . cqes = (struct io_uring_cqe *) ( cq + p . cq_off . cqes ) ;
+  ring . sqes = sqes ;
+  ring . sq = sq ;
+  ring . cq = cq ;
+  ring . sqlen = sqlen ;
+  ring . cqlen = cqlen ;
+  ring . sqeslen = sqeslen ;
+
+  return 0 ;
+
+err :
+  if ( MAP_FAILED != sqes ) { (void) munmap ( sqes, sqeslen ) ; }
+  if ( MAP_FAILED != cq && cq != sq ) { (void) munmap ( cq, cqlen ) ; }
+  if ( MAP_FAILED != sq ) { (void) munmap ( sq, sqlen ) ; }
+  fd_close ( fd ) ;
+  return -1 ;
+}
+
+/* only what checkdir () needs, and no sync on network filesystems */
+static void ring_statx ( char const * path, struct statx * st, const unsigned int k )
+{
+  const unsigned int idx = ring . tail & ring . sqmask ;
+  struct io_uring_sqe * const sqe = ring . sqes + idx ;
+
+  memset ( sqe, 0, sizeof ( * sqe ) ) ;
+  sqe -> opcode = IORING_OP_STATX ;
+  sqe -> fd = AT_FDCWD ;
+  sqe -> addr = (uintptr_t) path ;
+  sqe -> len = STATX_TYPE | STATX_INO ;
+  sqe -> off = (uintptr_t) st ;
+  sqe -> statx_flags = AT_STATX_DONT_SYNC ;
+  sqe -> user_data = k ;
+  ring . sqarray [ idx ] = idx ;
+  ++ ring . tail ;
+}
+
+/* submit the count queued requests and wait for them all, results in
+ * res or lres of the entries (user_data is the entry, which for the
+ * name/log batch is not below count). normally one system call.
+ * returns -1 if the wait failed, requests may still be in flight.
+ */
+static int ring_run ( const unsigned int count, const int islog )
+{
+  unsigned int sub = 0, done = 0 ;
+
+  __atomic_store_n ( ring . sqtail, ring . tail, __ATOMIC_RELEASE ) ;
+
+  while ( done < count ) {
+    unsigned int head = * ring . cqhead ;
+    const unsigned int tail = __atomic_load_n ( ring . cqtail, __ATOMIC_ACQUIRE ) ;
+
+    for ( ; head != tail ; ++ head, ++ done ) {
+      struct io_uring_cqe const * const cqe = ring . cqes + ( head & ring . cqmask ) ;
+
+      if ( cqe -> user_data < SCAN_BATCH ) {
+        if ( islog ) { ring . ent [ cqe -> user_data ] . lres = cqe -> res ; }
+        else { ring . ent [ cqe -> user_data ] . res = cqe -> res ; }
+      }
+    }
+
+    __atomic_store_n ( ring . cqhead, head, __ATOMIC_RELEASE ) ;
+
+    if ( done < count ) {
+      const int r = syscall ( SYS_io_uring_enter, ring . fd, count - sub, count - done, IORING_ENTER_GETEVENTS, NULL, 0 ) ;
+
+      if ( 0 > r ) {
+        if ( EINTR == errno ) { continue ; }
+        strerr_warnwu1sys ( "wait for io_uring, scanning without it" ) ;
+        return -1 ;
+      }
+
+      sub += r ;
+    }
+  }
+
+  return 0 ;
+}
+
+/* what check () does, from the results */
+static void ring_check ( struct scanent_s * ent, const int logdone )
+{
+  if ( 0 > ent -> res ) {
+    errno = - ent -> res ;
+    strerr_warnwu2sys ( "stat ", ent -> name ) ;
+    retrydirlater () ;
+    return ;
+  }
+
+  if ( ! S_ISDIR( ent -> st . stx_mode ) ) { return ; }
+
+  {
+    const dev_t dev = makedev ( ent -> st . stx_dev_major, ent -> st . stx_dev_minor ) ;
+    int haslog = -1 ;
+
+    if ( logdone ) {
+      if ( 0 <= ent -> lres ) { haslog = S_ISDIR( ent -> lst . stx_mode ) ; }
+      else if ( -ENOENT == ent -> lres ) { haslog = 0 ; }
+    }
+
+    checkdir ( ent -> name, dev, ent -> st . stx_ino, haslog, NULL, 0 ) ;
+  }
+}
+
+static void ring_flush ( void )
+{
+  const unsigned int count = ring . nent ;
+  unsigned int k, nlog = 0 ;
+  int inflight = 0 ;
+
+  ring . nent = 0 ;
+  if ( ! count ) { return ; }
+
+  for ( k = 0 ; k < count ; ++ k ) { ring_statx ( ring . ent [ k ] . name, & ring . ent [ k ] . st, k ) ; }
+
+  if ( 0 > ring_run ( count, 0 ) ) {
+    inflight = 1 ;
+    goto fallback ;
+  }
+
+  /* an old kernel without IORING_OP_STATX */
+  if ( -EINVAL == ring . ent [ 0 ] . res ) { goto fallback ; }
+
+  /* name/log, for the directories no slot knows */
+  for ( k = 0 ; k < count ; ++ k ) {
+    struct scanent_s * const ent = ring . ent + k ;
+
+    if ( 0 > ent -> res || ! S_ISDIR( ent -> st . stx_mode )
+      || svfind ( ent -> name, makedev ( ent -> st . stx_dev_major, ent -> st . stx_dev_minor ), ent -> st . stx_ino ) < n ) { continue ; }
+
+    memcpy ( ent -> log, ent -> name, strlen ( ent -> name ) ) ;
+    memcpy ( ent -> log + strlen ( ent -> name ), "/log", 5 ) ;
+    ring_statx ( ent -> log, & ent -> lst, k ) ;
+    ++ nlog ;
+  }
+
+  /* on failure checkdir () stats name/log itself */
+  if ( nlog && 0 > ring_run ( nlog, 1 ) ) {
+    nlog = 0 ;
+    inflight = 1 ;
+  }
+
+  for ( k = 0 ; k < count ; ++ k ) { ring_check ( ring . ent + k, 0 < nlog ) ; }
+
+  if ( inflight ) { ring_drop ( 1 ) ; }
+
+  return ;
+
+fallback :
+  for ( k = 0 ; k < count ; ++ k ) { check ( ring . ent [ k ] . name ) ; }
+  ring_drop ( inflight ) ;
+}
+#endif
+
+/* one directory entry of a full scan, not a dot one */
+static void scan_entry ( char const * name )
+{
+#ifdef SCAN_URING
+  if ( -1 == ring . fd && 0 > ring_setup () ) { ring . fd = -2 ; }
+
+  if ( 0 <= ring . fd && strlen ( name ) <= NAME_MAX ) {
+    memcpy ( ring . ent [ ring . nent ] . name, name, strlen ( name ) + 1 ) ;
+    ring . ent [ ring . nent ] . lres = -ENOENT ;
+    if ( SCAN_BATCH == ++ ring . nent ) { ring_flush () ; }
+    return ;
+  }
+#endif
+
+  check ( name ) ;
+}
+
+/* the entries queued by scan_entry () */
+static void scan_flush ( void )
+{
+#ifdef SCAN_URING
+  if ( ring . nent ) { ring_flush () ; }
+#endif
+}
+
+/* the length of the ndeps names at off, 0 if they run past the string table */
+static size_t db_depslen ( struct s2db_hdr_s const * h, const uint32_t off, const uint32_t ndeps )
+{
+  char const * const p = s2db_str ( h, off ) ;
+  size_t len = 0 ;
+  uint32_t k ;
+
+  for ( k = 0 ; k < ndeps ; ++ k ) {
+    if ( off + len >= h -> strsize ) { return 0 ; }
+    len += strlen ( p + len ) + 1 ;
+  }
+
+  return ( off + len <= h -> strsize ) ? len : 0 ;
+}
+
+/* everything stage2 relies on later: offsets inside the string table,
+ * valid names, sorted for s2db_find ()
+ */
+static int db_valid ( struct s2db_hdr_s const * h, const size_t size )
+{
+  uint32_t k ;
+
+  if ( size < sizeof ( * h ) || S2DB_MAGIC != h -> magic || S2DB_VERSION != h -> version
+    || h -> hdrsize < sizeof ( * h ) || h -> entsize < sizeof ( struct s2db_ent_s ) || ! h -> strsize
+    || (uint64_t) h -> hdrsize + (uint64_t) h -> count * h -> entsize + h -> strsize != size ) { return 0 ; }
+
+  if ( s2db_str ( h, h -> strsize - 1 ) [ 0 ] ) { return 0 ; }
+
+  for ( k = 0 ; k < h -> count ; ++ k ) {
+    struct s2db_ent_s const * const e = s2db_ent ( h, k ) ;
+    char const * name ;
+
+    if ( e -> name >= h -> strsize || e -> deps >= h -> strsize ) { return 0 ; }
+
+    name = s2db_str ( h, e -> name ) ;
+    if ( ! name [ 0 ] || '.' == name [ 0 ] || strchr ( name, '/' ) ) { return 0 ; }
+    if ( e -> ndeps && ! db_depslen ( h, e -> deps, e -> ndeps ) ) { return 0 ; }
+    if ( k && strcmp ( s2db_str ( h, s2db_ent ( h, k - 1 ) -> name ), name ) >= 0 ) { return 0 ; }
+  }
+
+  return 1 ;
+}
+
+/* map the database if it was replaced since the last time.
+ * returns 1 if it was, 0 if not, -1 on error (the old one stays).
+ */
+static int db_load ( void )
+{
+  struct stat st ;
+  void * p ;
+  int fd ;
+
+  if ( stat ( dbfn, & st ) < 0 ) {
+    strerr_warnwu2sys ( "stat ", dbfn ) ;
+    return -1 ;
+  }
+
+  /* a size change means it was rewritten in place, which it should not be */
+  if ( db && st . st_dev == dbdev && st . st_ino == dbino && (size_t) st . st_size == dbsize ) { return 0 ; }
+
+  fd = open ( dbfn, O_RDONLY | O_CLOEXEC ) ;
+  if ( 0 > fd ) {
+    strerr_warnwu2sys ( "open ", dbfn ) ;
+    return -1 ;
+  }
+
+  /* the file that was opened, it may have been replaced again */
+  if ( fstat ( fd, & st ) < 0 || (size_t) st . st_size < sizeof ( struct s2db_hdr_s ) ) {
+    fd_close ( fd ) ;
+    strerr_warnw2x ( "invalid service database: ", dbfn ) ;
+    return -1 ;
+  }
+
+  p = mmap ( NULL, st . st_size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+  fd_close ( fd ) ;
+
+  if ( MAP_FAILED == p ) {
+    strerr_warnwu2sys ( "map ", dbfn ) ;
+    return -1 ;
+  }
+
+  if ( ! db_valid ( p, st . st_size ) ) {
+    (void) munmap ( p, st . st_size ) ;
+    strerr_warnw2x ( "invalid service database: ", dbfn ) ;
+    return -1 ;
+  }
+
+  db = p ;
+  dbsize = st . st_size ;
+  dbdev = st . st_dev ;
+  dbino = st . st_ino ;
+
+  return 1 ;
+}
+
+/* whether the entry for the same name in old differs from e */
+static int db_changed ( struct s2db_hdr_s const * old, struct s2db_ent_s const * e )
+{
+  struct s2db_ent_s const * const o = s2db_find ( old, s2db_str ( db, e -> name ) ) ;
+  size_t len ;
+
+  if ( ! o ) { return 1 ; }
+
+  if ( o -> ndeps != e -> ndeps || o -> flags != e -> flags || o -> delaymax != e -> delaymax
+    || o -> resetafter != e -> resetafter || o -> limit != e -> limit || o -> window != e -> window
+    || o -> notifyfd != e -> notifyfd ) { return 1 ; }
+
+  len = e -> ndeps ? db_depslen ( db, e -> deps, e -> ndeps ) : 0 ;
+
+  return len && ( len != db_depslen ( old, o -> deps, o -> ndeps ) || memcmp ( s2db_str ( old, o -> deps ), s2db_str ( db, e -> deps ), len ) ) ;
+}
+
+/* the services are the entries of the database: no directory is read,
+ * and only the entries that changed since the last one are reloaded.
+ * on error the services are left as they are.
+ */
+static int scan_db ( void )
+{
+  struct s2db_hdr_s const * const old = db ;
+  const size_t oldsize = dbsize ;
+  const int r = db_load () ;
+  unsigned int i ;
+  uint32_t k ;
+
+  if ( 0 > r ) {
+    retrydirlater () ;
+    return -1 ;
+  }
+
+  for ( i = 0 ; i < n ; ++ i )
+    if ( ! services [ i ] . root ) services [ i ] . flagactive = 0 ;
+
+  for ( k = 0 ; k < db -> count ; ++ k ) {
+    struct s2db_ent_s const * const e = s2db_ent ( db, k ) ;
+
+    checkdir ( s2db_str ( db, e -> name ), e -> dev, e -> ino, -1, e, 0 < r && ( ! old || db_changed ( old, e ) ) ) ;
+  }
+
+  if ( 0 < r && old ) { (void) munmap ( (void *) old, oldsize ) ; }
+
+  return 0 ;
+}
+
+/* a full scan of root k: the scan directory, or the database, for 0 */
+static void scan_root ( const unsigned int k )
+{
+  struct root_s const * const r = roots + k ;
+  char const * const path = k ? r -> path : "." ;
+  unsigned int i = 0 ;
+
+  if ( ! k && dbfn ) {
+    if ( 0 > scan_db () ) { return ; }
+  } else {
+    DIR * dir = opendir ( path ) ;
+
+    if ( NULL == dir ) {
+      strerr_warnwu2sys ( "opendir ", path ) ;
+      retrydirlater () ;
+      return ;
+    }
+
+    for ( ; i < n ; ++ i )
+      if ( services [ i ] . root == k ) services [ i ] . flagactive = 0 ;
+
+    while ( 1 ) {
+      direntry * d = NULL ;
+
+      errno = 0 ;
+      d = readdir ( dir ) ;
+
+      if ( ! d ) { break ; }
+      else if ( '.' == d -> d_name [ 0 ] || ( ! k && rootdir ( d -> d_name ) ) ) { continue ; }
+      else if ( ! k ) { scan_entry ( d -> d_name ) ; }
+      else {
+        const size_t len = strlen ( d -> d_name ) ;
+        char name [ r -> len + len + 2 ] ;
+
+        memcpy ( name, r -> path, r -> len ) ;
+        name [ r -> len ] = '/' ;
+        memcpy ( name + r -> len + 1, d -> d_name, len + 1 ) ;
+        scan_entry ( name ) ;
+      }
+    }
+
+    if ( errno ) {
+      strerr_warnwu2sys ( "readdir ", path ) ;
+      retrydirlater () ;
+    }
+
+    scan_flush () ;
+
+    dir_close ( dir ) ;
+  }
+
+  for ( i = 0 ; i < n ; ++ i )
+    if ( services [ i ] . flagused && services [ i ] . root == k && ! services [ i ] . flagactive ) {
+      svdirty ( i ) ;
+      if ( r -> kill ) killsv ( i, r -> kill ) ;
+    }
+
+  for ( i = 0 ; i < n ; ++ i )
+    if ( services [ i ] . flagused && services [ i ] . root == k && ! services [ i ] . flagactive && ! services [ i ] . pid [ 0 ]
+      && ! services [ i ] . fpid [ 0 ] && ! services [ i ] . fpid [ 1 ] && ! services [ i ] . ninst ) {
+    if ( services [ i ] . flaglog ) {
+      if ( services [ i ] . pid [ 1 ] ) continue ;
+
+      if ( services [ i ] . p [ 0 ] >= 0 ) closepipe ( i ) ;
+    }
+
+    svfree ( i ) ;
+  }
+}
+
+/* the roots whose deadline passed, or all of them if asked to */
+static void scan ( void )
+{
+  tain_t start ;
+  unsigned int k ;
+  int scanned = 0 ;
+
+  for ( k = 0 ; k < nroots ; ++ k ) {
+    if ( ! wantscan && ! roots [ k ] . wantscan ) { continue ; }
+
+    if ( ! scanned ++ ) {
+      tain_now_g () ;
+      start = STAMP ;
+    }
+
+    roots [ k ] . wantscan = 0 ;
+    tain_add_g ( & roots [ k ] . deadline, & roots [ k ] . timeout ) ;
+    scanroot = k ;
+    scan_root ( k ) ;
+    event ( S2EV_SCAN, 0, S2EV_NOSLOT, k, roots [ k ] . nused ) ;
+  }
+
+  scanroot = 0 ;
+  wantscan = 0 ;
+
+  if ( scanned ) {
+    tain_t d ;
+
+    tain_now_g () ;
+    tain_sub ( & d, & STAMP, & start ) ;
+    scanlast = (uint64_t) d . sec . x * 1000000 + d . nano / 1000 ;
+    scanbusy += scanlast ;
+    ++ nscans ;
+  }
+}
+
+/* Resource accounting.
+   What the reaper learned about dead processes, exported in the
+   Prometheus text format through the control fifo ('m' writes
+   METRICS_FILE) and the control socket. */
+
+static int buf_put ( struct buf_s * b, void const * data, const size_t len )
+{
+  if ( b -> len + len > b -> max ) {
+    size_t m = b -> max ? b -> max : 4096 ;
+    char * p ;
+
+    while ( m < b -> len + len ) { m <<= 1 ; }
+
+    p = realloc ( b -> s, m ) ;
+    if ( ! p ) { return -1 ; }
+
+    b -> s = p ;
+    b -> max = m ;
+  }
+
+  memcpy ( b -> s + b -> len, data, len ) ;
+  b -> len += len ;
+
+  return 0 ;
+}
+
+/* add the usage of a dead process to the totals of its service */
+static void account ( const unsigned int i, const unsigned int islog, const int isfinish, const int wstat, struct rusage const * ru )
+{
+  struct usage_s * const u = services [ i ] . usage + islog ;
+
+  u -> utime += (uint64_t) ru -> ru_utime . tv_sec * 1000000 + ru -> ru_utime . tv_usec ;
+  u -> stime += (uint64_t) ru -> ru_stime . tv_sec * 1000000 + ru -> ru_stime . tv_usec ;
+  u -> majflt += ru -> ru_majflt ;
+  if ( ru -> ru_maxrss > u -> maxrss ) { u -> maxrss = ru -> ru_maxrss ; }
+
+  if ( isfinish ) { return ; }
+
+  if ( WIFSIGNALED( wstat ) ) { ++ u -> signaled ; }
+  else if ( WEXITSTATUS( wstat ) ) { ++ u -> failed ; }
+
+  if ( tain_less ( & services [ i ] . startedat [ islog ], & STAMP ) ) {
+    tain_t d ;
+
+    tain_sub ( & d, & STAMP, & services [ i ] . startedat [ islog ] ) ;
+    u -> uptime += d . sec . x * 1000 + d . nano / 1000000 ;
+  }
+}
+
+enum {
+  METRIC_UP,
+  METRIC_UPTIME,
+  METRIC_RESTARTS,
+  METRIC_FAILURES,
+  METRIC_SIGNALED,
+  METRIC_UTIME,
+  METRIC_STIME,
+  METRIC_MAXRSS,
+  METRIC_MAJFLT,
+  METRIC_LIFETIME,
+  METRIC_COUNT,
+} ;
+
+static const struct { char const * name ; char const * type ; char const * help ; } metricdefs [ METRIC_COUNT ] = {
+  { "stage2_service_up", "gauge", "1 if the process is running" },
+  { "stage2_service_uptime_seconds", "gauge", "seconds since the running process was started" },
+  { "stage2_service_restarts_total", "counter", "deaths of the process" },
+  { "stage2_service_failures_total", "counter", "deaths with a nonzero exit code" },
+  { "stage2_service_signaled_total", "counter", "deaths by a signal" },
+  { "stage2_service_cpu_user_seconds_total", "counter", "user CPU time of dead processes" },
+  { "stage2_service_cpu_system_seconds_total", "counter", "system CPU time of dead processes" },
+  { "stage2_service_max_rss_bytes", "gauge", "largest maximum resident set size of a dead process" },
+  { "stage2_service_major_faults_total", "counter", "major page faults of dead processes" },
+  { "stage2_service_lifetime_seconds_total", "counter", "time dead processes were up" },
+} ;
+
+static double metric ( const unsigned int i, const unsigned int islog, const unsigned int k )
+{
+  struct svinfo_s const * const sv = services + i ;
+  struct usage_s const * const u = sv -> usage + islog ;
+
+  switch ( k ) {
+    case METRIC_UP : return sv -> pid [ islog ] ? 1 : 0 ;
+    case METRIC_UPTIME :
+      if ( sv -> pid [ islog ] ) {
+        tain_t d ;
+
+        tain_sub ( & d, & STAMP, & sv -> startedat [ islog ] ) ;
+        return d . sec . x + d . nano / 1e9 ;
+      }
+      return 0 ;
+    case METRIC_RESTARTS : return sv -> restarts [ islog ] ;
+    case METRIC_FAILURES : return u -> failed ;
+    case METRIC_SIGNALED : return u -> signaled ;
+    case METRIC_UTIME : return u -> utime / 1e6 ;
+    case METRIC_STIME : return u -> stime / 1e6 ;
+    case METRIC_MAXRSS : return u -> maxrss * 1024.0 ;
+    case METRIC_MAJFLT : return u -> majflt ;
+    case METRIC_LIFETIME : return u -> uptime / 1e3 ;
+  }
+
+  return 0 ;
+}
+
+/* a label value, with \ " and newline escaped */
+static int buf_putlabel ( struct buf_s * b, char const * s )
+{
+  for ( ; * s ; ++ s ) {
+    if ( '\\' == * s || '"' == * s ) {
+      if ( buf_put ( b, "\\", 1 ) < 0 ) { return -1 ; }
+    } else if ( '\n' == * s ) {
+      if ( buf_put ( b, "\\n", 2 ) < 0 ) { return -1 ; }
+      continue ;
+    }
+
+    if ( buf_put ( b, s, 1 ) < 0 ) { return -1 ; }
+  }
+
+  return 0 ;
+}
+
+/* how long the loop took to get back to waiting since it woke up */
+static void loop_account ( tain_t const * woke )
+{
+  tain_t d ;
+  uint64_t us ;
+
+  tain_now_g () ;
+  tain_sub ( & d, & STAMP, woke ) ;
+  us = (uint64_t) d . sec . x * 1000000 + d . nano / 1000 ;
+  loopbusy += us ;
+  if ( us > loopmax ) { loopmax = us ; }
+}
+
+/* the loop itself, see reap () and handle_client (), and scan () */
+static int metrics_loop ( struct buf_s * b )
+{
+  char line [ 2048 ] ;
+  const int len = snprintf ( line, sizeof ( line ),
+    "# HELP stage2_reaped_total children reaped\n# TYPE stage2_reaped_total counter\nstage2_reaped_total %llu\n"
+    "# HELP stage2_orphans_reaped_total reaped processes that were not a service, logger or finish script\n"
+    "# TYPE stage2_orphans_reaped_total counter\nstage2_orphans_reaped_total %llu\n"
+    "# HELP stage2_loop_iterations_total event loop iterations\n# TYPE stage2_loop_iterations_total counter\n"
+    "stage2_loop_iterations_total %llu\n"
+    "# HELP stage2_loop_busy_seconds_total time spent handling events\n# TYPE stage2_loop_busy_seconds_total counter\n"
+    "stage2_loop_busy_seconds_total %.6f\n"
+    "# HELP stage2_loop_busy_seconds_max longest loop iteration\n# TYPE stage2_loop_busy_seconds_max gauge\n"
+    "stage2_loop_busy_seconds_max %.6f\n"
+    "# HELP stage2_scans_total directory scans\n# TYPE stage2_scans_total counter\nstage2_scans_total %llu\n"
+    "# HELP stage2_scan_seconds_total time spent scanning, starts included\n# TYPE stage2_scan_seconds_total counter\n"
+    "stage2_scan_seconds_total %.6f\n"
+    "# HELP stage2_scan_seconds_last duration of the last scan\n# TYPE stage2_scan_seconds_last gauge\n"
+    "stage2_scan_seconds_last %.6f\n",
+    (unsigned long long) nreaped, (unsigned long long) norphans, (unsigned long long) nloops,
+    loopbusy / 1e6, loopmax / 1e6, (unsigned long long) nscans, scanbusy / 1e6, scanlast / 1e6 ) ;
+
+  return buf_put ( b, line, len ) ;
+}
+
+static int metrics_fmt ( struct buf_s * b )
+{
+  unsigned int k, i, islog ;
+
+  for ( k = 0 ; k < METRIC_COUNT ; ++ k ) {
+    char line [ 256 ] ;
+    int len = snprintf ( line, sizeof ( line ), "# HELP %s %s\n# TYPE %s %s\n",
+      metricdefs [ k ] . name, metricdefs [ k ] . help, metricdefs [ k ] . name, metricdefs [ k ] . type ) ;
+
+    if ( buf_put ( b, line, len ) < 0 ) { return -1 ; }
+
+    for ( i = 0 ; i < n ; ++ i ) {
+      if ( ! services [ i ] . flagused ) { continue ; }
+
+      for ( islog = 0 ; islog <= ( services [ i ] . flaglog && ! logmux ) ; ++ islog ) {
+        if ( buf_put ( b, metricdefs [ k ] . name, strlen ( metricdefs [ k ] . name ) ) < 0
+          || buf_put ( b, "{service=\"", 10 ) < 0
+          || buf_putlabel ( b, services [ i ] . name ) < 0 ) { return -1 ; }
+
+        len = snprintf ( line, sizeof ( line ), "\",log=\"%u\"} %.15g\n", islog, metric ( i, islog, k ) ) ;
+        if ( buf_put ( b, line, len ) < 0 ) { return -1 ; }
+      }
+    }
+  }
+
+  return metrics_loop ( b ) ;
+}
+
+static void metrics_write ( void )
+{
+  struct buf_s b = { NULL, 0, 0 } ;
+
+  if ( metrics_fmt ( & b ) < 0 ) { strerr_warnwu1sys ( "format metrics" ) ; }
+  else if ( ! openwritenclose_suffix ( METRICS_FILE, b . s, b . len, ".new" ) )
+    strerr_warnwu2sys ( "write ", METRICS_FILE ) ;
+
+  free ( b . s ) ;
+}
+
+/* The control socket.
+   Clients send framed requests operating on many named services
+   at once (see s2ctl.h) and get one reply per request. */
+
+/* find a service by name, "name/log" meaning its logger */
+static int svlookup ( char const * name, unsigned int * islog )
+{
+  size_t len = strlen ( name ) ;
+  unsigned int i ;
+
+  * islog = 0 ;
+
+  if ( 4 < len && ! memcmp ( name + len - 4, "/log", 4 ) ) {
+    * islog = 1 ;
+    len -= 4 ;
+  }
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    if ( services [ i ] . flagused && ! strncmp ( services [ i ] . name, name, len ) && ! services [ i ] . name [ len ] )
+      return ( * islog && ( ! services [ i ] . flaglog || logmux ) ) ? -1 : (int) i ;
+  }
+
+  return -1 ;
+}
+
+/* write commands to the control fifo of a service's s6-supervise */
+static int svtell ( const unsigned int i, const unsigned int islog, char const * cmd, const size_t len )
+{
+  char const * const name = services [ i ] . name ;
+  const size_t namelen = strlen ( name ) ;
+  char fn [ namelen + sizeof ( "/log/supervise/control" ) ] ;
+  int fd ;
+  ssize_t r ;
+
+  memcpy ( fn, name, namelen ) ;
+  memcpy ( fn + namelen, "/log", 4 ) ;
+  memcpy ( fn + namelen + ( islog ? 4 : 0 ), "/supervise/control", sizeof ( "/supervise/control" ) ) ;
+
+  fd = open ( fn, O_WRONLY | O_NONBLOCK | O_CLOEXEC ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  r = fd_write ( fd, cmd, len ) ;
+  fd_close ( fd ) ;
+
+  return ( (ssize_t) len == r ) ? 0 : -1 ;
+}
+
+/* carry out a start, stop, restart or signal request for one service */
+static unsigned char svop ( const unsigned int i, const unsigned int islog, const unsigned int op, const unsigned int arg )
+{
+  struct svinfo_s * const sv = services + i ;
+  char cmd [ 2 ] = { 0, 0 } ;
+  size_t len = 1, k ;
+
+  if ( sv -> flagtemplate ) { return S2CTL_EINVAL ; }
+
+  /* stopped, an instance created by a request goes at the next scan */
+  if ( S2CTL_STOP == op && ! islog ) { sv -> flagdynamic = 0 ; }
+
+  /* asked for, an idle class service is an ordinary one until it is
+   * reconfigured */
+  if ( S2CTL_START == op && ! islog && sv -> flagheld ) {
+    sv -> flagidleclass = 0 ;
+    sv -> flagheld = 0 ;
+  }
+
+  switch ( op ) {
+    case S2CTL_START : cmd [ 0 ] = 'u' ; break ;
+    case S2CTL_STOP : cmd [ 0 ] = 'd' ; break ;
+    case S2CTL_RESTART : cmd [ 0 ] = 'u' ; cmd [ 1 ] = 't' ; len = 2 ; break ;
+    case S2CTL_SIGNAL :
+      if ( 1 > arg || NSIG <= arg ) { return S2CTL_EINVAL ; }
+      if ( inproc ) {
+        if ( sv -> pid [ islog ] ) { (void) kill ( sv -> pid [ islog ], arg ) ; }
+        return S2CTL_OK ;
+      }
+      cmd [ 0 ] = svletter ( arg ) ;
+      if ( ! cmd [ 0 ] ) { return S2CTL_EINVAL ; }
+      break ;
+    default : return S2CTL_EINVAL ;
+  }
+
+  if ( inproc ) {
+    for ( k = 0 ; k < len ; ++ k ) { svcommand ( i, islog, cmd [ k ] ) ; }
+    return S2CTL_OK ;
+  }
+
+  if ( 'u' == cmd [ 0 ] ) {
+    svdirty ( i ) ;
+    sv -> flagquarantine = 0 ;
+    sv -> fails [ islog ] = 0 ;
+  }
+
+  if ( ! sv -> pid [ islog ] ) {
+    /* no supervisor to tell: start one now instead of when it is due */
+    if ( 'u' != cmd [ 0 ] ) { return S2CTL_EIO ; }
+    if ( ! sv -> flagactive ) { return S2CTL_ENOENT ; }
+    if ( ! sv -> fpid [ islog ] ) {
+      timer_cancel ( i, islog ) ;
+      wantstart ( i, islog ) ;
+    }
+    return S2CTL_OK ;
+  }
+
+  return ( svtell ( i, islog, cmd, len ) < 0 ) ? S2CTL_EIO : S2CTL_OK ;
+}
+
+static void svstate ( const unsigned int i, struct s2ctl_state_s * st )
+{
+  struct svinfo_s const * const sv = services + i ;
+
+  memset ( st, 0, sizeof ( * st ) ) ;
+  st -> pid = sv -> pid [ 0 ] ;
+  st -> logpid = sv -> pid [ 1 ] ;
+  st -> fails = sv -> fails [ 0 ] ;
+  st -> logfails = sv -> fails [ 1 ] ;
+  st -> flags = S2CTL_KNOWN
+    | ( sv -> flagactive ? S2CTL_ACTIVE : 0 )
+    | ( sv -> flaglog ? S2CTL_LOG : 0 )
+    | ( sv -> flagquarantine ? S2CTL_QUARANTINE : 0 )
+    | ( sv -> flagqueued ? S2CTL_QUEUED : 0 )
+    | ( sv -> flagstarting ? S2CTL_STARTING : 0 )
+    | ( sv -> flagcritical ? S2CTL_CRITICAL : 0 )
+    | ( sv -> flagready ? S2CTL_READY : 0 )
+    | ( sv -> flagwaiting ? S2CTL_WAITING : 0 )
+    | ( ( sv -> down & 1 ) ? S2CTL_DOWN : 0 )
+    | ( ( sv -> down & 2 ) ? S2CTL_LOGDOWN : 0 )
+    | ( sv -> flagtemplate ? S2CTL_TEMPLATE : 0 )
+    | ( sv -> flagshedding ? S2CTL_PAUSED : 0 )
+    | ( sv -> flagheld ? S2CTL_HELD : 0 ) ;
+
+  if ( sv -> pid [ 0 ] ) {
+    tain_t d ;
+
+    tain_sub ( & d, & STAMP, & sv -> startedat [ 0 ] ) ;
+    st -> uptime = d . sec . x ;
+  }
+}
+
+/* Pressure.
+   With -P, stage2 sets PSI triggers on the memory and cpu pressure
+   files and watches them for EPOLLPRI. From a trigger until PSI_CALM
+   seconds after the last one, queued and new starts wait (but those
+   of critical services), services with a low-priority file are not
+   restarted and those with a sheddable file are stopped. */
+
+#if defined (OSLinux)
+static char const * const psifiles [] = { "/proc/pressure/memory", "/proc/pressure/cpu", 0 } ;
+
+static void psi_open ( void )
+{
+  char trig [ sizeof ( "some  " ) + 2 * UINT_FMT ] ;
+  size_t m = 5 ;
+  unsigned int k ;
+
+  if ( ! psistall ) { return ; }
+
+  memcpy ( trig, "some ", 5 ) ;
+  m += uint_fmt ( trig + m, psistall * ( PSI_WINDOW / 1000000 ) ) ;
+  trig [ m ++ ] = ' ' ;
+  m += uint_fmt ( trig + m, PSI_WINDOW ) ;
+  trig [ m ++ ] = 0 ;
+
+  for ( k = 0 ; psifiles [ k ] ; ++ k ) {
+    const int fd = open ( psifiles [ k ], O_RDWR | O_NONBLOCK | O_CLOEXEC ) ;
+
+    /* the trigger lives as long as the fd */
+    if ( 0 > fd || fd_write ( fd, trig, m ) < (ssize_t) m || ev_pri ( fd, EV_PSI, k ) < 0 ) {
+      strerr_warnwu2sys ( "set up a pressure trigger on ", psifiles [ k ] ) ;
+      if ( 0 <= fd ) { fd_close ( fd ) ; }
+    }
+  }
+}
+#else
+static void psi_open ( void )
+{
+  if ( psistall ) { strerr_warnw1x ( "pressure triggers are not supported on this system" ) ; }
+}
+#endif
+
+static void pressure_begin ( void )
+{
+  unsigned int i ;
+
+  pressure = 1 ;
+  strerr_warnw1x ( "under pressure: holding back starts" ) ;
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    struct svinfo_s * const sv = services + i ;
+
+    if ( ! sv -> flagused || ! sv -> flagshed || ! sv -> pid [ 0 ] || sv -> flagshedding ) { continue ; }
+
+    if ( S2CTL_OK == svop ( i, 0, S2CTL_SIGNAL, SIGSTOP ) ) {
+      sv -> flagshedding = 1 ;
+      svdirty ( i ) ;
+    }
+  }
+}
+
+static void pressure_end ( void )
+{
+  unsigned int i ;
+
+  pressure = 0 ;
+  strerr_warnw1x ( "pressure gone: resuming starts" ) ;
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    struct svinfo_s * const sv = services + i ;
+
+    if ( ! sv -> flagused ) { continue ; }
+
+    if ( sv -> flagshedding ) {
+      sv -> flagshedding = 0 ;
+      svdirty ( i ) ;
+      if ( sv -> pid [ 0 ] ) { (void) svop ( i, 0, S2CTL_SIGNAL, SIGCONT ) ; }
+    }
+
+    if ( sv -> flagdeferred ) {
+      sv -> flagdeferred = 0 ;
+      restart ( i, 0 ) ;
+    }
+  }
+}
+
+/* a trigger fired: nothing to read, polling rearms it */
+static void handle_psi ( void )
+{
+  tain_addsec_g ( & pressureuntil, PSI_CALM ) ;
+  if ( ! pressure ) { pressure_begin () ; }
+}
+
+static void pressure_check ( void )
+{
+  if ( pressure && ! tain_future ( & pressureuntil ) ) { pressure_end () ; }
+}
+
+/* The idle class.
+   Services whose start-class file says "idle" are not started until
+   no start is queued or under way and the cpu and io pressure stays
+   below SETTLE_PSI percent (and -P sees none) for SETTLE_TIME
+   seconds, or until -i idlemax seconds have gone by. After that,
+   they are ordinary services. */
+
+#if defined (OSLinux)
+/* the "some avg10" percentage of a pressure file, 0 if unknown */
+static unsigned int psi_avg10 ( char const * fn )
+{
+  char buf [ 256 ] ;
+  char const * p ;
+  unsigned int pct ;
+  const ssize_t r = openreadnclose ( fn, buf, sizeof ( buf ) - 1 ) ;
+
+  if ( 0 >= r ) { return 0 ; }
+  buf [ r ] = 0 ;
+
+  p = strstr ( buf, "avg10=" ) ;
+
+  return ( p && uint_scan ( p + 6, & pct ) ) ? pct : 0 ;
+}
+
+static int loadhigh ( void )
+{
+  return SETTLE_PSI <= psi_avg10 ( "/proc/pressure/cpu" ) || SETTLE_PSI <= psi_avg10 ( "/proc/pressure/io" ) ;
+}
+#else
+static int loadhigh ( void )
+{
+  return 0 ;
+}
+#endif
+
+static void settle_release ( char const * why )
+{
+  unsigned int i ;
+
+  settling = 0 ;
+  wantsettle = 0 ;
+
+  for ( i = 0 ; i < n ; ++ i ) {
+    struct svinfo_s * const sv = services + i ;
+
+    if ( ! sv -> flagused || ! sv -> flagheld ) { continue ; }
+
+    if ( why ) {
+      strerr_warni2x ( "starting the idle class: ", why ) ;
+      why = 0 ;
+    }
+
+    svdirty ( i ) ;
+    sv -> flagheld = 0 ;
+    if ( sv -> flagactive && ! sv -> flagquarantine && ! sv -> pid [ 0 ] && ! sv -> fpid [ 0 ] && ! ( sv -> down & 1 ) )
+      admit ( i ) ;
+  }
+}
+
+/* looks at the load once a second while some service is held */
+static void settle_check ( void )
+{
+  if ( ! settling ) { return ; }
+
+  if ( ! tain_future ( & settleuntil ) ) {
+    settle_release ( "maximum delay reached" ) ;
+    return ;
+  }
+
+  if ( ! wantsettle || tain_future ( & settlepoll ) ) { return ; }
+  tain_addsec_g ( & settlepoll, 1 ) ;
+
+  if ( queued () || nstarting || pressure || loadhigh () ) {
+    quiet = 0 ;
+    return ;
+  }
+
+  if ( ! quiet ) {
+    quiet = 1 ;
+    tain_addsec_g ( & settleat, SETTLE_TIME ) ;
+  }
+
+  if ( ! tain_future ( & settleat ) ) { settle_release ( "the system has settled" ) ; }
+}
+
+/* The status file.
+   The service table is mirrored into a shared mapping that readers
+   copy entries from without ever talking to us (see s2status.h). */
+
+static struct s2status_ent_s * status_ent ( const unsigned int i )
+{
+  return (struct s2status_ent_s *) ( (char *) status + sizeof ( struct s2status_hdr_s ) ) + i ;
+}
+
+/* create the file under a temporary name and rename it into place,
+ * so a reader never maps a half initialized one
+ */
+static void status_open ( void )
+{
+  const size_t len = strlen ( statusfn ) ;
+  const size_t size = sizeof ( struct s2status_hdr_s ) + max * sizeof ( struct s2status_ent_s ) ;
+  char tmp [ len + 5 ] ;
+  void * p ;
+  int fd ;
+
+  memcpy ( tmp, statusfn, len ) ;
+  memcpy ( tmp + len, ".new", 5 ) ;
+
+  fd = open ( tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 00644 ) ;
+  if ( 0 > fd ) { goto err ; }
+
+  if ( ftruncate ( fd, size ) < 0 ) {
+    fd_close ( fd ) ;
+    goto err ;
+  }
+
+  p = mmap ( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+  fd_close ( fd ) ;
+  if ( MAP_FAILED == p ) { goto err ; }
+
+  status = p ;
+  status -> magic = S2STATUS_MAGIC ;
+  status -> version = S2STATUS_VERSION ;
+  status -> hdrsize = sizeof ( struct s2status_hdr_s ) ;
+  status -> entsize = sizeof ( struct s2status_ent_s ) ;
+  status -> nslots = max ;
+  status -> pid = getpid () ;
+
+  if ( rename ( tmp, statusfn ) < 0 ) {
+    (void) munmap ( p, size ) ;
+    status = NULL ;
+    goto err ;
+  }
+
+  return ;
+
+err :
+  strerr_warnwu2sys ( "set up status file ", tmp ) ;
+  (void) unlink ( tmp ) ;
+}
+
+static void status_write ( const unsigned int i, const time_t now )
+{
+  struct s2status_ent_s e, * const p = status_ent ( i ) ;
+  struct svinfo_s const * const sv = services + i ;
+
+  memset ( & e, 0, sizeof ( e ) ) ;
+
+  if ( sv -> flagused ) {
+    struct s2ctl_state_s st ;
+    const size_t len = strlen ( sv -> name ) ;
+
+    svstate ( i, & st ) ;
+    e . flags = st . flags ;
+    e . pid = st . pid ;
+    e . logpid = st . logpid ;
+    e . restarts = sv -> restarts [ 0 ] ;
+    e . logrestarts = sv -> restarts [ 1 ] ;
+    e . lastexit = sv -> wstat [ 0 ] ;
+    e . loglastexit = sv -> wstat [ 1 ] ;
+    e . since = sv -> since [ 0 ] ;
+    e . logsince = sv -> since [ 1 ] ;
+    memcpy ( e . name, sv -> name, ( len < S2STATUS_NAMELEN ) ? len : S2STATUS_NAMELEN - 1 ) ;
+  }
+
+  /* leave the entry alone if nothing readers can see has changed */
+  e . seq = p -> seq ;
+  e . changed = p -> changed ;
+  if ( ! memcmp ( & e, p, sizeof ( e ) ) ) { return ; }
+
+  e . changed = now ;
+  __atomic_store_n ( & p -> seq, e . seq + 1, __ATOMIC_RELAXED ) ;
+  __atomic_thread_fence ( __ATOMIC_RELEASE ) ;
+  memcpy ( (char *) p + sizeof ( p -> seq ), (char const *) & e + sizeof ( e . seq ), sizeof ( e ) - sizeof ( e . seq ) ) ;
+  __atomic_store_n ( & p -> seq, e . seq + 2, __ATOMIC_RELEASE ) ;
+}
+
+/* publish all services that changed since the last call */
+static void status_publish ( void )
+{
+  time_t now ;
+
+  if ( ! ndirty ) { return ; }
+
+  now = time ( NULL ) ;
+
+  while ( ndirty ) {
+    const unsigned int i = dirty [ -- ndirty ] ;
+
+    dirtymark [ i ] = 0 ;
+    status_write ( i, now ) ;
+  }
+
+  __atomic_store_n ( & status -> high, n, __ATOMIC_RELAXED ) ;
+  __atomic_add_fetch ( & status -> gen, 1, __ATOMIC_RELEASE ) ;
+}
+
+/* create the control socket, only the owner may connect */
+static int ctlsock_open ( void )
+{
+  struct sockaddr_un sa ;
+  int fd ;
+
+  memset ( & sa, 0, sizeof ( sa ) ) ;
+  sa . sun_family = AF_UNIX ;
+  memcpy ( sa . sun_path, CONTROL_SOCKET, sizeof ( CONTROL_SOCKET ) ) ;
+
+  fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ;
+  if ( 0 > fd ) { return -1 ; }
+
+  (void) unlink ( CONTROL_SOCKET ) ;
+
+  if ( bind ( fd, (struct sockaddr *) & sa, sizeof ( sa ) ) < 0
+    || chmod ( CONTROL_SOCKET, 00600 ) < 0
+    || listen ( fd, CLIENT_MAX ) < 0
+    || ev_add ( fd, EV_LISTEN, 0 ) < 0 ) {
+    const int e = errno ;
+
+    fd_close ( fd ) ;
+    errno = e ;
+    return -1 ;
+  }
+
+  return fd ;
+}
+
+/* the socket is mode 0600 already, but check who is at the other end */
+static int peer_allowed ( const int fd )
+{
+#if defined (OSLinux)
+  struct ucred cr ;
+  socklen_t len = sizeof ( cr ) ;
+
+  if ( getsockopt ( fd, SOL_SOCKET, SO_PEERCRED, & cr, & len ) < 0 ) { return 0 ; }
+
+  return ! cr . uid || geteuid () == cr . uid ;
+#else
+  uid_t uid ;
+  gid_t gid ;
+
+  if ( getpeereid ( fd, & uid, & gid ) < 0 ) { return 0 ; }
+
+  return ! uid || geteuid () == uid ;
+#endif
+}
+
+static void client_close ( const unsigned int k )
+{
+  struct client_s * const c = clients + k ;
+
+  ev_del ( c -> fd ) ;
+  fd_close ( c -> fd ) ;
+  free ( c -> out . s ) ;
+  c -> fd = -1 ;
+  c -> out . s = NULL ;
+  c -> inlen = c -> outpos = c -> out . len = c -> out . max = 0 ;
+  c -> waiting = 0 ;
+}
+
+static void handle_accept ( void )
+{
+  while ( 1 ) {
+    unsigned int k ;
+    const int fd = accept4 ( lsfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ;
+
+    if ( 0 > fd ) {
+      if ( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno && ECONNABORTED != errno )
+        strerr_warnwu1sys ( "accept on the control socket" ) ;
+      return ;
+    }
+
+    for ( k = 0 ; k < CLIENT_MAX && 0 <= clients [ k ] . fd ; ++ k ) ;
+
+    if ( CLIENT_MAX <= k ) {
+      strerr_warnw1x ( "too many control socket clients" ) ;
+      fd_close ( fd ) ;
+      continue ;
+    }
+
+    if ( ! peer_allowed ( fd ) ) {
+      strerr_warnw1x ( "control socket client not allowed" ) ;
+      fd_close ( fd ) ;
+      continue ;
+    }
+
+    if ( ev_add ( fd, EV_CLIENT, k ) < 0 ) {
+      strerr_warnwu1sys ( "watch control socket client" ) ;
+      fd_close ( fd ) ;
+      continue ;
+    }
+
+    clients [ k ] . fd = fd ;
+  }
+}
+
+/* answer one complete request. the names in the payload have been
+ * checked to be count NUL terminated strings. returns -1 if the
+ * client must be dropped.
+ */
+static int client_request ( struct client_s * c, struct s2ctl_hdr_s const * h, char const * names )
+{
+  struct s2ctl_hdr_s rh = * h ;
+  const size_t start = c -> out . len ;
+  char const * name = names ;
+  unsigned int k ;
+
+  rh . len = 0 ;
+  rh . arg = S2CTL_OK ;
+  if ( buf_put ( & c -> out, & rh, sizeof ( rh ) ) < 0 ) { return -1 ; }
+
+  event ( S2EV_REQUEST, 0, S2EV_NOSLOT, h -> op, h -> count ) ;
+
+  if ( S2CTL_METRICS == h -> op ) {
+    if ( metrics_fmt ( & c -> out ) < 0 ) { return -1 ; }
+  } else if ( S2CTL_LOGTAIL == h -> op ) {
+    unsigned int islog ;
+    const int i = ( 1 == h -> count ) ? svlookup ( names, & islog ) : -1 ;
+    struct logmux_s const * const lm = ( 0 <= i ) ? services [ i ] . lm : NULL ;
+
+    if ( 1 != h -> count ) { rh . arg = S2CTL_EINVAL ; }
+    else if ( ! lm ) { rh . arg = S2CTL_ENOENT ; }
+    else if ( ( lm -> ringfull && buf_put ( & c -> out, lm -> ring + lm -> ringpos, LOG_RING - lm -> ringpos ) < 0 )
+      || buf_put ( & c -> out, lm -> ring, lm -> ringpos ) < 0 ) { return -1 ; }
+  } else if ( S2CTL_QUERY == h -> op ) {
+    struct s2ctl_state_s st ;
+    unsigned int count = 0 ;
+
+    if ( ! h -> count ) {
+      for ( k = 0 ; k < n ; ++ k ) {
+        if ( ! services [ k ] . flagused ) { continue ; }
+        svstate ( k, & st ) ;
+        if ( buf_put ( & c -> out, & st, sizeof ( st ) ) < 0
+          || buf_put ( & c -> out, services [ k ] . name, strlen ( services [ k ] . name ) + 1 ) < 0 ) { return -1 ; }
+        ++ count ;
+      }
+    } else {
+      for ( k = 0 ; k < h -> count ; ++ k, name += strlen ( name ) + 1 ) {
+        unsigned int islog ;
+        const int i = svlookup ( name, & islog ) ;
+
+        if ( 0 > i ) { memset ( & st, 0, sizeof ( st ) ) ; }
+        else { svstate ( i, & st ) ; }
+        if ( buf_put ( & c -> out, & st, sizeof ( st ) ) < 0
+          || buf_put ( & c -> out, name, strlen ( name ) + 1 ) < 0 ) { return -1 ; }
+        ++ count ;
+      }
+    }
+
+    rh . count = count ;
+  } else if ( S2CTL_RESCAN == h -> op && ! h -> count ) {
+    wantscan = 1 ;
+  } else if ( S2CTL_REEXEC == h -> op ) {
+    if ( h -> count ) { rh . arg = S2CTL_EINVAL ; }
+    else { wantreexec = 1 ; }
+  } else if ( S2CTL_EVENTS == h -> op ) {
+    if ( h -> count ) { rh . arg = S2CTL_EINVAL ; }
+    else if ( events_dump () < 0 ) {
+      strerr_warnwu2sys ( "write ", EVENTS_FILE ) ;
+      rh . arg = S2CTL_EIO ;
+    }
+  } else {
+    for ( k = 0 ; k < h -> count ; ++ k, name += strlen ( name ) + 1 ) {
+      unsigned int islog ;
+      unsigned char res = S2CTL_OK ;
+      int i ;
+
+      if ( S2CTL_RESCAN == h -> op ) {
+        /* just one directory, not a full scan */
+        struct stat st ;
+        struct s2db_ent_s const * e = NULL ;
+        const unsigned int k = rootof ( name ) ;
+        char const * const base = k ? name + roots [ k ] . len + 1 : name ;
+
+        if ( ! base [ 0 ] || '.' == base [ 0 ] || strchr ( base, '/' ) || ( ! k && rootdir ( name ) ) ) { res = S2CTL_EINVAL ; }
+        else if ( dbfn && ! k ) {
+          /* what the database holds, as loaded by the last scan */
+          if ( ! db || ! ( e = s2db_find ( db, name ) ) ) { res = S2CTL_ENOENT ; }
+          else {
+            checkdir ( name, e -> dev, e -> ino, -1, e, 0 ) ;
+            if ( 0 > svlookup ( name, & islog ) ) { res = S2CTL_EIO ; }
+          }
+        }
+        else if ( stat ( name, & st ) < 0 || ! S_ISDIR( st . st_mode ) ) { res = S2CTL_ENOENT ; }
+        else {
+          scanroot = k ;
+          check ( name ) ;
+          scanroot = 0 ;
+          if ( 0 > svlookup ( name, & islog ) ) { res = S2CTL_EIO ; }
+        }
+      } else if ( 0 > ( i = svlookup ( name, & islog ) ) && ( S2CTL_START != h -> op || 0 > ( i = instance_new ( name ) ) ) ) {
+        res = S2CTL_ENOENT ;
+      } else {
+        res = svop ( i, islog, h -> op, h -> arg ) ;
+      }
+
+      if ( buf_put ( & c -> out, & res, 1 ) < 0 ) { return -1 ; }
+    }
+  }
+
+  rh . len = c -> out . len - start - sizeof ( rh ) ;
+  memcpy ( c -> out . s + start, & rh, sizeof ( rh ) ) ;
+
+  return 0 ;
+}
+
+/* write out what we can of the pending replies */
+static int client_flush ( const unsigned int k )
+{
+  struct client_s * const c = clients + k ;
+
+  while ( c -> outpos < c -> out . len ) {
+    const ssize_t r = sanitize_read ( fd_write ( c -> fd, c -> out . s + c -> outpos, c -> out . len - c -> outpos ) ) ;
+
+    if ( 0 > r ) { return -1 ; }
+    if ( ! r ) {
+      if ( c -> waiting ) { return 0 ; }
+      c -> waiting = 1 ;
+      return ev_mod ( c -> fd, EV_CLIENT, k, 1 ) ;
+    }
+
+    c -> outpos += r ;
+  }
+
+  c -> outpos = c -> out . len = 0 ;
+
+  if ( ! c -> waiting ) { return 0 ; }
+  c -> waiting = 0 ;
+  return ev_mod ( c -> fd, EV_CLIENT, k, 0 ) ;
+}
+
+/* read and answer requests. a client that does not read its replies
+ * is not read from until it does.
+ */
+static void handle_client ( const unsigned int k )
+{
+  struct client_s * const c = clients + k ;
+  const size_t hlen = sizeof ( struct s2ctl_hdr_s ) ;
+  unsigned int budget = CLIENT_BUDGET ;
+
+  if ( c -> out . len && client_flush ( k ) < 0 ) { goto drop ; }
+
+  while ( ! c -> out . len ) {
+    struct s2ctl_hdr_s h ;
+    ssize_t r ;
+
+    /* the rest waits for the next iteration, see handle_clients () */
+    if ( ! budget ) {
+      wantclients = 1 ;
+      break ;
+    }
+
+    if ( hlen <= c -> inlen ) {
+      memcpy ( & h, c -> in, hlen ) ;
+
+      if ( S2CTL_MAXREQ < h . len || ! h . op || S2CTL_EVENTS < h . op ) {
+        h . arg = S2CTL_EPROTO ;
+        h . len = h . count = 0 ;
+        (void) fd_write ( c -> fd, (char const *) & h, hlen ) ;
+        goto drop ;
+      }
+
+      if ( hlen + h . len <= c -> inlen ) {
+        char * const names = c -> in + hlen ;
+        size_t pos = 0 ;
+        unsigned int count = 0 ;
+
+        while ( pos < h . len ) {
+          char const * const z = memchr ( names + pos, 0, h . len - pos ) ;
+
+          if ( ! z ) { break ; }
+          pos = z - names + 1 ;
+          ++ count ;
+        }
+
+        if ( pos != h . len || count != h . count ) {
+          h . arg = S2CTL_EPROTO ;
+          h . len = h . count = 0 ;
+          (void) fd_write ( c -> fd, (char const *) & h, hlen ) ;
+          goto drop ;
+        }
+
+        if ( client_request ( c, & h, names ) < 0 ) {
+          strerr_warnwu1sys ( "answer control socket request" ) ;
+          goto drop ;
+        }
+
+        c -> inlen -= hlen + h . len ;
+        memmove ( c -> in, c -> in + hlen + h . len, c -> inlen ) ;
+        -- budget ;
+
+        if ( client_flush ( k ) < 0 ) { goto drop ; }
+        continue ;
+      }
+    }
+
+    r = sanitize_read ( fd_read ( c -> fd, c -> in + c -> inlen, sizeof ( c -> in ) - c -> inlen ) ) ;
+
+    if ( 0 > r ) { goto drop ; }
+    if ( ! r ) { break ; }
+
+    c -> inlen += r ;
+  }
+
+  return ;
+
+drop :
+  client_close ( k ) ;
+}
+
+/* give the clients that ran out of budget another turn */
+static void handle_clients ( void )
+{
+  unsigned int k ;
+
+  if ( ! wantclients ) { return ; }
+
+  wantclients = 0 ;
+
+  for ( k = 0 ; k < CLIENT_MAX ; ++ k ) {
+    if ( 0 <= clients [ k ] . fd ) { handle_client ( k ) ; }
+  }
+}
+
+/* hot re-exec, for upgrades without a reboot.
+ * 'e' on the control fifo (or S2CTL_REEXEC on the control socket)
+ * makes stage2 write its service table to an anonymous file and exec
+ * itself again, by the name and with the arguments it was run with
+ * plus "-X fd". the new binary reads the table back and adopts the
+ * running supervisors (or services) together with their log pipes,
+ * control fifos, readiness fds and sockets: nothing is stopped or
+ * restarted. children that died meanwhile are reaped right away.
+ *
+ * the file is a header followed by records, each a struct rexec_rec_s,
+ * a fixed part of rec . fixed bytes and, for a service, its name. a
+ * newer binary reads what an older one wrote: fields beyond the fixed
+ * part it knows of are 0, unknown record types are skipped.
+ */
+#define REXEC_MAGIC		0x58523253
+#define REXEC_VERSION		1
+#define REXEC_FILE		S6_SVSCAN_CTLDIR "/reexec"
+
+enum {
+  REXEC_GLOBAL				= 1,
+  REXEC_SERVICE				= 2,
+  /* the slots in the rate limiter queue, in order */
+  REXEC_QUEUE				= 3,
+} ;
+
+enum {
+  REXEC_ACTIVE				= 0x0001,
+  REXEC_LOG				= 0x0002,
+  REXEC_QUARANTINE			= 0x0004,
+  REXEC_STARTING			= 0x0008,
+  REXEC_READY				= 0x0010,
+  REXEC_WAITING				= 0x0020,
+  REXEC_NODEPS				= 0x0040,
+  REXEC_DOWN				= 0x0080,
+  REXEC_LOGDOWN				= 0x0100,
+  REXEC_LOGMUX				= 0x0200,
+  REXEC_MIDLINE				= 0x0400,
+  REXEC_ONDEMAND			= 0x0800,
+  REXEC_ARMED				= 0x1000,
+  REXEC_WANTED				= 0x2000,
+  REXEC_TEMPLATE			= 0x4000,
+  REXEC_DYNAMIC				= 0x8000,
+} ;
+
+struct rexec_hdr_s {
+  uint32_t magic ;
+  uint32_t version ;
+} ;
+
+struct rexec_rec_s {
+  uint16_t type ;
+  uint16_t fixed ;
+  /* everything after this struct */
+  uint32_t len ;
+} ;
+
+struct rexec_tain_s {
+  uint64_t sec ;
+  uint32_t nano ;
+  uint32_t set ;
+} ;
+
+struct rexec_global_s {
+  int32_t lsfd ;
+  uint32_t finish ;
+} ;
+
+struct rexec_sv_s {
+  uint32_t slot ;
+  uint32_t flags ;
+  uint64_t dev ;
+  uint64_t ino ;
+  int32_t pid [ 2 ] ;
+  int32_t fpid [ 2 ] ;
+  int32_t p [ 2 ] ;
+  int32_t ctl [ 2 ] ;
+  int32_t nfd ;
+  uint32_t nls ;
+  int32_t ls [ LISTEN_MAX ] ;
+  uint32_t idle ;
+  uint32_t fails [ 2 ] ;
+  uint32_t restarts [ 2 ] ;
+  uint32_t windowcount ;
+  int32_t wstat [ 2 ] ;
+  int64_t since [ 2 ] ;
+  /* struct usage_s, field by field */
+  uint64_t usage [ 2 ] [ 7 ] ;
+  struct rexec_tain_s restartafter [ 2 ] ;
+  struct rexec_tain_s startedat [ 2 ] ;
+  struct rexec_tain_s windowstart ;
+  struct rexec_tain_s lastuse ;
+  /* the deadlines of the timers that were set, by kind */
+  struct rexec_tain_s timer [ 8 ] ;
+  /* fd + 1, 0 for none */
+  int32_t pidfd [ 2 ] ;
+  /* the template's slot + 1 for an instance */
+  uint32_t tpl ;
+} ;
+
+static char const * const finishargs [] = { "reboot", "poweroff", "halt", "other", 0 } ;
+
+static void rexec_tain ( struct rexec_tain_s * r, tain_t const * t )
+{
+  r -> sec = t -> sec . x ;
+  r -> nano = t -> nano ;
+  r -> set = 1 ;
+}
+
+static void rexec_untain ( tain_t * t, struct rexec_tain_s const * r )
+{
+  t -> sec . x = r -> sec ;
+  t -> nano = r -> nano ;
+}
+
+static int rexec_put ( struct buf_s * b, const unsigned int type, void const * fixed, const size_t len,
+  void const * tail, const size_t taillen )
+{
+  struct rexec_rec_s rec ;
+
+  rec . type = type ;
+  rec . fixed = len ;
+  rec . len = len + taillen ;
+
+  return ( buf_put ( b, & rec, sizeof ( rec ) ) < 0 || buf_put ( b, fixed, len ) < 0
+    || buf_put ( b, tail, taillen ) < 0 ) ? -1 : 0 ;
+}
+
+static int rexec_service ( struct buf_s * b, const unsigned int i )
+{
+  struct svinfo_s const * const sv = services + i ;
+  struct rexec_sv_s r ;
+  unsigned int k ;
+
+  memset ( & r, 0, sizeof ( r ) ) ;
+  r . slot = i ;
+  r . flags = ( sv -> flagactive ? REXEC_ACTIVE : 0 ) | ( sv -> flaglog ? REXEC_LOG : 0 )
+    | ( sv -> flagquarantine ? REXEC_QUARANTINE : 0 ) | ( sv -> flagstarting ? REXEC_STARTING : 0 )
+    | ( sv -> flagready ? REXEC_READY : 0 ) | ( sv -> flagwaiting ? REXEC_WAITING : 0 )
+    | ( sv -> flagnodeps ? REXEC_NODEPS : 0 ) | ( ( sv -> down & 1 ) ? REXEC_DOWN : 0 )
+    | ( ( sv -> down & 2 ) ? REXEC_LOGDOWN : 0 ) | ( sv -> lm ? REXEC_LOGMUX : 0 )
+    | ( ( sv -> lm && sv -> lm -> midline ) ? REXEC_MIDLINE : 0 )
+    | ( sv -> flagtemplate ? REXEC_TEMPLATE : 0 ) | ( sv -> flagdynamic ? REXEC_DYNAMIC : 0 ) ;
+  r . tpl = sv -> tpl ;
+  r . dev = sv -> dev ;
+  r . ino = sv -> ino ;
+  r . nfd = sv -> nfd ;
+
+  for ( k = 0 ; k < 2 ; ++ k ) {
+    struct usage_s const * const u = sv -> usage + k ;
+
+    r . pid [ k ] = sv -> pid [ k ] ;
+    r . fpid [ k ] = sv -> fpid [ k ] ;
+    r . p [ k ] = sv -> p [ k ] ;
+    r . ctl [ k ] = sv -> ctl [ k ] ;
+    r . pidfd [ k ] = sv -> pidfd [ k ] + 1 ;
+    r . fails [ k ] = sv -> fails [ k ] ;
+    r . restarts [ k ] = sv -> restarts [ k ] ;
+    r . wstat [ k ] = sv -> wstat [ k ] ;
+    r . since [ k ] = sv -> since [ k ] ;
+    r . usage [ k ] [ 0 ] = u -> utime ;
+    r . usage [ k ] [ 1 ] = u -> stime ;
+    r . usage [ k ] [ 2 ] = u -> majflt ;
+    r . usage [ k ] [ 3 ] = u -> uptime ;
+    r . usage [ k ] [ 4 ] = u -> maxrss ;
+    r . usage [ k ] [ 5 ] = u -> failed ;
+    r . usage [ k ] [ 6 ] = u -> signaled ;
+    rexec_tain ( r . restartafter + k, sv -> restartafter + k ) ;
+    rexec_tain ( r . startedat + k, sv -> startedat + k ) ;
+  }
+
+  r . windowcount = sv -> windowcount ;
+  rexec_tain ( & r . windowstart, & sv -> windowstart ) ;
+
+  if ( sv -> ls ) {
+    r . nls = sv -> ls -> n ;
+    r . idle = sv -> ls -> idle ;
+    for ( k = 0 ; k < sv -> ls -> n ; ++ k ) { r . ls [ k ] = sv -> ls -> fd [ k ] ; }
+    rexec_tain ( & r . lastuse, & sv -> ls -> lastuse ) ;
+    r . flags |= ( sv -> ls -> ondemand ? REXEC_ONDEMAND : 0 ) | ( sv -> ls -> armed ? REXEC_ARMED : 0 )
+      | ( sv -> ls -> wanted ? REXEC_WANTED : 0 ) ;
+  }
+
+  for ( k = 0 ; k < TIMER_KINDS && k < 8 ; ++ k ) {
+    if ( sv -> tpos [ k ] ) { rexec_tain ( r . timer + k, & timers [ sv -> tpos [ k ] - 1 ] . when ) ; }
   }
+
+  return rexec_put ( b, REXEC_SERVICE, & r, sizeof ( r ), sv -> name, strlen ( sv -> name ) + 1 ) ;
 }
 
-static void handle_diverted_signals ( void )
+/* set or clear close-on-exec on every fd the next binary adopts */
+static void rexec_keep ( const int keep )
 {
-  while ( 1 ) {
-    const int sig = selfpipe_read () ;
+  int ( * const f ) ( int ) = keep ? uncoe : coe ;
+  unsigned int i, k ;
 
-    switch ( sig ) {
-      case -1 : panic ( "selfpipe_read" ) ;
-      case 0 : return ; break ;
-      case SIGCHLD : wantreap = 1 ; break ;
-      case SIGALRM : wantscan = 1 ; break ;
-      case SIGABRT : cont = 0 ; break ;
-      default :
-        {
-          char const * const name = sig_name ( sig ) ;
-          const size_t len = strlen ( name ) ;
-          char fn [ SIGNAL_PROG_LEN + len + 1 ] ;
-          const char * const newargv [ 2 ] = { fn, 0 } ;
+  if ( 0 <= lsfd ) { (void) f ( lsfd ) ; }
 
-          (void) memcpy ( fn, SIGNAL_PROG, SIGNAL_PROG_LEN ) ;
-          (void) memcpy ( fn + SIGNAL_PROG_LEN, name, len + 1 ) ;
+  for ( i = 0 ; i < n ; ++ i ) {
+    struct svinfo_s const * const sv = services + i ;
 
-          if  ( ! child_spawn0 ( newargv [ 0 ], newargv, (char const **) environ ) )
-            strerr_warnwu2sys ( "spawn ", newargv [ 0 ] ) ;
-        }
-        break ;
+    if ( ! sv -> flagused ) { continue ; }
+
+    for ( k = 0 ; k < 2 ; ++ k ) {
+      if ( 0 <= sv -> p [ k ] ) { (void) f ( sv -> p [ k ] ) ; }
+      if ( 0 <= sv -> ctl [ k ] ) { (void) f ( sv -> ctl [ k ] ) ; }
+      if ( 0 <= sv -> pidfd [ k ] ) { (void) f ( sv -> pidfd [ k ] ) ; }
+    }
+
+    if ( 0 <= sv -> nfd ) { (void) f ( sv -> nfd ) ; }
+    if ( sv -> ls ) {
+      for ( k = 0 ; k < sv -> ls -> n ; ++ k ) { (void) f ( sv -> ls -> fd [ k ] ) ; }
     }
   }
 }
 
-static void handle_control ( const int fd )
+/* the anonymous file the table is passed in */
+static int rexec_file ( void )
 {
-  while ( 1 ) {
-    char c = 0 ;
-    const ssize_t r = sanitize_read ( fd_read ( fd, & c, 1 ) ) ;
+#if defined (OSLinux) && defined (MFD_CLOEXEC)
+  return memfd_create ( "stage2-state", 0 ) ;
+#else
+  const int fd = open ( REXEC_FILE, O_RDWR | O_CREAT | O_TRUNC, 00600 ) ;
 
-    if ( r < 0 ) panic ( "read control pipe" ) ;
-    else if ( ! r ) break ;
-    else switch ( c ) {
-      case 'p' : finish_arg = "poweroff" ; break ;
-      case 'h' : hup () ; return ;
-      case 'r' : finish_arg = "reboot" ; break ;
-      case 'a' : wantscan = 1 ; break ;
-      case 't' : term () ; return ;
-      case 's' : finish_arg = "halt" ; break ;
-      case 'z' : wantreap = 1 ; break ;
-      case 'b' : cont = 0 ; return ;
-      case 'n' : wantkill = 2 ; break ;
-      case 'N' : wantkill = 6 ; break ;
-      case '6' :
-      case 'i' : intr () ; return ;
-      case 'q' : quit () ; return ;
-      case '0' : finish_arg = "halt" ; term () ; return ;
-      case '7' : usr1 () ; return ;
-      case '8' : finish_arg = "other" ; term () ; return ;
-      default : {
-          char s [ 2 ] = { c, 0 } ;
-          strerr_warnw2x ( "received unknown control command: ", s ) ;
-        }
-        break ;
-    }
-  }
+  if ( 0 <= fd ) { (void) unlink ( REXEC_FILE ) ; }
+  return fd ;
+#endif
 }
 
-/* First essential function: the reaper.
- * s6-svscan must wait() for all children,
- * including ones it doesn't know it has.
- * Dead active services are flagged to be restarted in 1 second.
+static char const * const * progargv ;
+static unsigned int progargc, progskip ;
+
+/* write the table and exec. returns only if that failed, stage2
+ * then goes on as before.
  */
-static void reap ( void )
+static void reexec ( void )
 {
-  tain_t nextscan ;
+  struct buf_s b = { 0, 0, 0 } ;
+  struct rexec_hdr_s h = { REXEC_MAGIC, REXEC_VERSION } ;
+  struct rexec_global_s g ;
+  char const * eargv [ progargc - progskip + 3 ] ;
+  char fmt [ UINT_FMT ] ;
+  sigset_t old ;
+  unsigned int i, k ;
+  int fd ;
 
-  if ( ! wantreap ) return ;
+  if ( ! cont || wantkill ) {
+    strerr_warnw1x ( "not re-executing while shutting down" ) ;
+    return ;
+  }
 
-  wantreap = 0 ;
-  tain_addsec_g ( & nextscan, 1 ) ;
+  /* the new image sets up its own triggers: nothing stays stopped */
+  if ( pressure ) { pressure_end () ; }
 
-  while ( 1 ) {
-    int wstat = 0 ;
-    pid_t r = wait_nohang ( & wstat ) ;
+  g . lsfd = lsfd ;
+  g . finish = 0 ;
+  while ( finishargs [ g . finish + 1 ] && strcmp ( finishargs [ g . finish ], finish_arg ) ) { ++ g . finish ; }
 
-    if ( r < 0 )
-      if ( errno != ECHILD ) panic ( "wait_nohang" ) ;
-      else break ;
-    else if ( ! r ) break ;
-    else {
-      unsigned int i = 0 ;
+  if ( buf_put ( & b, & h, sizeof ( h ) ) < 0 || rexec_put ( & b, REXEC_GLOBAL, & g, sizeof ( g ), 0, 0 ) < 0 ) { goto err ; }
 
-      for ( i = 0 ; i < n ; ++ i ) {
-        if ( services [ i ] . pid [ 0 ] == r ) {
-          services [ i ] . pid [ 0 ] = 0 ;
-          services [ i ] . restartafter [ 0 ] = nextscan ;
-          break ;
-        } else if ( services [ i ] . pid [ 1 ] == r ) {
-          services [ i ] . pid [ 1 ] = 0 ;
-          services [ i ] . restartafter [ 1 ] = nextscan ;
-          break ;
-        }
-      }
+  /* instances after their templates */
+  for ( i = 0 ; i < n ; ++ i ) {
+    if ( services [ i ] . flagused && ! services [ i ] . tpl && rexec_service ( & b, i ) < 0 ) { goto err ; }
+  }
 
-      if ( i == n ) continue ;
+  for ( i = 0 ; i < n ; ++ i ) {
+    if ( services [ i ] . flagused && services [ i ] . tpl && rexec_service ( & b, i ) < 0 ) { goto err ; }
+  }
 
-      if ( services [ i ] . flagactive ) {
-        if (tain_less(&nextscan, &deadline)) deadline = nextscan ;
-      } else {
-        if ( services [ i ] . flaglog ) {
- /*
-    BLACK MAGIC:
-     - we need to close the pipe early:
-       * as soon as the writer exits so the logger can exit on EOF
-       * or as soon as the logger exits so the writer can crash on EPIPE
-     - but if the same service gets reactivated before the second
-       supervise process exits, ouch: we've lost the pipe
-     - so we can't reuse the same service even if it gets reactivated
-     - so we're marking a dying service with a closed pipe
-     - if the scanner sees a service with p[0] = -1 it won't flag
-       it as active (and won't restart the dead supervise)
-     - but if the service gets reactivated we want it to restart
-       as soon as the 2nd supervise process dies
-     - so the scanner marks such a process with p[0] = -2
-     - and the reaper triggers a scan when it finds a -2.
- */
-          if (services[i].p[0] >= 0) {
-            fd_close(services[i].p[1]) ; services[i].p[1] = -1 ;
-            fd_close(services[i].p[0]) ; services[i].p[0] = -1 ;
-          } else if (services[i].p[0] == -2) wantscan = 1 ;
-        }
+  if ( queued () ) {
+    uint32_t * const q = malloc ( n * sizeof ( uint32_t ) ) ;
+    unsigned int j ;
+    int r ;
 
-        if (!services[i].pid[0] && (!services[i].flaglog || !services[i].pid[1]))
-          services [ i ] = services [ -- n ] ;
-      }
-    }
+    if ( ! q ) { goto err ; }
+    /* root by root, restore () puts them back in their queues */
+    for ( k = 0, j = 0 ; j < nroots ; ++ j )
+      for ( i = roots [ j ] . qhead ; i ; i = services [ i - 1 ] . qnext ) { q [ k ++ ] = i - 1 ; }
+    r = rexec_put ( & b, REXEC_QUEUE, q, k * sizeof ( uint32_t ), 0, 0 ) ;
+    free ( q ) ;
+    if ( r < 0 ) { goto err ; }
   }
-}
 
+  fd = rexec_file () ;
+  if ( 0 > fd ) { goto err ; }
 
-/* Second essential function: the scanner.
-   It monitors the service directories and spawns a supervisor
-   if needed. */
+  if ( allwrite ( fd, b . s, b . len ) < b . len || lseek ( fd, 0, SEEK_SET ) < 0 ) {
+    const int e = errno ;
 
-static void trystart ( unsigned int i, char const * name, int islog )
-{
-  const pid_t pid = fork () ;
+    fd_close ( fd ) ;
+    errno = e ;
+    goto err ;
+  }
 
-  switch ( pid ) {
-    case -1 :
-      tain_addsec_g(&services[i].restartafter[islog], CHECK_RETRY_TIMEOUT) ;
-      strerr_warnwu2sys("fork for ", name) ;
-      return ;
-    case 0 :
-    {
-      char const *cargv[3] = { "s6-supervise", name, 0 } ;
-      PROG = "s6-svscan (child)" ;
-      selfpipe_finish() ;
-      if (services[i].flaglog)
-        if (fd_move(!islog, services[i].p[!islog]) == -1)
-          strerr_diefu2sys(111, "set fds for ", name) ;
-      xpathexec_run(S6_BINPREFIX "s6-supervise", cargv, (char const **)environ) ;
-    }
+  free ( b . s ) ;
+  b . s = NULL ;
+
+  /* the replies are due before the clients go away */
+  for ( k = 0 ; k < CLIENT_MAX ; ++ k ) {
+    if ( 0 > clients [ k ] . fd ) { continue ; }
+    (void) client_flush ( k ) ;
+    client_close ( k ) ;
   }
 
-  services[i].pid[islog] = pid ;
-}
+  fmt [ uint_fmt ( fmt, fd ) ] = 0 ;
+  eargv [ 0 ] = progargv [ 0 ] ;
+  eargv [ 1 ] = "-X" ;
+  eargv [ 2 ] = fmt ;
+  for ( k = 1 + progskip ; k < progargc ; ++ k ) { eargv [ k - progskip + 2 ] = progargv [ k ] ; }
+  eargv [ progargc - progskip + 2 ] = 0 ;
 
-static void retrydirlater ( void )
-{
-  tain_t a ;
-  tain_addsec_g ( & a, DIR_RETRY_TIMEOUT ) ;
-  if ( tain_less ( & a, & deadline ) ) deadline = a ;
+  /* signals wait for the next binary, pending */
+  rexec_keep ( 1 ) ;
+  (void) sigprocmask ( SIG_BLOCK, & trapped, & old ) ;
+  (void) execvp ( eargv [ 0 ], (char * const *) eargv ) ;
+  strerr_warnwu2sys ( "re-execute ", eargv [ 0 ] ) ;
+  (void) sigprocmask ( SIG_SETMASK, & old, 0 ) ;
+  rexec_keep ( 0 ) ;
+  fd_close ( fd ) ;
+  return ;
+
+err :
+  strerr_warnwu1sys ( "save the service table for re-execution" ) ;
+  free ( b . s ) ;
 }
 
-static void check ( char const * name )
+/* adopt one service of the previous binary */
+static void restore_service ( struct rexec_sv_s const * r, char const * name )
 {
-  struct stat st ;
-  size_t namelen ;
-  unsigned int i = 0 ;
-
-  if (name[0] == '.') return ;
+  struct svinfo_s * sv ;
+  unsigned int i = r -> slot, k ;
 
-  if (stat(name, &st) == -1) {
-    strerr_warnwu2sys("stat ", name) ;
-    retrydirlater() ;
+  if ( i >= max || services [ i ] . flagused ) {
+    strerr_warnwu3x ( "adopt ", name, ": no service slot" ) ;
     return ;
   }
 
-  if ( ! S_ISDIR( st . st_mode ) ) return ;
+  sv = services + i ;
+  memset ( sv, 0, sizeof ( * sv ) ) ;
+  sv -> name = strdup ( name ) ;
 
-  namelen = strlen(name) ;
+  if ( ! sv -> name ) {
+    strerr_warnwu2sys ( "store name of ", name ) ;
+    return ;
+  }
 
-  for (; i < n ; i++) if ((services[i].ino == st.st_ino) && (services[i].dev == st.st_dev)) break ;
+  sv -> dev = r -> dev ;
+  sv -> ino = r -> ino ;
+  sv -> root = rootof ( name ) ;
+  sv -> flagtemplate = !! ( r -> flags & REXEC_TEMPLATE ) ;
+  sv -> flagdynamic = !! ( r -> flags & REXEC_DYNAMIC ) ;
 
-  if ( i < n ) {
-    if (services[i].flaglog && (services[i].p[0] < 0)) {
-     /* See BLACK MAGIC above. */
-      services[i].p[0] = -2 ;
+  if ( r -> tpl ) {
+    if ( r -> tpl > n || ! services [ r -> tpl - 1 ] . flagused || ! services [ r -> tpl - 1 ] . flagtemplate ) {
+      strerr_warnwu3x ( "adopt ", name, ": its template is gone" ) ;
+      free ( sv -> name ) ;
+      sv -> name = NULL ;
       return ;
     }
-  } else {
-    if (n >= max) {
-      strerr_warnwu3x("start supervisor for ", name, ": too many services") ;
-      return ;
+
+    sv -> tpl = r -> tpl ;
+    ++ services [ r -> tpl - 1 ] . ninst ;
+  }
+
+  sv -> flagused = 1 ;
+  sv -> flagactive = !! ( r -> flags & REXEC_ACTIVE ) ;
+  sv -> flaglog = !! ( r -> flags & REXEC_LOG ) ;
+  sv -> flagquarantine = !! ( r -> flags & REXEC_QUARANTINE ) ;
+  sv -> flagready = !! ( r -> flags & REXEC_READY ) ;
+  sv -> flagwaiting = !! ( r -> flags & REXEC_WAITING ) ;
+  sv -> flagnodeps = !! ( r -> flags & REXEC_NODEPS ) ;
+  sv -> down = ( ( r -> flags & REXEC_DOWN ) ? 1 : 0 ) | ( ( r -> flags & REXEC_LOGDOWN ) ? 2 : 0 ) ;
+  sv -> nfd = r -> nfd ;
+
+  if ( r -> flags & REXEC_STARTING ) {
+    sv -> flagstarting = 1 ;
+    ++ nstarting ;
+  }
+
+  for ( k = 0 ; k < 2 ; ++ k ) {
+    struct usage_s * const u = sv -> usage + k ;
+
+    pidset ( i, k, 0, r -> pid [ k ] ) ;
+    pidset ( i, k, 1, r -> fpid [ k ] ) ;
+    sv -> p [ k ] = r -> p [ k ] ;
+    sv -> ctl [ k ] = r -> ctl [ k ] ;
+    sv -> pidfd [ k ] = r -> pidfd [ k ] - 1 ;
+    sv -> fails [ k ] = r -> fails [ k ] ;
+    sv -> restarts [ k ] = r -> restarts [ k ] ;
+    sv -> wstat [ k ] = r -> wstat [ k ] ;
+    sv -> since [ k ] = r -> since [ k ] ;
+    u -> utime = r -> usage [ k ] [ 0 ] ;
+    u -> stime = r -> usage [ k ] [ 1 ] ;
+    u -> majflt = r -> usage [ k ] [ 2 ] ;
+    u -> uptime = r -> usage [ k ] [ 3 ] ;
+    u -> maxrss = r -> usage [ k ] [ 4 ] ;
+    u -> failed = r -> usage [ k ] [ 5 ] ;
+    u -> signaled = r -> usage [ k ] [ 6 ] ;
+    rexec_untain ( sv -> restartafter + k, r -> restartafter + k ) ;
+    rexec_untain ( sv -> startedat + k, r -> startedat + k ) ;
+
+    if ( 0 <= sv -> p [ k ] ) { (void) coe ( sv -> p [ k ] ) ; }
+    if ( 0 <= sv -> ctl [ k ] ) {
+      (void) coe ( sv -> ctl [ k ] ) ;
+      if ( ev_add ( sv -> ctl [ k ], EV_SVCONTROL, ( i << 1 ) | k ) < 0 )
+        strerr_warnwu2sys ( "watch the control fifo of ", name ) ;
+    }
+    if ( 0 <= sv -> pidfd [ k ] ) {
+      (void) coe ( sv -> pidfd [ k ] ) ;
+      if ( ev_add ( sv -> pidfd [ k ], EV_PIDFD, ( i << 1 ) | k ) < 0 )
+        strerr_warnwu2sys ( "watch the adopted processes of ", name ) ;
+    }
+  }
+
+  sv -> windowcount = r -> windowcount ;
+  rexec_untain ( & sv -> windowstart, & r -> windowstart ) ;
+
+  ++ nused ;
+  ++ roots [ sv -> root ] . nused ;
+  if ( i >= n ) { n = i + 1 ; }
+
+  /* the settings are read again, they may have changed meanwhile */
+  loadconf ( i ) ;
+
+  if ( 0 <= sv -> nfd ) {
+    (void) coe ( sv -> nfd ) ;
+    if ( ev_add ( sv -> nfd, EV_NOTIFY, i ) < 0 ) { strerr_warnwu2sys ( "watch readiness notification of ", name ) ; }
+  }
+
+  if ( ( r -> flags & REXEC_LOGMUX ) && 0 <= sv -> p [ 0 ] ) {
+    if ( logmux_open ( i ) < 0 ) { strerr_warnwu2sys ( "set up log multiplexing for ", name ) ; }
+    else { sv -> lm -> midline = !! ( r -> flags & REXEC_MIDLINE ) ; }
+  }
+
+  if ( r -> nls && r -> nls <= LISTEN_MAX ) {
+    struct sockets_s * const ls = malloc ( sizeof ( * ls ) ) ;
+
+    if ( ! ls ) {
+      strerr_warnwu2sys ( "adopt the sockets of ", name ) ;
+      for ( k = 0 ; k < r -> nls ; ++ k ) { fd_close ( r -> ls [ k ] ) ; }
     } else {
-      struct stat su ;
-      char tmp[namelen + 5] ;
-      memcpy(tmp, name, namelen) ;
-      memcpy(tmp + namelen, "/log", 5) ;
-      if (stat(tmp, &su) < 0)
-        if (errno == ENOENT) services[i].flaglog = 0 ;
-        else {
-          strerr_warnwu2sys("stat ", tmp) ;
-          retrydirlater() ;
-          return ;
-        }
-      else if (!S_ISDIR(su.st_mode))
-        services[i].flaglog = 0 ;
-      else {
-        if (pipecoe(services[i].p) < 0) {
-          strerr_warnwu1sys("pipecoe") ;
-          retrydirlater() ;
-          return ;
-        }
-        services[i].flaglog = 1 ;
+      memset ( ls, 0, sizeof ( * ls ) ) ;
+      ls -> n = r -> nls ;
+      ls -> idle = r -> idle ;
+      ls -> ondemand = !! ( r -> flags & REXEC_ONDEMAND ) ;
+      ls -> wanted = !! ( r -> flags & REXEC_WANTED ) ;
+      rexec_untain ( & ls -> lastuse, & r -> lastuse ) ;
+      for ( k = 0 ; k < ls -> n ; ++ k ) {
+        ls -> fd [ k ] = r -> ls [ k ] ;
+        (void) coe ( ls -> fd [ k ] ) ;
       }
-      services[i].ino = st.st_ino ;
-      services[i].dev = st.st_dev ;
-      tain_copynow(&services[i].restartafter[0]) ;
-      tain_copynow(&services[i].restartafter[1]) ;
-      services[i].pid[0] = 0 ;
-      services[i].pid[1] = 0 ;
-      ++ n ;
+      sv -> ls = ls ;
+      if ( r -> flags & REXEC_ARMED ) { sockets_watch ( i, ls -> wanted ) ; }
     }
   }
-  
-  services[i].flagactive = 1 ;
 
-  if ( services [ i ] . flaglog && ! services [ i ] . pid [ 1 ] ) {
-    if ( ! tain_future( & services [ i ] . restartafter [ 1 ] ) ) {
-      char tmp [ namelen + 5 ] ;
-      memcpy(tmp, name, namelen) ;
-      memcpy(tmp + namelen, "/log", 5) ;
-      trystart(i, tmp, 1) ;
-    } else if (tain_less(&services[i].restartafter[1], &deadline))
-      deadline = services[i].restartafter[1] ;
-  }
+  probe_open ( i ) ;
 
-  if ( ! services[i].pid[0]) {
-    if (!tain_future(&services[i].restartafter[0]))
-      trystart(i, name, 0) ;
-    else if (tain_less(&services[i].restartafter[0], &deadline))
-      deadline = services[i].restartafter[0] ;
+  for ( k = 0 ; k < TIMER_KINDS && k < 8 ; ++ k ) {
+    tain_t t ;
+
+    if ( ! r -> timer [ k ] . set ) { continue ; }
+    rexec_untain ( & t, r -> timer + k ) ;
+    timer_set ( i, k, & t ) ;
   }
+
+  svdirty ( i ) ;
 }
 
-static void scan ( void )
+/* read back what reexec () wrote */
+static void restore ( const int fd )
 {
-  unsigned int i = 0 ;
-  DIR * dir = NULL ;
+  struct stat st ;
+  struct rexec_hdr_s h ;
+  char * s ;
+  size_t pos ;
 
-  if ( ! wantscan ) return ;
+  if ( fstat ( fd, & st ) < 0 ) {
+    strerr_warnwu1sys ( "read the service table of the previous binary" ) ;
+    return ;
+  }
 
-  wantscan = 0 ;
-  tain_add_g ( & deadline, & defaulttimeout ) ;
-  dir = opendir ( "." ) ;
+  s = malloc ( st . st_size + 1 ) ;
 
-  if ( NULL == dir ) {
-    strerr_warnwu1sys ( "opendir ." ) ;
-    retrydirlater () ;
+  if ( ! s || allread ( fd, s, st . st_size ) < (size_t) st . st_size ) {
+    strerr_warnwu1sys ( "read the service table of the previous binary" ) ;
+    free ( s ) ;
+    fd_close ( fd ) ;
     return ;
   }
 
-  for ( ; i < n ; ++ i ) services [ i ] . flagactive = 0 ;
+  fd_close ( fd ) ;
+  if ( (size_t) st . st_size >= sizeof ( h ) ) { memcpy ( & h, s, sizeof ( h ) ) ; }
 
-  while ( 1 ) {
-    direntry * d = NULL ;
+  if ( (size_t) st . st_size < sizeof ( h ) || REXEC_MAGIC != h . magic ) {
+    strerr_warnw1x ( "invalid service table from the previous binary, starting afresh" ) ;
+    free ( s ) ;
+    return ;
+  }
 
-    errno = 0 ;
-    d = readdir ( dir ) ;
+  for ( pos = sizeof ( h ) ; pos + sizeof ( struct rexec_rec_s ) <= (size_t) st . st_size ; ) {
+    struct rexec_rec_s rec ;
+    char const * p ;
 
-    if ( d ) { check ( d -> d_name ) ; }
-    else { break ; }
-  }
+    memcpy ( & rec, s + pos, sizeof ( rec ) ) ;
+    pos += sizeof ( rec ) ;
+    if ( rec . len > st . st_size - pos || rec . fixed > rec . len ) { break ; }
+    p = s + pos ;
+    pos += rec . len ;
 
-  if ( errno ) {
-    strerr_warnwu1sys ( "readdir ." ) ;
-    retrydirlater () ;
-  }
+    switch ( rec . type ) {
+      case REXEC_GLOBAL : {
+          struct rexec_global_s g ;
 
-  dir_close ( dir ) ;
+          memset ( & g, 0, sizeof ( g ) ) ;
+          memcpy ( & g, p, rec . fixed < sizeof ( g ) ? rec . fixed : sizeof ( g ) ) ;
+          lsfd = g . lsfd ;
+          if ( g . finish < sizeof ( finishargs ) / sizeof ( * finishargs ) - 1 ) { finish_arg = finishargs [ g . finish ] ; }
+        }
+        break ;
+      case REXEC_SERVICE : {
+          struct rexec_sv_s r ;
+          char const * const name = p + rec . fixed ;
 
-  for ( i = 0 ; i < n ; ++ i )
-    if ( ! services [ i ] . flagactive && ! services [ i ] . pid [ 0 ] ) {
-    if ( services [ i ] . flaglog ) {
-      if ( services [ i ] . pid [ 1 ] ) continue ;
+          if ( rec . fixed == rec . len || name [ rec . len - rec . fixed - 1 ] ) { break ; }
+          memset ( & r, 0, sizeof ( r ) ) ;
+          memcpy ( & r, p, rec . fixed < sizeof ( r ) ? rec . fixed : sizeof ( r ) ) ;
+          restore_service ( & r, name ) ;
+        }
+        break ;
+      case REXEC_QUEUE : {
+          uint32_t k ;
+          size_t j ;
 
-      if ( services [ i ] . p [ 0 ] >= 0 ) {
-        fd_close ( services [ i ] . p [ 1 ] ) ; services [ i ] . p [ 1 ] = -1 ;
-        fd_close ( services [ i ] . p [ 0 ] ) ; services [ i ] . p [ 0 ] = -1 ;
-      }
+          for ( j = 0 ; j + sizeof ( k ) <= rec . fixed ; j += sizeof ( k ) ) {
+            memcpy ( & k, p + j, sizeof ( k ) ) ;
+            if ( k < n && services [ k ] . flagused ) { queue_push ( k ) ; }
+          }
+        }
+        break ;
     }
+  }
+
+  free ( s ) ;
 
-    services [ i ] = services [ -- n ] ;
+  if ( 0 <= lsfd ) {
+    (void) coe ( lsfd ) ;
+    if ( ev_add ( lsfd, EV_LISTEN, 0 ) < 0 ) {
+      strerr_warnwu1sys ( "watch the control socket" ) ;
+      fd_close ( lsfd ) ;
+      lsfd = -1 ;
+    }
+  } else {
+    lsfd = ctlsock_open () ;
+    if ( 0 > lsfd ) strerr_warnwu2sys ( "create control socket ", CONTROL_SOCKET ) ;
   }
+
+  wantdeps = 1 ;
 }
 
 static void sig_setup ( void )
@@ -495,10 +6895,13 @@ int main ( int argc, char const * const * argv )
   unsigned long int f = 0 ;
   const pid_t mypid = getpid () ;
   const uid_t myuid = getuid () ;
-  iopause_fd x [ 2 ] = { { -1, IOPAUSE_READ, 0 }, { -1, IOPAUSE_READ, 0 } } ;
+  int ctlfd = -1, spfd = -1, restorefd = -1 ;
 
   /* initialize global variables */
   PROG = "s6-svscan" ;
+  events_init () ;
+  progargv = argv ;
+  progargc = argc ;
   /* drop possible privileges we should not have */
   (void) seteuid ( myuid ) ;
   (void) setegid ( getgid () ) ;
@@ -524,7 +6927,7 @@ int main ( int argc, char const * const * argv )
     unsigned int t = 0 ;
 
     while ( 1 ) {
-      const int opt = subgetopt_r ( argc, argv, "Sst:c:d:", & l ) ;
+      const int opt = subgetopt_r ( argc, argv, "SsILt:c:d:r:b:j:m:p:D:P:i:X:", & l ) ;
 
       if ( 1 > opt ) { break ; }
 
@@ -535,6 +6938,12 @@ int main ( int argc, char const * const * argv )
         case 's' :
           divertsignals = 1 ;
           break ;
+        case 'I' :
+          inproc = 1 ;
+          break ;
+        case 'L' :
+          logmux = 1 ;
+          break ;
         case 't' :
           if ( uint0_scan ( l . arg, & t ) ) { break ; }
         case 'c' :
@@ -550,11 +6959,47 @@ int main ( int argc, char const * const * argv )
             return 100 ;
           }
 
-          if ( 0 > fcntl ( notif, F_GETFD ) ) {
+          /* gone with the previous binary after a re-exec */
+          if ( 0 > restorefd && 0 > fcntl ( notif, F_GETFD ) ) {
             strerr_dief1sys ( 100, "invalid notification fd" ) ;
             return 111 ;
           }
 
+          break ;
+        case 'r' :
+          if ( ! uint0_scan ( l . arg, & roots [ 0 ] . ratelimit ) ) dieusage () ;
+          break ;
+        case 'b' :
+          if ( ! uint0_scan ( l . arg, & roots [ 0 ] . burst ) ) dieusage () ;
+          if ( ! roots [ 0 ] . burst ) roots [ 0 ] . burst = 1 ;
+          break ;
+        case 'j' :
+          if ( ! uint0_scan ( l . arg, & maxstarting ) ) dieusage () ;
+          break ;
+        case 'm' :
+          statusfn = l . arg ;
+          break ;
+        case 'p' :
+          adoptfn = l . arg ;
+          break ;
+        case 'D' :
+          dbfn = l . arg ;
+          break ;
+        case 'P' :
+          if ( ! uint0_scan ( l . arg, & psistall ) || ! psistall || 1000 <= psistall ) dieusage () ;
+          psistall *= 1000 ;
+          break ;
+        case 'i' :
+          if ( ! uint0_scan ( l . arg, & settlemax ) ) dieusage () ;
+          break ;
+        case 'X' : {
+            unsigned int fd ;
+
+            /* from reexec (), always first */
+            if ( ! uint0_scan ( l . arg, & fd ) || 3 != l . ind ) dieusage () ;
+            restorefd = fd ;
+            progskip = 2 ;
+          }
           break ;
         default :
           dieusage () ;
@@ -566,10 +7011,12 @@ int main ( int argc, char const * const * argv )
     argc -= l . ind ;
     argv += l . ind ;
 
-    if ( t ) tain_from_millisecs ( & defaulttimeout, t ) ;
-    else defaulttimeout = tain_infinite_relative ;
+    if ( t ) tain_from_millisecs ( & roots [ 0 ] . timeout, t ) ;
+    else roots [ 0 ] . timeout = tain_infinite_relative ;
 
     if ( max < 2 ) max = 2 ;
+    roots [ 0 ] . max = max ;
+    if ( 1 == mypid && ! adoptfn ) adoptfn = ADOPT_FILE ;
   }
 
   /* Init phase.
@@ -579,43 +7026,98 @@ int main ( int argc, char const * const * argv )
    */
   if ( 0 < argc && 0 != chdir ( argv [ 0 ] ) ) strerr_diefu1sys ( 111, "chdir" ) ;
 
-  x [ 1 ] . fd = s6_supervise_lock ( S6_SVSCAN_CTLDIR ) ;
-  x [ 0 ] . fd = selfpipe_init () ;
+  ctlfd = s6_supervise_lock ( S6_SVSCAN_CTLDIR ) ;
+  roots_load () ;
+  spfd = selfpipe_init () ;
 
-  if ( x [ 0 ] . fd < 0 ) strerr_diefu1sys ( 111, "selfpipe_init" ) ;
+  if ( spfd < 0 ) strerr_diefu1sys ( 111, "selfpipe_init" ) ;
+
+  if ( ev_init () < 0 || ev_add ( spfd, EV_SELFPIPE, 0 ) < 0 || ev_add ( ctlfd, EV_CONTROL, 0 ) < 0 )
+    strerr_diefu1sys ( 111, "set up the event loop" ) ;
+
+  {
+    unsigned int k ;
+
+    for ( k = 0 ; k < CLIENT_MAX ; ++ k ) { clients [ k ] . fd = -1 ; }
+  }
+
+  /* not fatal: the control fifo still works without it. after a
+   * re-exec, the previous binary's socket is kept instead */
+  if ( 0 > restorefd ) {
+    lsfd = ctlsock_open () ;
+    if ( 0 > lsfd ) strerr_warnwu2sys ( "create control socket ", CONTROL_SOCKET ) ;
+  }
 
   if ( sig_ignore ( SIGPIPE ) < 0 ) strerr_diefu1sys ( 111, "ignore SIGPIPE" ) ;
 
   {
-    sigset_t set ;
-    sigemptyset ( & set ) ;
-    sigaddset ( & set, SIGCHLD ) ;
-    sigaddset ( & set, SIGALRM ) ;
-    sigaddset ( & set, SIGTERM ) ;
-    sigaddset ( & set, SIGHUP ) ;
-    sigaddset ( & set, SIGQUIT ) ;
-    sigaddset ( & set, SIGABRT ) ;
-    sigaddset ( & set, SIGINT ) ;
+    sigset_t * const set = & trapped ;
+    sigemptyset ( set ) ;
+    sigaddset ( set, SIGCHLD ) ;
+    sigaddset ( set, SIGALRM ) ;
+    sigaddset ( set, SIGTERM ) ;
+    sigaddset ( set, SIGHUP ) ;
+    sigaddset ( set, SIGQUIT ) ;
+    sigaddset ( set, SIGABRT ) ;
+    sigaddset ( set, SIGINT ) ;
 
     if ( divertsignals ) {
-      sigaddset ( & set, SIGUSR1 ) ;
-      sigaddset ( & set, SIGUSR2 ) ;
+      sigaddset ( set, SIGUSR1 ) ;
+      sigaddset ( set, SIGUSR2 ) ;
     }
 
-    if ( selfpipe_trapset ( & set ) < 0 ) strerr_diefu1sys ( 111, "trap signals" ) ;
+    if ( selfpipe_trapset ( set ) < 0 ) strerr_diefu1sys ( 111, "trap signals" ) ;
   }
 
-  if ( notif ) {
+#ifndef STAGE2_FORK
+  if ( spawn_init () < 0 ) strerr_diefu1sys ( 111, "initialize spawn attributes" ) ;
+#endif
+
+  if ( notif && 0 <= restorefd ) {
+    notif = 0 ;
+  } else if ( notif ) {
     fd_write ( notif, "\n", 1 ) ;
     fd_close ( notif ) ;
     notif = 0 ;
   }
 
+  /* at most 4 pids per service, and the index at most half full */
+  pidmask = 7 ;
+  while ( pidmask < (size_t) max * 8 - 1 ) { pidmask = pidmask << 1 | 1 ; }
+
   {
-    struct svinfo_s blob [ max ] ; /* careful with that stack, Eugene */
-    services = blob ;
+    /* the per slot tables, in one block off the stack: at -c 50000 they
+     * are tens of megabytes. per service: one of service, ready and
+     * finish, one of log and logfinish, idle and probe timers.
+     */
+#define S2ROUND(n) ( ( (n) + 15 ) & ~(size_t) 15 )
+    size_t const svlen = S2ROUND ( (size_t) max * sizeof ( struct svinfo_s ) ) ;
+    size_t const tlen = S2ROUND ( (size_t) max * 4 * sizeof ( struct timer_s ) ) ;
+    size_t const plen = S2ROUND ( ( pidmask + 1 ) * sizeof ( struct pident_s ) ) ;
+    size_t const alen = S2ROUND ( ( adoptfn ? max : 1 ) * sizeof ( struct adopt_ent_s ) ) ;
+    size_t const dlen = S2ROUND ( ( statusfn ? max : 1 ) * sizeof ( unsigned int ) ) ;
+#undef S2ROUND
+    char * const blob = calloc ( 1, svlen + tlen + plen + alen + dlen + ( statusfn ? max : 1 ) ) ;
+    tain_t woke ;
+    unsigned int k ;
+    if ( ! blob ) strerr_diefu1sys ( 111, "allocate the service tables" ) ;
+    services = (struct svinfo_s *) blob ;
+    timers = (struct timer_s *) ( blob + svlen ) ;
+    pids = (struct pident_s *) ( blob + svlen + tlen ) ;
+    adoptlast = (struct adopt_ent_s *) ( blob + svlen + tlen + plen ) ;
+    dirty = (unsigned int *) ( blob + svlen + tlen + plen + alen ) ;
+    dirtymark = (unsigned char *) ( blob + svlen + tlen + plen + alen + dlen ) ;
+    if ( statusfn ) status_open () ;
     tain_now_g () ;
-
+    event ( S2EV_START, ( 0 <= restorefd ) ? S2EV_REEXEC : 0, S2EV_NOSLOT, mypid, 0 ) ;
+    for ( k = 0 ; k < nroots ; ++ k ) {
+      roots [ k ] . tokenstamp = STAMP ;
+      roots [ k ] . tokens = (uint64_t) roots [ k ] . burst * 1000 ;
+    }
+    tain_addsec_g ( & settleuntil, settlemax ) ;
+    if ( 0 <= restorefd ) restore ( restorefd ) ;
+    else if ( adoptfn ) adopt_load () ;
+    psi_open () ;
 
     /* Loop phase.
      * From now on, we must not die.
@@ -623,31 +7125,100 @@ int main ( int argc, char const * const * argv )
      */
     while ( cont ) {
       int r = 0 ;
+      uint64_t tags [ MAX_EVENTS ] ;
+      tain_t deadline ;
 
       reap () ;
+      handle_clients () ;
+      run_timers () ;
+      pressure_check () ;
       scan () ;
+      adopt_forget () ;
+      startwaiting () ;
+      drain_queue () ;
+      settle_check () ;
       killthem () ;
-      r = iopause_g ( x, 2, & deadline ) ;
+      status_publish () ;
+      adopt_publish () ;
 
-      if ( r < 0 ) panic ( "iopause" ) ;
-      else if ( ! r ) wantscan = 1 ;
-      else {
-        if ( ( x [ 0 ] . revents | x [ 1 ] . revents ) & IOPAUSE_EXCEPT ) {
-          errno = EIO ;
-          panic("check internal pipes") ;
-        }
+      if ( wantreexec ) {
+        wantreexec = 0 ;
+        reexec () ;
+      }
+
+      if ( nloops ++ ) { loop_account ( & woke ) ; }
+
+      /* sleep until the next timer, the next periodic scan of a root
+       * or the next token for a spawn rate limiter is due, not at all
+       * if a budget ran out */
+      deadline = roots [ 0 ] . deadline ;
+      for ( k = 1 ; k < nroots ; ++ k )
+        if ( tain_less ( & roots [ k ] . deadline, & deadline ) ) deadline = roots [ k ] . deadline ;
+      if ( ntimers && tain_less ( & timers [ 0 ] . when, & deadline ) ) deadline = timers [ 0 ] . when ;
+      if ( pressure && tain_less ( & pressureuntil, & deadline ) ) deadline = pressureuntil ;
+      if ( settling ) {
+        tain_t const * const d = wantsettle ? & settlepoll : & settleuntil ;
+        if ( tain_less ( d, & deadline ) ) deadline = * d ;
+      }
+      {
+        tain_t q ;
+        if ( queue_deadline ( & q ) && tain_less ( & q, & deadline ) ) deadline = q ;
+      }
+      if ( wantreap || wantclients ) deadline = STAMP ;
+
+      r = ev_wait ( tags, MAX_EVENTS, & deadline ) ;
+      woke = STAMP ;
 
-        if ( x [ 0 ] . revents & IOPAUSE_READ )
-          divertsignals ? handle_diverted_signals () : handle_signals () ;
+      if ( r < 0 ) panic ( "check internal pipes" ) ;
 
-        if ( x [ 1 ] . revents & IOPAUSE_READ ) handle_control ( x [ 1 ] . fd ) ;
+      for ( k = 0 ; k < nroots ; ++ k )
+        if ( ! tain_future ( & roots [ k ] . deadline ) ) roots [ k ] . wantscan = 1 ;
+
+      while ( r -- ) {
+        switch ( tags [ r ] >> 32 ) {
+          case EV_SELFPIPE :
+            divertsignals ? handle_diverted_signals () : handle_signals () ;
+            break ;
+          case EV_CONTROL :
+            handle_control ( ctlfd ) ;
+            break ;
+          case EV_SVCONTROL :
+            handle_svcontrol ( (uint32_t) tags [ r ] >> 1, tags [ r ] & 1 ) ;
+            break ;
+          case EV_LISTEN :
+            handle_accept () ;
+            break ;
+          case EV_LOG :
+            if ( services [ (uint32_t) tags [ r ] ] . lm ) logmux_read ( (uint32_t) tags [ r ] ) ;
+            break ;
+          case EV_CLIENT :
+            if ( 0 <= clients [ (uint32_t) tags [ r ] ] . fd ) handle_client ( (uint32_t) tags [ r ] ) ;
+            break ;
+          case EV_ACTIVATE :
+            if ( services [ (uint32_t) tags [ r ] ] . ls ) handle_activate ( (uint32_t) tags [ r ] ) ;
+            break ;
+          case EV_NOTIFY :
+            if ( 0 <= services [ (uint32_t) tags [ r ] ] . nfd ) handle_notify ( (uint32_t) tags [ r ] ) ;
+            break ;
+          case EV_PIDFD :
+            handle_pidfd ( (uint32_t) tags [ r ] >> 1, tags [ r ] & 1 ) ;
+            break ;
+          case EV_PSI :
+            handle_psi () ;
+            break ;
+          case EV_PROBE :
+            handle_probe ( (uint32_t) tags [ r ] ) ;
+            break ;
+        }
       }
     }
 
     /* Finish phase */
+    if ( 0 <= lsfd ) (void) unlink ( CONTROL_SOCKET ) ;
     selfpipe_finish () ;
     killthem () ;
     reap () ;
+    if ( adoptfn ) (void) unlink ( adoptfn ) ;
   }
 
   {